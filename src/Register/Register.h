@@ -2,131 +2,227 @@
 #define REGISTER_H
 
 #include <cmath>
+#include <cassert>
 #include <iostream>
-#include <unordered_map>
 #include <stdint.h>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <array>
-// #include <vector>
-// #include <any>
+#include <vector>
+#include <unordered_map>
+#include <utility>
 
 namespace SST {
 namespace phnsw {
 
-template <typename T>
-struct RegTemp {
-    size_t size;
-    std::string description;
-    T reg;
+/*
+ * All registers of the core, {name, element type, element count, description}.
+ * raw1, raw2, raw_res (bytes of a raw vector: dim elements of the image format), pq_code (pq_m), C_* (queueCCapacity)
+ * and W_* (ef) counts are defaults, resized from params.
+ * The order here is the register index (Reg::Id), names are only looked up by the assembler.
+ */
+#define PHNSW_REGISTERS(X)                                                          \
+    /* Sources */                                                                   \
+    X(raw1,              uint8_t,  512, "DistCalc, raw vector in the image format")  \
+    X(raw2,              uint8_t,  512, "DistCalc, raw vector in the image format")  \
+    X(pq_code,           uint8_t,  16,  "DIST PQ, PQ code of a node (pq_m bytes)")   \
+    X(list,              uint32_t, 10,  "LookUp")                                   \
+    X(list_index,        uint32_t, 10,  "LookUp")                                   \
+    X(target,            uint32_t, 1,   "LookUp")                                   \
+    X(cmp1,              uint32_t, 1,   "CMP")                                      \
+    X(cmp2,              uint32_t, 1,   "CMP")                                      \
+    X(dma_addr,          uint64_t, 1,   "DMA start addr")                           \
+    X(DMAindex,          uint32_t, 1,   "Raw data or Neighbors of point(index)")    \
+    X(dma_offset,        uint64_t, 1,   "DMA read length")                          \
+    X(num1,              uint8_t,  1,   "ALU")                                      \
+    X(num2,              uint8_t,  1,   "ALU")                                      \
+    X(vst_index,         uint32_t, 1,   "VISIT")                                    \
+    X(jmp_addr,          uint64_t, 1,   "JMP")                                      \
+    X(raw_index,         uint8_t,  1,   "fetch RAW from SPM")                       \
+    X(wrm_index,         uint32_t, 1,   "WRM")                                      \
+    X(index2addr,        uint32_t, 1,   "index2addr")                               \
+    X(acw_index,         uint32_t, 1,   "ACW")                                      \
+    X(query_index,       uint32_t, 1,   "index of the current query")               \
+    X(ep_index,          uint32_t, 1,   "entry point of the current query")         \
+    X(layer,             uint32_t, 1,   "layer of DMA N")                           \
+    /* Destinations */                                                              \
+    X(dist_res,          uint32_t, 1,   "DistCalc")                                 \
+    X(look_res_index,    uint32_t, 1,   "LookUp")                                   \
+    X(look_res_dist,     uint32_t, 1,   "LookUp")                                   \
+    X(cmp_res,           uint8_t,  1,   "CMP")                                      \
+    X(dma_res,           uint64_t, 1,   "DMA")                                      \
+    X(alu_res,           uint8_t,  1,   "ALU")                                      \
+    X(vst_res,           uint8_t,  1,   "VISIT")                                    \
+    X(raw_res,           uint8_t,  512, "RAW")                                      \
+    X(addr,              uint32_t, 1,   "index2addr")                               \
+    X(rmc_dist,          uint32_t, 1,   "RMC, min of C")                            \
+    X(rmc_index,         uint32_t, 1,   "RMC, min of C")                            \
+    X(rmw_dist,          uint32_t, 1,   "RMW, max of W")                            \
+    X(rmw_index,         uint32_t, 1,   "RMW, max of W")                            \
+    X(acw_dist,          uint32_t, 1,   "ACW, max of W once full")                  \
+    X(nei_index,         uint32_t, 1,   "lower bound index")                        \
+    X(nei_dist,          uint32_t, 1,   "lower bound dist")                         \
+    X(dma_tag,           uint32_t, 1,   "tag of the last DMA operation, for WAIT")  \
+    X(max_level,         uint32_t, 1,   "DMA L, top layer of DMAindex")             \
+    /* Vars */                                                                      \
+    X(C_dist,            uint32_t, 360, "Candidate Dist")                           \
+    X(C_index,           uint32_t, 360, "Candidate Index")                          \
+    X(C_size,            uint32_t, 1,   "Candidate Size")                           \
+    X(W_index,           uint32_t, 40,  "Wait Index")                               \
+    X(W_dist,            uint32_t, 40,  "Wait Dist")                                \
+    X(W_size,            uint32_t, 1,   "Wait Size")                                \
+    X(current_node,      uint32_t, 1,   "current node")                             \
+    X(CN_neighbor_index, uint32_t, 1,   "Current Node NeighborList indexs")         \
+    X(i,                 uint32_t, 1,   "temp var")                                 \
+    X(i20,               uint32_t, 1,   "temp var")                                 \
+    X(dist1,             uint32_t, 1,   "dist1")                                    \
+    X(cur_dist,          uint32_t, 1,   "greedy descent: dist of current_node")     \
+    X(changed,           uint32_t, 1,   "greedy descent: current_node moved")
 
-    RegTemp() = default;
-    RegTemp(const std::string& desc, const T& value)
-        : description(desc), reg(value), size(sizeof(T)) {}
-};
+namespace Reg {
+    /* Register index, usable as a compile time constant: Reg::C_size, Reg::raw1 ... */
+    enum Id : uint16_t {
+#define PHNSW_REG_ID(name, type, count, desc) name,
+        PHNSW_REGISTERS(PHNSW_REG_ID)
+#undef PHNSW_REG_ID
+        NUM,
+        NONE = 0xffff
+    };
+
+    enum Type : uint8_t { U8, U32, U64, F32 };
 
+    template <typename T> constexpr Type type_of();
+    template <> constexpr Type type_of<uint8_t>()  { return U8; }
+    template <> constexpr Type type_of<uint32_t>() { return U32; }
+    template <> constexpr Type type_of<uint64_t>() { return U64; }
+    template <> constexpr Type type_of<float>()    { return F32; }
+
+    struct Desc {
+        const char *name;
+        const char *description;
+        Type type;
+        uint8_t elem_size;
+        uint32_t count;
+    };
+
+    /* Static description of every register, indexed by Reg::Id */
+    constexpr Desc desc[NUM] = {
+#define PHNSW_REG_DESC(name, type, count, descr) {#name, descr, type_of<type>(), sizeof(type), count},
+        PHNSW_REGISTERS(PHNSW_REG_DESC)
+#undef PHNSW_REG_DESC
+    };
+} // namespace Reg
+
+/*
+ * Register file of one query context of a core.
+ * All registers live in one contiguous buffer, each one at a fixed offset
+ * computed from the element counts, so access by Reg::Id is one table load and an add.
+ * Counts start from Reg::desc, registers sized by the index shape (dim, M, ef)
+ * are resized once at construction of the core.
+ */
 struct Register {
-    // @description: all reg map
-    // @param {size_t} size
-    // @param {std::string} description
-    // @param {void *} reg_ptr<std::array<uint8_t,  128>, std::array<uint32_t, 10>, uint8_t, uint32_t, uint64_t>
-    std::unordered_map<std::string, void*> reg_map;
-    
-    /* {"reg_name", "description", init value} */
+    struct Slot {
+        uint32_t offset;
+        uint32_t size;
+    };
+
     Register () {
-        // Sources
-        reg_map["raw1"]        = new RegTemp<std::array<float_t,  128>>{"DistCalc", {0}};
-        reg_map["raw2"]        = new RegTemp<std::array<float_t,  128>>{"DistCalc", {0}};
-        reg_map["list"]        = new RegTemp<std::array<uint32_t, 10>>{"LookUp", {0}};
-        reg_map["list_index"]  = new RegTemp<std::array<uint32_t, 10>>{"LookUp", {0}};
-        reg_map["target"]      = new RegTemp<uint32_t>{"LookUp", 0};
-        reg_map["cmp1"]        = new RegTemp<uint32_t>{"CMP", 0};
-        reg_map["cmp2"]        = new RegTemp<uint32_t>{"CMP", 0};
-        reg_map["dma_addr"]    = new RegTemp<uint64_t>{"DMA start addr", 0};
-        reg_map["DMAindex"]      = new RegTemp<uint32_t>{"Raw data or Neighbors of point(index)", 0};
-        reg_map["dma_offset"]  = new RegTemp<uint64_t>{"DMA read length", 0};
-        reg_map["num1"]        = new RegTemp<uint8_t>{"ALU", 0};
-        reg_map["num2"]        = new RegTemp<uint8_t>{"ALU", 0};
-        reg_map["vst_index"] = new RegTemp<uint32_t>{"VISIT", 0};
-        reg_map["jmp_addr"]    = new RegTemp<uint64_t>{"JMP", 0};
-        reg_map["raw_index"]   = new RegTemp<uint8_t>{"fetch RAW from SPM", 0};
-        reg_map["wrm_index"]   = new RegTemp<uint32_t>{"WRM", 0};
-        reg_map["index2addr"]  = new RegTemp<uint32_t>{"index2addr", 0};
-        reg_map["acw_index"]   = new RegTemp<uint32_t>{"ACW", 0};
-          // Destinations
-        reg_map["dist_res"]       = new RegTemp<uint32_t>{"DistCalc", 0};
-        reg_map["look_res_index"] = new RegTemp<uint32_t>{"LookUp", 0};
-        reg_map["look_res_dist"]  = new RegTemp<uint32_t>{"LookUp", 0};
-        reg_map["cmp_res"]        = new RegTemp<uint8_t>{"CMP", 0};
-        reg_map["dma_res"]        = new RegTemp<uint64_t>{"DMA", 0};
-        reg_map["alu_res"]        = new RegTemp<uint8_t>{"ALU", 0};
-        reg_map["vst_res"]      = new RegTemp<uint8_t>{"VISIT", 0};
-        reg_map["raw_res"]        = new RegTemp<std::array<float, 128>>{"RAW", {0}};
-        reg_map["addr"]           = new RegTemp<uint32_t>{"index2addr", 0};
-        reg_map["rmc_dist"]       = new RegTemp<uint32_t>{"RMC", 0};
-        reg_map["rmc_index"]       = new RegTemp<uint32_t>{"RMC", 0};
-        reg_map["rmw_dist"]       = new RegTemp<uint32_t>{"RMW", 0};
-        reg_map["rmw_index"]       = new RegTemp<uint32_t>{"RMW", 0};
-        reg_map["acw_dist"]       = new RegTemp<uint32_t>{"RMW", 0};
-        reg_map["acw_index"]       = new RegTemp<uint32_t>{"RMW", 0};
-        reg_map["nei_index"]        = new RegTemp<uint32_t>{"lower bound index", 0};
-        reg_map["nei_dist"]         = new RegTemp<uint32_t>{"lower bound dist", 0};
-        // Vars
-        reg_map["C_dist"]            = new RegTemp<std::array<uint32_t, 360>>{"Candidate Dist", {0}};
-        reg_map["C_index"]           = new RegTemp<std::array<uint32_t, 360>>{"Candidate Index", {0}};
-        reg_map["C_size"]            = new RegTemp<uint32_t>{"Candidate Size", 0};
-        reg_map["W_index"]           = new RegTemp<std::array<uint32_t, 40>>{"Wait Index", {0}};
-        reg_map["W_dist"]            = new RegTemp<std::array<uint32_t, 40>>{"Wait Dist", {0}};
-        reg_map["W_size"]            = new RegTemp<uint32_t>{"Wait Size", 0};
-        reg_map["current_node"]      = new RegTemp<uint32_t>{"current node", 0};
-        reg_map["CN_neighbor_index"] = new RegTemp<uint32_t>{"Current Node NeighborList indexs", {0}};
-        reg_map["i"]                 = new RegTemp<uint32_t>{"temp var", 0};
-        reg_map["i20"]               = new RegTemp<uint32_t>{"temp var", 0};
-        reg_map["dist1"]             = new RegTemp<uint32_t>{"dist1", 0};
-        std::cout << "Register init done" << std::endl;
+        for (size_t id = 0; id < Reg::NUM; id++) counts[id] = Reg::desc[id].count;
+        layout();
     }
 
     /**
-     * @description: find match register by name and return its reg_ptr and size
-     * @param {string& name} name to find
-     * @param {size_t& size} size of register to return
-     * @return {void *} reg ptr
+     * @description: set the element count of some registers, lay the file out again and clear it
+     * @param {vector<pair<Reg::Id, uint32_t>>&} new_counts {register, count}, count at least 1
+     * @return {*}
      */
-    void* find_match(const std::string& name, size_t& size) {
-        if (reg_map.find(name) == reg_map.end()) {
-            std::cout << "Register not found: " << name << std::endl;
-            throw "Register not found: ";
+    void resize(const std::vector<std::pair<Reg::Id, uint32_t>> &new_counts) {
+        for (auto &&count : new_counts) {
+            assert(count.second > 0);
+            counts[count.first] = count.second;
         }
-        size = *(size_t *) (reg_map[name]);
-        if (size == sizeof(std::array<float, 128>)) {
-            return &((RegTemp<std::array<float, 128>> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(std::array<uint32_t, 10>)) {
-            return &((RegTemp<std::array<uint32_t, 10>> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(std::array<uint32_t, 40>)) { // W
-            return &((RegTemp<std::array<uint32_t, 40>> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(std::array<uint32_t, 360>)) { // C
-            return &((RegTemp<std::array<uint32_t, 360>> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(uint8_t)) {
-            return &((RegTemp<uint8_t> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(uint32_t)) {
-            return &((RegTemp<uint32_t> *) (reg_map[name]))->reg;
-        } else if (size == sizeof(uint64_t)) {
-            return &((RegTemp<uint64_t> *) (reg_map[name]))->reg;
-        }
-        std::cout << "Register type not found: " << name << std::endl;
-        throw "Register type not found";
+        layout();
+    }
+
+    /**
+     * @description: clear every register to 0
+     * @return {*}
+     */
+    void reset() {
+        std::memset(storage.data(), 0, storage.size() * sizeof(Line));
+    }
+
+    void *slot(Reg::Id id) {
+        return (uint8_t *) storage.data() + slots[id].offset;
+    }
+
+    const void *slot(Reg::Id id) const {
+        return (const uint8_t *) storage.data() + slots[id].offset;
+    }
+
+    /**
+     * @description: typed pointer to the first element of a register
+     * @param {Reg::Id} id register
+     * @return {T *}
+     */
+    template <typename T>
+    T *ptr(Reg::Id id) {
+        assert(Reg::desc[id].type == Reg::type_of<T>());
+        return (T *) slot(id);
+    }
+
+    template <typename T>
+    T &ref(Reg::Id id) {
+        return *ptr<T>(id);
+    }
+
+    size_t size(Reg::Id id) const {
+        return slots[id].size;
+    }
+
+    uint32_t count(Reg::Id id) const {
+        return counts[id];
+    }
+
+    /**
+     * @description: find register by name, only used by the assembler
+     * @param {string&} name to find
+     * @return {Reg::Id} Reg::NONE if not found
+     */
+    static Reg::Id find(const std::string& name) {
+        static const std::unordered_map<std::string, Reg::Id> names = [] {
+            std::unordered_map<std::string, Reg::Id> m;
+            for (size_t id = 0; id < Reg::NUM; id++) {
+                m[Reg::desc[id].name] = (Reg::Id) id;
+            }
+            return m;
+        }();
+        auto found = names.find(name);
+        return found == names.end() ? Reg::NONE : found->second;
     }
 
-    size_t find_size(const std::string& name) {
-        if (reg_map.find(name) == reg_map.end()) {
-            // throw "Register not found: ";
-            return 0;
+private:
+    struct alignas(64) Line { uint8_t bytes[64]; };
+    std::array<uint32_t, Reg::NUM> counts;
+    std::array<Slot, Reg::NUM> slots;
+    std::vector<Line> storage;
+
+    void layout() {
+        uint32_t offset = 0;
+        for (size_t id = 0; id < Reg::NUM; id++) {
+            uint32_t size = Reg::desc[id].elem_size * counts[id];
+            uint32_t align = counts[id] > 1 ? sizeof(Line) : sizeof(uint64_t);
+            offset = (offset + align - 1) / align * align;
+            slots[id] = {offset, size};
+            offset += size;
         }
-        return *(size_t *) (reg_map[name]);
+        storage.resize((offset + sizeof(Line) - 1) / sizeof(Line));
+        reset();
     }
 };
 
 } // namespace phnsw
 } // namespace SST
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,453 @@
+#!/usr/bin/env python3
+# Build a phnsw memory image from .fvecs/.bvecs vectors and an HNSW index (hnswlib or faiss IndexHNSWFlat).
+# The image starts with the header of src/image.h, then the node indexed regions:
+#   layer 0 neighbor lists | raw vectors (nodes, then queries) | upper layer lists | top layer bytes | u8 scale, offset
+#   | PQ codebook | PQ codes (nodes) | labels (nodes, shards only)
+# Raw vectors are stored as f32, f16 or u8 codes (x = offset + scale * code per dimension).
+# --pq M adds product quantization codes of M bytes per node for DIST PQ (needs numpy).
+# --shard s --shards S marks the image as shard s of a sharded index and stores the label
+# (global id) of every node; the index of a shard is built on its part of the base vectors
+# with the global ids as labels.
+# Everything is streamed region by region, only the per node top layer (and the hnswlib labels
+# when --base is given) stay in memory, so 1M-10M vector images build in one pass over the index.
+#
+# e.g. python3 build_image.py --index sift_hnsw.bin --base sift_base.fvecs --queries sift_query.fvecs \
+#          --out sift/output.bin --query-list sift/queries.txt
+import argparse
+import array
+import os
+import struct
+import sys
+
+try:
+    import numpy as np  # only --pq needs it
+except ImportError:
+    np = None
+
+# Keep in sync with ImageHeader in src/image.h
+MAGIC = b"PHNSWIMG"
+VERSION = 4
+HEADER = struct.Struct("<8s8I12Q2I4Q2I")
+ELEMS = {"f32": (0, 4), "f16": (1, 2), "u8": (2, 1)}  # ImageElem, bytes
+ALIGN = 4096
+PQ_KSUB = 256  # centroids per subspace, IMAGE_PQ_KSUB
+
+
+def align(n, a=ALIGN):
+    return (n + a - 1) // a * a
+
+
+class Vecs:
+    """Row access to a .fvecs (int32 dim + float32 x dim) or .bvecs (int32 dim + uint8 x dim) file."""
+
+    def __init__(self, path):
+        self.path = path
+        self.elem = "B" if path.endswith(".bvecs") else "f"
+        self.file = open(path, "rb")
+        (self.dim,) = struct.unpack("<i", self.file.read(4))
+        self.row_size = 4 + self.dim * array.array(self.elem).itemsize
+        self.count = os.path.getsize(path) // self.row_size
+
+    def row(self, n):
+        self.file.seek(n * self.row_size + 4)
+        return self._floats(self.file.read(self.row_size - 4))
+
+    def rows(self, chunk=4096):
+        self.file.seek(0)
+        for first in range(0, self.count, chunk):
+            data = self.file.read(min(chunk, self.count - first) * self.row_size)
+            for offset in range(0, len(data), self.row_size):
+                yield self._floats(data[offset + 4:offset + self.row_size])
+
+    def _floats(self, data):
+        """float32 rows, .bvecs rows stay bytes ("B") so u8 can store them as they are"""
+        v = array.array(self.elem)
+        v.frombytes(data)
+        return v
+
+
+class Encoder:
+    """Raw vector bytes of one format. u8 maps [min, max] of every dimension to codes 0 .. 255,
+    byte vectors are kept as they are (scale 1, offset 0), so .bvecs datasets are exact."""
+
+    def __init__(self, fmt, dim):
+        self.fmt = fmt
+        self.dim = dim
+        self.scale = [1.0] * dim
+        self.offset = [0.0] * dim
+        self.low = None
+        self.high = None
+
+    def observe(self, vector):
+        """range pass of u8, over every base vector"""
+        if vector.typecode == "B":
+            return
+        if self.low is None:
+            self.low, self.high = list(vector), list(vector)
+            return
+        self.low = list(map(min, self.low, vector))
+        self.high = list(map(max, self.high, vector))
+
+    def fit(self):
+        if self.low is not None:
+            self.offset = self.low
+            self.scale = [(h - l) / 255 or 1.0 for l, h in zip(self.low, self.high)]
+        # the core multiplies float32 values
+        self.scale = list(array.array("f", self.scale))
+        self.offset = list(array.array("f", self.offset))
+
+    def quant(self):
+        return array.array("f", self.scale + self.offset).tobytes()
+
+    def encode(self, vector):
+        if self.fmt == "f32":
+            return (vector if vector.typecode == "f" else array.array("f", vector)).tobytes()
+        if self.fmt == "f16":
+            return struct.pack("<%de" % self.dim, *vector)
+        if vector.typecode == "B" and self.low is None:
+            return vector.tobytes()
+        return bytes(min(255, max(0, int(round((x - o) / s)))) for x, o, s in zip(vector, self.offset, self.scale))
+
+
+class ProductQuantizer:
+    """M subspaces of dim / M dimensions, PQ_KSUB centroids each, trained by k-means on a sample."""
+
+    def __init__(self, m, dim, iters, seed=7):
+        if np is None:
+            sys.exit("ERROR: --pq needs numpy")
+        if dim % m:
+            sys.exit("ERROR: --pq %d must divide dim %d" % (m, dim))
+        self.m = m
+        self.dsub = dim // m
+        self.iters = iters
+        self.rng = np.random.default_rng(seed)
+        self.centroids = None  # [m][PQ_KSUB][dsub]
+
+    def train(self, sample):
+        x = np.asarray(sample, dtype=np.float32)
+        self.centroids = np.empty((self.m, PQ_KSUB, self.dsub), dtype=np.float32)
+        for sub in range(self.m):
+            xs = x[:, sub * self.dsub:(sub + 1) * self.dsub]
+            c = xs[self.rng.choice(len(xs), PQ_KSUB, replace=len(xs) < PQ_KSUB)].copy()
+            for _ in range(self.iters):
+                assign = self._nearest(xs, c)
+                for k in range(PQ_KSUB):
+                    members = xs[assign == k]
+                    if len(members):
+                        c[k] = members.mean(axis=0)
+            self.centroids[sub] = c
+
+    @staticmethod
+    def _nearest(xs, c):
+        d = (xs * xs).sum(1)[:, None] - 2 * xs @ c.T + (c * c).sum(1)[None, :]
+        return d.argmin(1)
+
+    def encode(self, rows):
+        x = np.asarray(rows, dtype=np.float32)
+        codes = np.empty((len(x), self.m), dtype=np.uint8)
+        for sub in range(self.m):
+            codes[:, sub] = self._nearest(x[:, sub * self.dsub:(sub + 1) * self.dsub], self.centroids[sub])
+        return codes.tobytes()
+
+    def codebook(self):
+        return self.centroids.tobytes()
+
+
+class Region:
+    """Sequential writer of one image region, with its own file handle."""
+
+    def __init__(self, path, offset):
+        self.file = open(path, "r+b")
+        self.file.seek(offset)
+        self.buf = bytearray()
+
+    def write(self, data):
+        self.buf += data
+        if len(self.buf) >= 1 << 22:
+            self.flush()
+
+    def flush(self):
+        self.file.write(self.buf)
+        self.buf = bytearray()
+
+    def close(self):
+        self.flush()
+        self.file.close()
+
+
+def pad_list(ids, count, self_id):
+    """count ids, short lists padded with the node's own id (what the search skips as visited)"""
+    ids = [i for i in ids[:count] if i >= 0]
+    return array.array("I", ids + [self_id] * (count - len(ids))).tobytes()
+
+
+def read_vector(f, fmt):
+    (n,) = struct.unpack("<Q", f.read(8))
+    v = array.array(fmt)
+    v.frombytes(f.read(n * v.itemsize))
+    return v
+
+
+def skip_vector(f, itemsize):
+    (n,) = struct.unpack("<Q", f.read(8))
+    pos = f.tell()
+    f.seek(n * itemsize, 1)
+    return pos, n
+
+
+class HnswlibIndex:
+    """hnswlib HierarchicalNSW::saveIndex format: a fixed header, the level 0 block
+    (list, vector and label of every element), then the upper lists of every element."""
+
+    def __init__(self, path, dim):
+        self.path = path
+        f = open(path, "rb")
+        (self.offset_level0, self.max_elements, self.nodes, self.element_size, self.label_offset,
+         self.data_offset) = struct.unpack("<6Q", f.read(48))
+        self.max_level, self.entry_point = struct.unpack("<iI", f.read(8))
+        self.upper_degree, self.degree, self.m = struct.unpack("<3Q", f.read(24))
+        f.read(16)  # mult_, ef_construction_
+        self.level0_pos = f.tell()
+        self.levels = self.max_level + 1
+        self.dim = dim or (self.label_offset - self.data_offset) // 4
+        f.close()
+
+    def level0(self):
+        """(node, layer 0 list, vector, label) in node order"""
+        f = open(self.path, "rb")
+        f.seek(self.level0_pos)
+        for node in range(self.nodes):
+            e = f.read(self.element_size)
+            count = struct.unpack_from("<H", e, self.offset_level0)[0]
+            ids = list(struct.unpack_from("<%dI" % count, e, self.offset_level0 + 4))
+            vector = array.array("f", e[self.data_offset:self.data_offset + self.dim * 4])
+            (label,) = struct.unpack_from("<Q", e, self.label_offset)
+            yield node, ids, vector, label
+        self.upper_pos = f.tell()
+        f.close()
+
+    def upper(self):
+        """(node, top layer, [list of layer 1, 2 ...]) in node order, level0() must run first"""
+        f = open(self.path, "rb")
+        f.seek(self.upper_pos)
+        links_size = (self.upper_degree + 1) * 4
+        for node in range(self.nodes):
+            (size,) = struct.unpack("<I", f.read(4))
+            data = f.read(size)
+            lists = []
+            for layer in range(size // links_size):
+                count = struct.unpack_from("<H", data, layer * links_size)[0]
+                lists.append(list(struct.unpack_from("<%dI" % count, data, layer * links_size + 4)))
+            yield node, len(lists), lists
+        f.close()
+
+
+class FaissIndex:
+    """faiss write_index format of IndexHNSWFlat ("IHNf"): index header, HNSW graph
+    (levels, offsets, neighbors with -1 holes), then the IndexFlat storage."""
+
+    def __init__(self, path, dim):
+        self.path = path
+        f = open(path, "rb")
+        if f.read(4) != b"IHNf":
+            sys.exit("ERROR: %s is not a faiss IndexHNSWFlat" % path)
+        self.dim, self.nodes = self._header(f)
+        skip_vector(f, 8)  # assign_probas
+        self.cum = read_vector(f, "i")  # cum_nneighbor_per_level
+        self.node_levels = read_vector(f, "i")  # layers of every node, top layer + 1
+        self.offsets_pos, _ = skip_vector(f, 8)
+        self.neighbors_pos, _ = skip_vector(f, 4)
+        self.entry_point, self.max_level = struct.unpack("<ii", f.read(8))
+        f.read(12)  # efConstruction, efSearch, upper_beam
+        if f.read(4) not in (b"IxF2", b"IxFI"):
+            sys.exit("ERROR: the storage of %s is not an IndexFlat" % path)
+        self._header(f)
+        self.vectors_pos, _ = skip_vector(f, 4)
+        f.close()
+        self.levels = self.max_level + 1
+        self.degree = self.cum[1] - self.cum[0]
+        self.upper_degree = self.cum[2] - self.cum[1] if self.levels > 1 else 0
+        if dim and dim != self.dim:
+            sys.exit("ERROR: index dim %d, vectors dim %d" % (self.dim, dim))
+
+    @staticmethod
+    def _header(f):
+        d, ntotal, _, _, _, metric = struct.unpack("<iqqq?i", f.read(33))
+        if metric > 1:
+            f.read(4)  # metric_arg
+        if metric != 1:
+            print("WARNING: metric %d, phnsw computes L2" % metric, file=sys.stderr)
+        return d, ntotal
+
+    def _lists(self):
+        """(node, [list of layer 0, 1 ...]) in node order"""
+        offsets = open(self.path, "rb")
+        neighbors = open(self.path, "rb")
+        offsets.seek(self.offsets_pos)
+        neighbors.seek(self.neighbors_pos)
+        (begin,) = struct.unpack("<Q", offsets.read(8))
+        for node in range(self.nodes):
+            (end,) = struct.unpack("<Q", offsets.read(8))
+            ids = array.array("i")
+            ids.frombytes(neighbors.read((end - begin) * 4))
+            begin = end
+            layers = self.node_levels[node]
+            yield node, [list(ids[self.cum[l]:self.cum[l + 1]]) for l in range(layers)]
+        offsets.close()
+        neighbors.close()
+
+    def level0(self):
+        vectors = open(self.path, "rb")
+        vectors.seek(self.vectors_pos)
+        for node, lists in self._lists():
+            yield node, lists[0], array.array("f", vectors.read(self.dim * 4)), node
+        vectors.close()
+
+    def upper(self):
+        for node, lists in self._lists():
+            yield node, len(lists) - 1, lists[1:]
+
+
+def open_index(path, dim):
+    with open(path, "rb") as f:
+        magic = f.read(4)
+    return FaissIndex(path, dim) if magic == b"IHNf" else HnswlibIndex(path, dim)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="build a phnsw memory image with a layout header")
+    parser.add_argument("--index", required=True, help="hnswlib saveIndex file or faiss IndexHNSWFlat")
+    parser.add_argument("--base", help=".fvecs/.bvecs base vectors, row = label; default the vectors stored in the index")
+    parser.add_argument("--queries", help=".fvecs/.bvecs query vectors, stored after the nodes")
+    parser.add_argument("--out", required=True, help="image file, the memory_file and imageFile of the test config")
+    parser.add_argument("--query-list", help="queryFile with the node ids of the query vectors")
+    parser.add_argument("--format", choices=sorted(ELEMS), default="f32", help="raw vector format (vecFormat)")
+    parser.add_argument("--pq", type=int, default=0, help="PQ subspaces (code bytes per node), 0 for no PQ codes")
+    parser.add_argument("--pq-train", type=int, default=65536, help="base vectors the PQ codebook is trained on")
+    parser.add_argument("--pq-iters", type=int, default=10, help="k-means iterations of the PQ codebook")
+    parser.add_argument("--shard", type=int, default=0, help="shard of this image, 0 .. --shards - 1")
+    parser.add_argument("--shards", type=int, default=1, help="shards of the index, > 1 stores the node labels")
+    args = parser.parse_args()
+    if args.pq and args.format == "u8":
+        sys.exit("ERROR: --pq builds the query table from f32 or f16 raw vectors")
+    if args.shards < 1 or not 0 <= args.shard < args.shards:
+        sys.exit("ERROR: --shard must be in 0 .. --shards - 1")
+
+    base = Vecs(args.base) if args.base else None
+    queries = Vecs(args.queries) if args.queries else None
+    index = open_index(args.index, base.dim if base else 0)
+    dim = index.dim
+    for vecs in (base, queries):
+        if vecs and vecs.dim != dim:
+            sys.exit("ERROR: %s has dim %d, the index %d" % (vecs.path, vecs.dim, dim))
+    nodes = index.nodes
+    query_count = queries.count if queries else 0
+
+    neighbor_offset = ALIGN
+    neighbor_stride = index.degree * 4
+    raw_offset = align(neighbor_offset + nodes * neighbor_stride)
+    elem_type, elem_size = ELEMS[args.format]
+    raw_stride = dim * elem_size
+    upper_offset = align(raw_offset + (nodes + query_count) * raw_stride)
+    upper_stride = index.upper_degree * 4
+    upper_layer_stride = nodes * upper_stride
+    level_offset = align(upper_offset + (index.levels - 1) * upper_layer_stride)
+    end = level_offset + nodes
+    quant_offset = align(end) if args.format == "u8" else 0
+    if quant_offset:
+        end = quant_offset + 8 * dim
+    pq_codebook_offset = align(end) if args.pq else 0
+    pq_offset = align(pq_codebook_offset + PQ_KSUB * dim * 4) if args.pq else 0
+    if args.pq:
+        end = pq_offset + nodes * args.pq
+    label_offset = align(end) if args.shards > 1 else 0
+    if label_offset:
+        end = label_offset + nodes * 4
+    image_size = align(end)
+
+    # u8 needs the range of every dimension first, one more pass over the base vectors
+    encoder = Encoder(args.format, dim)
+    if args.format == "u8":
+        for vector in (base.rows() if base else (v for _, _, v, _ in index.level0())):
+            encoder.observe(vector)
+    encoder.fit()
+
+    # PQ codebook from the first --pq-train nodes
+    pq = ProductQuantizer(args.pq, dim, args.pq_iters) if args.pq else None
+    if pq:
+        sample = []
+        for node, _, vector, label in index.level0():
+            if node >= args.pq_train:
+                break
+            sample.append(base.row(label) if base else vector)
+        pq.train(sample)
+
+    with open(args.out, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, ALIGN, dim, elem_type, index.degree, index.upper_degree,
+                            index.levels, index.entry_point, nodes, query_count,
+                            neighbor_offset, neighbor_stride, raw_offset, raw_stride,
+                            upper_offset, upper_stride, upper_layer_stride, level_offset, image_size,
+                            quant_offset, args.pq, 0, pq_offset, args.pq, pq_codebook_offset,
+                            label_offset, args.shard, args.shards))
+        if quant_offset:
+            f.seek(quant_offset)
+            f.write(encoder.quant())
+        if pq:
+            f.seek(pq_codebook_offset)
+            f.write(pq.codebook())
+        f.truncate(image_size)  # sparse: nodes below a layer leave holes in its region
+
+    # layer 0 lists and raw vectors, both sequential
+    neighbor = Region(args.out, neighbor_offset)
+    raw = Region(args.out, raw_offset)
+    codes = Region(args.out, pq_offset) if pq else None
+    labels = Region(args.out, label_offset) if label_offset else None
+    batch = []
+    for node, ids, vector, label in index.level0():
+        neighbor.write(pad_list(ids, index.degree, node))
+        if labels:
+            if label > 0xFFFFFFFF:
+                sys.exit("ERROR: label %d of node %d does not fit in 32 bits" % (label, node))
+            labels.write(struct.pack("<I", label))
+        vector = base.row(label) if base else vector
+        raw.write(encoder.encode(vector))
+        if pq:
+            batch.append(vector)
+            if len(batch) == 4096:
+                codes.write(pq.encode(batch))
+                batch = []
+    neighbor.close()
+    if labels:
+        labels.close()
+    if pq:
+        if batch:
+            codes.write(pq.encode(batch))
+        codes.close()
+    if queries:
+        for vector in queries.rows():
+            raw.write(encoder.encode(vector))
+    raw.close()
+
+    # upper layer lists, only the nodes of a layer are written, and the top layer bytes
+    upper = open(args.out, "r+b")
+    level = Region(args.out, level_offset)
+    for node, top, lists in index.upper():
+        for layer, ids in enumerate(lists, 1):
+            upper.seek(upper_offset + (layer - 1) * upper_layer_stride + node * upper_stride)
+            upper.write(pad_list(ids, index.upper_degree, node))
+        level.write(bytes([top]))
+    upper.close()
+    level.close()
+
+    if args.query_list:
+        with open(args.query_list, "w") as f:
+            for q in range(query_count):
+                f.write("%d\n" % (nodes + q))
+
+    print("%s: %d nodes, %d queries, dim %d %s, M %d, upperM %d, %d levels, entry point %d, PQ %d, shard %d/%d, %d MiB"
+          % (args.out, nodes, query_count, dim, args.format, index.degree, index.upper_degree, index.levels,
+             index.entry_point, args.pq, args.shard, args.shards, image_size >> 20))
+
+
+if __name__ == "__main__":
+    main()
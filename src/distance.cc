@@ -0,0 +1,315 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-05-20 10:12:41
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-05-20 10:12:41
+ * @FilePath: /phnsw/src/distance.cc
+ * @Description: host kernels of the DIST instruction
+ * 
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved. 
+ */
+
+#include <cstring>
+
+#include "distance.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PHNSW_X86 1
+#include <immintrin.h>
+#endif
+
+namespace SST {
+namespace phnsw {
+
+namespace {
+
+constexpr uint32_t LANES = 16;
+
+inline float reduce_lanes(float *lane) {
+    for (uint32_t width = LANES / 2; width > 0; width /= 2) {
+        for (uint32_t j = 0; j < width; j++) {
+            lane[j] = lane[j] + lane[j + width];
+        }
+    }
+    return lane[0];
+}
+
+inline void accumulate_tail(const float *a, const float *b, uint32_t from, uint32_t dim, float *lane) {
+    for (uint32_t i = from; i < dim; i++) {
+        float t = a[i] - b[i];
+        float sq = t * t;
+        lane[i % LANES] = lane[i % LANES] + sq;
+    }
+}
+
+inline void accumulate_tail_f16(const uint16_t *a, const uint16_t *b, uint32_t from, uint32_t dim, float *lane) {
+    for (uint32_t i = from; i < dim; i++) {
+        float t = half_to_float(a[i]) - half_to_float(b[i]);
+        float sq = t * t;
+        lane[i % LANES] = lane[i % LANES] + sq;
+    }
+}
+
+inline void accumulate_tail_u8(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t from, uint32_t dim, float *lane) {
+    for (uint32_t i = from; i < dim; i++) {
+        int32_t t = (int32_t) a[i] - (int32_t) b[i];
+        float sq = (float) (t * t);
+        lane[i % LANES] = lane[i % LANES] + sq * weight[i];
+    }
+}
+
+/* Dim == 0 means the dim is only known at runtime */
+template <uint32_t Dim>
+float l2sq_scalar(const float *a, const float *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    float lane[LANES] = {0};
+    accumulate_tail(a, b, 0, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+float l2sq_f16_scalar(const uint16_t *a, const uint16_t *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    float lane[LANES] = {0};
+    accumulate_tail_f16(a, b, 0, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+float l2sq_u8_scalar(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    float lane[LANES] = {0};
+    accumulate_tail_u8(a, b, weight, 0, n, lane);
+    return reduce_lanes(lane);
+}
+
+#ifdef PHNSW_X86
+template <uint32_t Dim>
+__attribute__((target("avx2")))
+float l2sq_avx2(const float *a, const float *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m256 acc0 = _mm256_setzero_ps(); // lanes 0..7
+    __m256 acc1 = _mm256_setzero_ps(); // lanes 8..15
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+    }
+    float lane[LANES];
+    _mm256_storeu_ps(lane, acc0);
+    _mm256_storeu_ps(lane + 8, acc1);
+    accumulate_tail(a, b, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx512f")))
+float l2sq_avx512(const float *a, const float *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m512 acc = _mm512_setzero_ps();
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc = _mm512_add_ps(acc, _mm512_mul_ps(d, d));
+    }
+    float lane[LANES];
+    _mm512_storeu_ps(lane, acc);
+    accumulate_tail(a, b, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx2,f16c")))
+float l2sq_f16_avx2(const uint16_t *a, const uint16_t *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        __m256 a0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256 a1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (a + i + 8)));
+        __m256 d0 = _mm256_sub_ps(a0, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (b + i))));
+        __m256 d1 = _mm256_sub_ps(a1, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (b + i + 8))));
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+    }
+    float lane[LANES];
+    _mm256_storeu_ps(lane, acc0);
+    _mm256_storeu_ps(lane + 8, acc1);
+    accumulate_tail_f16(a, b, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx512f")))
+float l2sq_f16_avx512(const uint16_t *a, const uint16_t *b, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m512 acc = _mm512_setzero_ps();
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        __m512 d = _mm512_sub_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (a + i))),
+                                 _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (b + i))));
+        acc = _mm512_add_ps(acc, _mm512_mul_ps(d, d));
+    }
+    float lane[LANES];
+    _mm512_storeu_ps(lane, acc);
+    accumulate_tail_f16(a, b, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx2")))
+float l2sq_u8_avx2(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m256 acc[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()};
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        for (uint32_t h = 0; h < 2; h++) {
+            // (a - b)^2 is at most 255^2, exact in int32 and float
+            __m256i t = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (a + i + 8 * h))),
+                                         _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b + i + 8 * h))));
+            __m256 sq = _mm256_cvtepi32_ps(_mm256_mullo_epi32(t, t));
+            acc[h] = _mm256_add_ps(acc[h], _mm256_mul_ps(sq, _mm256_loadu_ps(weight + i + 8 * h)));
+        }
+    }
+    float lane[LANES];
+    _mm256_storeu_ps(lane, acc[0]);
+    _mm256_storeu_ps(lane + 8, acc[1]);
+    accumulate_tail_u8(a, b, weight, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx512f")))
+float l2sq_u8_avx512(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t dim) {
+    const uint32_t n = Dim ? Dim : dim;
+    const uint32_t blocks = n / LANES * LANES;
+    __m512 acc = _mm512_setzero_ps();
+    for (uint32_t i = 0; i < blocks; i += LANES) {
+        __m512i t = _mm512_sub_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (a + i))),
+                                     _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (b + i))));
+        __m512 sq = _mm512_cvtepi32_ps(_mm512_mullo_epi32(t, t));
+        acc = _mm512_add_ps(acc, _mm512_mul_ps(sq, _mm512_loadu_ps(weight + i)));
+    }
+    float lane[LANES];
+    _mm512_storeu_ps(lane, acc);
+    accumulate_tail_u8(a, b, weight, blocks, n, lane);
+    return reduce_lanes(lane);
+}
+#endif
+
+struct KernelSet {
+    L2sqFn scalar, avx2, avx512;
+    L2sqF16Fn f16_scalar, f16_avx2, f16_avx512;
+    L2sqU8Fn u8_scalar, u8_avx2, u8_avx512;
+};
+
+template <uint32_t Dim>
+KernelSet kernels() {
+#ifdef PHNSW_X86
+    return {&l2sq_scalar<Dim>, &l2sq_avx2<Dim>, &l2sq_avx512<Dim>,
+            &l2sq_f16_scalar<Dim>, &l2sq_f16_avx2<Dim>, &l2sq_f16_avx512<Dim>,
+            &l2sq_u8_scalar<Dim>, &l2sq_u8_avx2<Dim>, &l2sq_u8_avx512<Dim>};
+#else
+    return {&l2sq_scalar<Dim>, &l2sq_scalar<Dim>, &l2sq_scalar<Dim>,
+            &l2sq_f16_scalar<Dim>, &l2sq_f16_scalar<Dim>, &l2sq_f16_scalar<Dim>,
+            &l2sq_u8_scalar<Dim>, &l2sq_u8_scalar<Dim>, &l2sq_u8_scalar<Dim>};
+#endif
+}
+
+KernelSet kernels_of(uint32_t dim) {
+    return dim == 96  ? kernels<96>()  :
+           dim == 100 ? kernels<100>() :
+           dim == 128 ? kernels<128>() :
+           dim == 256 ? kernels<256>() :
+           dim == 384 ? kernels<384>() :
+           dim == 768 ? kernels<768>() :
+           dim == 960 ? kernels<960>() :
+                        kernels<0>();
+}
+
+} // namespace
+
+SimdLevel detect_simd() {
+#ifdef PHNSW_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+SimdLevel parse_simd(const std::string &name, bool &ok) {
+    SimdLevel host = detect_simd();
+    ok = true;
+    if (name == "scalar") return SimdLevel::SCALAR;
+    if (name == "avx2" && host >= SimdLevel::AVX2) return SimdLevel::AVX2;
+    if (name == "avx512" && host >= SimdLevel::AVX512) return SimdLevel::AVX512;
+    ok = name == "auto" || name == "avx2" || name == "avx512";
+    return host;
+}
+
+const char *simd_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX512: return "avx512";
+        case SimdLevel::AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+L2sqFn select_l2sq(uint32_t dim, SimdLevel level) {
+    KernelSet set = kernels_of(dim);
+    switch (level) {
+        case SimdLevel::AVX512: return set.avx512;
+        case SimdLevel::AVX2: return set.avx2;
+        default: return set.scalar;
+    }
+}
+
+L2sqF16Fn select_l2sq_f16(uint32_t dim, SimdLevel level) {
+    KernelSet set = kernels_of(dim);
+    switch (level) {
+        case SimdLevel::AVX512: return set.f16_avx512;
+        case SimdLevel::AVX2: return set.f16_avx2;
+        default: return set.f16_scalar;
+    }
+}
+
+L2sqU8Fn select_l2sq_u8(uint32_t dim, SimdLevel level) {
+    KernelSet set = kernels_of(dim);
+    switch (level) {
+        case SimdLevel::AVX512: return set.u8_avx512;
+        case SimdLevel::AVX2: return set.u8_avx2;
+        default: return set.u8_scalar;
+    }
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13); // inf, nan
+    } else if (exp) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant) {
+        // subnormal half, normal float
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    } else {
+        bits = sign;
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+} // namespace phnsw
+} // namespace SST
@@ -0,0 +1,79 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-05-20 10:12:41
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-05-20 10:12:41
+ * @FilePath: /phnsw/src/distance.h
+ * @Description: host kernels of the DIST instruction
+ * 
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved. 
+ */
+
+#ifndef _PHNSW_DISTANCE_H
+#define _PHNSW_DISTANCE_H
+
+#include <cstdint>
+#include <string>
+
+namespace SST {
+namespace phnsw {
+
+/*
+ * Squared L2 distance, every kernel follows the same reference summation order
+ * so results are bit-identical whatever instruction set runs it:
+ *   - 16 lanes, lane j accumulates (a[i] - b[i])^2 for i % 16 == j, in increasing i,
+ *     with a separate multiply and add (no FMA);
+ *   - lanes are reduced pairwise: lane[j] += lane[j + 8], then + 4, + 2, + 1.
+ * distance.cc is compiled with -ffp-contract=off so the compiler keeps this order.
+ */
+typedef float (*L2sqFn)(const float *a, const float *b, uint32_t dim);
+
+/*
+ * DIST on the compressed vector formats, same lanes and reduction:
+ *   - f16: elements are widened to float first, so the result equals the float32 kernel
+ *     on the widened vectors;
+ *   - u8:  codes c of x = offset + scale * c, (x_a - x_b)^2 = scale^2 * (c_a - c_b)^2, so a lane adds
+ *     float((c_a - c_b)^2) * weight[i] with weight = scale^2, the offset cancels.
+ */
+typedef float (*L2sqF16Fn)(const uint16_t *a, const uint16_t *b, uint32_t dim);
+typedef float (*L2sqU8Fn)(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t dim);
+
+enum class SimdLevel { SCALAR, AVX2, AVX512 };
+
+/**
+ * @description: best instruction set of the host cpu
+ * @return {SimdLevel}
+ */
+SimdLevel detect_simd();
+
+/**
+ * @description: parse "auto", "scalar", "avx2" or "avx512", "auto" (or a level the host lacks) gives detect_simd()
+ * @param {string&} name of the level
+ * @param {bool&} ok false if name is unknown
+ * @return {SimdLevel}
+ */
+SimdLevel parse_simd(const std::string &name, bool &ok);
+
+const char *simd_name(SimdLevel level);
+
+/**
+ * @description: pick the kernel for dim, dims 96, 100, 128, 256, 384, 768 and 960 get a specialized one
+ * @param {uint32_t} dim of vectors
+ * @param {SimdLevel} level instruction set to use
+ * @return {L2sqFn}
+ */
+L2sqFn select_l2sq(uint32_t dim, SimdLevel level);
+L2sqF16Fn select_l2sq_f16(uint32_t dim, SimdLevel level);
+L2sqU8Fn select_l2sq_u8(uint32_t dim, SimdLevel level);
+
+/**
+ * @description: IEEE half to float, exact
+ * @param {uint16_t} h
+ * @return {float}
+ */
+float half_to_float(uint16_t h);
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-10 15:02:11
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-10 15:02:11
+ * @FilePath: /phnsw/src/image.cc
+ * @Description: self-describing header of the memory image, written by datasetx/build_image.py
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+#include "image.h"
+
+using namespace SST::phnsw;
+
+uint32_t SST::phnsw::image_elem_size(ImageElem elem) {
+    switch (elem) {
+    case ImageElem::F16: return sizeof(uint16_t);
+    case ImageElem::U8: return sizeof(uint8_t);
+    case ImageElem::F32:
+    default:
+        return sizeof(float);
+    }
+}
+
+ImageElem SST::phnsw::parse_image_elem(const std::string &name, bool &ok) {
+    ok = true;
+    if (name == "f32") return ImageElem::F32;
+    if (name == "f16") return ImageElem::F16;
+    if (name == "u8") return ImageElem::U8;
+    ok = false;
+    return ImageElem::F32;
+}
+
+const char *SST::phnsw::image_elem_name(ImageElem elem) {
+    switch (elem) {
+    case ImageElem::F16: return "f16";
+    case ImageElem::U8: return "u8";
+    default: return "f32";
+    }
+}
+
+bool SST::phnsw::read_image_header(const std::string &path, ImageHeader &header, std::string &error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "can not open " + path;
+        return false;
+    }
+    // the fields are naturally aligned, so the struct is the on-disk layout on little-endian hosts,
+    // version 1 ends before quant_offset, version 2 before pq_m, version 3 before label_offset
+    const size_t v1_size = offsetof(ImageHeader, quant_offset);
+    const size_t v2_size = offsetof(ImageHeader, pq_m);
+    const size_t v3_size = offsetof(ImageHeader, label_offset);
+    std::memset(&header, 0, sizeof(header));
+    if (!file.read((char *) &header, v1_size)) {
+        error = path + " is shorter than a header";
+        return false;
+    }
+    if (std::memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) {
+        error = path + " has no image header (magic " IMAGE_MAGIC ")";
+        return false;
+    }
+    if (header.version < 1 || header.version > IMAGE_VERSION) {
+        error = "unsupported image version " + std::to_string(header.version);
+        return false;
+    }
+    const size_t sizes[] = {v1_size, v2_size, v3_size, sizeof(header)};
+    const size_t size = sizes[header.version - 1];
+    if (size > v1_size && !file.read((char *) &header + v1_size, size - v1_size)) {
+        error = path + " is shorter than a header";
+        return false;
+    }
+    if (header.elem_type > (uint32_t) ImageElem::U8) {
+        error = "unsupported element type " + std::to_string(header.elem_type);
+        return false;
+    }
+    if (header.elem_type == (uint32_t) ImageElem::U8 && !header.quant_offset) {
+        error = "u8 image without scale and offset";
+        return false;
+    }
+    if (header.pq_m && (header.dim % header.pq_m || !header.pq_offset || !header.pq_codebook_offset
+        || header.pq_stride < header.pq_m)) {
+        error = "invalid PQ shape, pq_m must divide dim";
+        return false;
+    }
+    if (header.version < 4) header.shards = 1;
+    if (!header.shards || header.shard >= header.shards) {
+        error = "shard " + std::to_string(header.shard) + " of " + std::to_string(header.shards);
+        return false;
+    }
+    if (!header.dim || !header.degree || !header.levels || !header.nodes) {
+        error = "dim, degree, levels and nodes must be at least 1";
+        return false;
+    }
+    if (header.nodes + header.queries > UINT32_MAX) {
+        error = "node ids do not fit in 32 bits";
+        return false;
+    }
+    if (header.neighbor_stride < (uint64_t) header.degree * sizeof(uint32_t)
+        || header.raw_stride < (uint64_t) header.dim * image_elem_size((ImageElem) header.elem_type)) {
+        error = "a stride is smaller than its list or vector";
+        return false;
+    }
+    if (header.levels > 1 && (!header.upper_degree || header.upper_degree > header.degree
+        || header.upper_stride < (uint64_t) header.upper_degree * sizeof(uint32_t)
+        || header.upper_layer_stride < header.nodes * header.upper_stride)) {
+        error = "invalid upper layer shape";
+        return false;
+    }
+    if (header.neighbor_offset < header.header_size || header.raw_offset < header.header_size) {
+        error = "a region overlaps the header";
+        return false;
+    }
+    if (header.entry_point >= header.nodes) {
+        error = "entry point " + std::to_string(header.entry_point) + " is not a node";
+        return false;
+    }
+    return true;
+}
+
+bool SST::phnsw::read_image_quant(const std::string &path, const ImageHeader &header,
+                                  std::vector<float> &scale, std::vector<float> &offset, std::string &error) {
+    std::ifstream file(path, std::ios::binary);
+    scale.resize(header.dim);
+    offset.resize(header.dim);
+    if (!file.seekg(header.quant_offset)
+        || !file.read((char *) scale.data(), header.dim * sizeof(float))
+        || !file.read((char *) offset.data(), header.dim * sizeof(float))) {
+        error = "can not read the scale and offset of " + path;
+        return false;
+    }
+    return true;
+}
+
+bool SST::phnsw::read_image_codebook(const std::string &path, const ImageHeader &header,
+                                     std::vector<float> &codebook, std::string &error) {
+    std::ifstream file(path, std::ios::binary);
+    codebook.resize((size_t) IMAGE_PQ_KSUB * header.dim);
+    if (!file.seekg(header.pq_codebook_offset)
+        || !file.read((char *) codebook.data(), codebook.size() * sizeof(float))) {
+        error = "can not read the PQ codebook of " + path;
+        return false;
+    }
+    return true;
+}
+
+bool SST::phnsw::read_image_labels(const std::string &path, const ImageHeader &header,
+                                   std::vector<uint32_t> &labels, std::string &error) {
+    labels.resize(header.nodes);
+    if (!header.label_offset) {
+        for (uint64_t n = 0; n < header.nodes; n++) labels[n] = (uint32_t) n;
+        return true;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file.seekg(header.label_offset)
+        || !file.read((char *) labels.data(), labels.size() * sizeof(uint32_t))) {
+        error = "can not read the labels of " + path;
+        return false;
+    }
+    return true;
+}
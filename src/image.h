@@ -0,0 +1,153 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-10 15:02:11
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-10 15:02:11
+ * @FilePath: /phnsw/src/image.h
+ * @Description: self-describing header of the memory image, written by datasetx/build_image.py
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#ifndef _PHNSW_IMAGE_H
+#define _PHNSW_IMAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Layout of the header-less siftsmall output.bin: 10000 lists of 32 neighbors, then the raw vectors */
+#define IMAGE_LEGACY_RAW_BASE 0x138800
+
+#define IMAGE_MAGIC "PHNSWIMG"
+#define IMAGE_PQ_KSUB 256   // centroids per PQ subspace, one code byte
+#define IMAGE_ALIGN 4096    // regions and image_size of datasetx/build_image.py
+#define IMAGE_VERSION 4
+
+namespace SST {
+namespace phnsw {
+
+/*
+ * Element type of the raw vectors:
+ * F32: float32;
+ * F16: IEEE half;
+ * U8:  8-bit codes c, x = offset[d] + scale[d] * c per dimension d, the scale and offset
+ *      arrays (dim float32 each) are at quant_offset.
+ */
+enum class ImageElem : uint32_t { F32 = 0, F16 = 1, U8 = 2 };
+
+/*
+ * Header at the start of memory (offset 0 of the image file), little-endian.
+ * Offsets are from the start of memory, strides in bytes. Node ids index every region:
+ * - layer 0 list of node n at neighbor_offset + n * neighbor_stride, degree ids;
+ * - raw vector of node n at raw_offset + n * raw_stride, queries follow the nodes;
+ * - layer l (1 .. levels - 1) list of node n at upper_offset + (l - 1) * upper_layer_stride + n * upper_stride,
+ *   upper_degree ids;
+ * - top layer of node n, one byte, at level_offset + n;
+ * - PQ code of node n at pq_offset + n * pq_stride, pq_m bytes, one centroid id per subspace
+ *   (nodes only, queries keep their raw vector), with the codebook at pq_codebook_offset:
+ *   float32 centroids[pq_m][IMAGE_PQ_KSUB][dim / pq_m];
+ * - label of node n, its uint32 id in the whole index, at label_offset + n * 4 (images of a shard).
+ * Lists shorter than their degree are padded with the node's own id.
+ * Keep in sync with HEADER in datasetx/build_image.py.
+ */
+struct ImageHeader {
+    char magic[8];              // IMAGE_MAGIC, not 0 terminated
+    uint32_t version;           // IMAGE_VERSION
+    uint32_t header_size;       // bytes reserved for the header
+    uint32_t dim;
+    uint32_t elem_type;         // ImageElem
+    uint32_t degree;            // layer 0 neighbors per list (M)
+    uint32_t upper_degree;      // upperM, 0 if levels is 1
+    uint32_t levels;
+    uint32_t entry_point;
+    uint64_t nodes;
+    uint64_t queries;           // query vectors stored after the nodes in the raw region
+    uint64_t neighbor_offset;
+    uint64_t neighbor_stride;
+    uint64_t raw_offset;
+    uint64_t raw_stride;
+    uint64_t upper_offset;
+    uint64_t upper_stride;
+    uint64_t upper_layer_stride;
+    uint64_t level_offset;
+    uint64_t image_size;
+    /* version 2 */
+    uint64_t quant_offset;      // U8 scale[dim] then offset[dim], 0 for other types
+    /* version 3 */
+    uint32_t pq_m;              // PQ subspaces (code bytes), 0 without PQ codes
+    uint32_t pq_reserved;
+    uint64_t pq_offset;
+    uint64_t pq_stride;
+    uint64_t pq_codebook_offset;
+    /* version 4 */
+    uint64_t label_offset;      // 0 if node ids are the labels
+    uint32_t shard;             // shard of a sharded index, 0 .. shards - 1
+    uint32_t shards;            // 1 for an index in one image
+};
+static_assert(sizeof(ImageHeader) == 184, "ImageHeader must match the on-disk layout");
+
+/**
+ * @description: read and check the header of an image file
+ * @param {string&} path of the image (the memory_file of the memory controller)
+ * @param {ImageHeader&} header filled on success
+ * @param {string&} error why the file was rejected
+ * @return {bool} false if the file can not be read, has no header or an unsupported one
+ */
+bool read_image_header(const std::string &path, ImageHeader &header, std::string &error);
+
+/**
+ * @description: read the per dimension scale and offset of a U8 image
+ * @param {string&} path of the image
+ * @param {ImageHeader&} header of the image, from read_image_header
+ * @param {vector<float>&} scale dim entries
+ * @param {vector<float>&} offset dim entries
+ * @param {string&} error why the arrays can not be read
+ * @return {bool}
+ */
+bool read_image_quant(const std::string &path, const ImageHeader &header,
+                      std::vector<float> &scale, std::vector<float> &offset, std::string &error);
+
+/**
+ * @description: read the PQ codebook of an image with pq_m > 0
+ * @param {string&} path of the image
+ * @param {ImageHeader&} header of the image, from read_image_header
+ * @param {vector<float>&} codebook pq_m * IMAGE_PQ_KSUB * (dim / pq_m) entries
+ * @param {string&} error why the codebook can not be read
+ * @return {bool}
+ */
+bool read_image_codebook(const std::string &path, const ImageHeader &header,
+                         std::vector<float> &codebook, std::string &error);
+
+/**
+ * @description: read the labels of the nodes, node ids themselves if the image has none
+ * @param {string&} path of the image
+ * @param {ImageHeader&} header of the image, from read_image_header
+ * @param {vector<uint32_t>&} labels nodes entries
+ * @param {string&} error why the labels can not be read
+ * @return {bool}
+ */
+bool read_image_labels(const std::string &path, const ImageHeader &header,
+                       std::vector<uint32_t> &labels, std::string &error);
+
+/**
+ * @description: bytes of one element of the raw vectors
+ * @param {ImageElem} elem
+ * @return {uint32_t}
+ */
+uint32_t image_elem_size(ImageElem elem);
+
+/**
+ * @description: parse "f32", "f16" or "u8"
+ * @param {string&} name to parse
+ * @param {bool&} ok false if name is unknown
+ * @return {ImageElem}
+ */
+ImageElem parse_image_elem(const std::string &name, bool &ok);
+
+const char *image_elem_name(ImageElem elem);
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
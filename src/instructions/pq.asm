@@ -0,0 +1,128 @@
+MOV query_index DMAindex ; query index, set by the core for each query
+
+DMA R
+
+RAW
+
+MOV raw1 raw2 ; raw2 里就一直是query的raw data了。
+
+MOV ep_index DMAindex ; ep index, set by the core for each query
+DMA L ; top layer of the ep into max_level
+DIST T ; ADC table of the query (raw2) into the scratchpad
+
+DMA P ; PQ code of the ep
+
+RAW P
+
+DIST PQ
+MOV ep_index current_node
+MOV max_level layer
+
+MOV dist_res cur_dist
+
+CMP EQ layer [0] ; [ ] greedy descent (ef = 1) through the layers above 0
+
+JMP [28] ; [x] to layer 0
+
+MOV [0] i
+MOV [0] changed
+MOV current_node DMAindex
+DMA N ; neighbor list of current_node in this layer
+
+CMP GE i [M_UP] ; [ ] i >= M_UP
+
+JMP [23] ; [x] to changed
+
+NEI
+
+ADD i [1] ; i++
+
+MOV alu_res i
+
+RAW PS
+
+DIST PQ
+
+CMP GE dist_res cur_dist
+
+JMP [12] ; [x] to i >= M_UP
+
+MOV dist_res cur_dist ; closer, move there
+MOV nei_index current_node
+MOV [1] changed
+MOV [1] cmp_res
+
+JMP [12] ; [x] to i >= M_UP
+
+CMP NE changed [0]
+
+JMP [11] ; [x] scan the list of the new current_node
+
+SUB layer [1]
+
+MOV alu_res layer
+MOV [1] cmp_res
+
+JMP [9] ; [x] next layer down
+
+MOV current_node DMAindex ; layer 0 starts from the descent result
+MOV current_node vst_index
+
+PUSH cur_dist DMAindex C
+
+PUSH cur_dist DMAindex W
+
+VST W
+
+CMP LE C_size [0] ; [ ] C_size <= 0
+
+JMP [54] ; [x] to the END
+
+RMC ; nearest candidate into rmc_dist / rmc_index
+
+ACW ; furthest result, UINT32_MAX until W is full
+MOV rmc_index current_node
+
+CMP GT rmc_dist acw_dist
+
+JMP [54] ; [x] to the END
+
+MOV [0] i
+MOV current_node DMAindex
+DMA N ; neighbor list of current_node, the prefetcher streams its raw vectors
+
+CMP GE i [M] ; [ ] i >= M
+
+JMP [32] ; [x] to C_size <= 0
+
+NEI
+
+ADD i [1] ; i++
+
+MOV alu_res i
+
+MOV nei_index vst_index
+VST T ; test and set
+
+CMP NE vst_res [0] ; 没有visit过
+
+JMP [39] ; [x] to i >= M
+
+ACW
+
+RAW PS ; code of nei_index, from the prefetch ring
+
+DIST PQ
+
+MOV dist_res nei_dist
+CMP GE nei_dist acw_dist
+
+JMP [39] ; [x] to i >= M
+
+PUSH nei_dist nei_index C
+PUSH nei_dist nei_index W ; a full W evicts its furthest
+MOV [1] cmp_res
+
+JMP [39] ; [x] to i >= M
+
+END
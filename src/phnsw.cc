@@ -29,10 +29,29 @@
 #include <sst/core/realtimeAction.h>
 
 #include <bitset>
+#include <cstdio>
+#include <mutex>
 
 using namespace SST;
 using namespace phnsw;
 
+/* Batch summary of the cores of one simulation, the last core to finish prints the aggregate.
+ * Cores must share the process: run multi-core configs on one rank (threads are fine) */
+static struct CoreSummary {
+    std::mutex lock;
+    uint32_t cores = 0;
+    uint32_t reported = 0;
+    size_t queries = 0;
+    SST::SimTime_t start_ns = UINT64_MAX;
+    SST::SimTime_t end_ns = 0;
+    // the other cores finished in another process, the aggregate line was never printed
+    ~CoreSummary() {
+        if (reported && reported < cores) {
+            std::fprintf(stderr, "WARNING: only %u of %u cores reported to this process, no aggregate QPS printed\n", reported, cores);
+        }
+    }
+} core_summary;
+
 /**
  * @description: Constructor
  *               Find and add parameters to local variables.
@@ -104,18 +123,102 @@ Phnsw::Phnsw( SST::ComponentId_t id, SST::Params& params ) :
     dma = loadUserSubComponent<phnswDMAAPI>("dma", SST::ComponentInfo::SHARE_NONE, clockTC);
 
     sst_assert(dma, CALL_INFO, -1, "Unable to load dma subcomponent\n");
+    dma_blocking = params.find<bool>("dmaBlocking", false);
+    // the clock is off while the core only waits for the DMA, every retired op turns it on
+    suspend_clock = params.find<bool>("suspendClock", true);
+    suspended = false;
+    suspend_cycle = 0;
+    suspend_stall = Issue::IDLE;
+    dma->on_retire = [this]() { Phnsw::resume(); };
+    mem_base = scratchSize;
+    context_count = params.find<uint32_t>("contexts", 1);
+    if (context_count < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'contexts' - must be at least 1\n", getName().c_str());
+    // the inits below build context 0, context_init copies it to the others
+    contexts.resize(1);
+    ctx_now = 0;
+    ctx = &contexts[0];
+    ctx->dma_last_tag = dma_mark = dma->issued_tag;
+    Phnsw::init_layout(params);
+    Phnsw::prefetch_init(params);
+    Phnsw::pq_init(params);
+    Phnsw::rerank_init(params);
+    Phnsw::visit_init(params);
+    ctx->reg_dma_tag.fill(0);
+    ctx->vst_read_tag = 0;
+
+    // Host kernel of DIST
+    bool kernel_ok;
+    std::string dist_kernel = params.find<std::string>("distKernel", "auto");
+    SimdLevel simd = parse_simd(dist_kernel, kernel_ok);
+    if (!kernel_ok) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'distKernel' - %s\n", getName().c_str(), dist_kernel.c_str());
+    l2sq = select_l2sq(layout.dim, simd);
+    l2sq_f16 = select_l2sq_f16(layout.dim, simd);
+    l2sq_u8 = select_l2sq_u8(layout.dim, simd);
+    output.verbose(CALL_INFO, 1, 0, "DIST kernel: %s\n", simd_name(simd));
+
+    // Per opcode unit latencies and the DIST unit model
+    Phnsw::init_units(params);
 
     // Load Instructions
     inst_time = 0;
+    program = params.find<std::string>("program", "instructions/instructions.asm");
     Phnsw::load_inst_creat_img();
     output.verbose(CALL_INFO, 1, 0, "img created!\n");
 
-    // reset statistics
-    Phnsw::pushc_times = 0;
-    Phnsw::pushw_times = 0;
-}
+    // Queries of this run, from phnswMerge in shard mode; idle contexts take them in clockTick
+    query_now = 0;
+    ctx->job_now = ctx->record_now = 0;
+    ctx->started_at = 0;
+    ctx->query_started = false;
+    ctx->query_idle = true;
+    host = configureLink("host_link", new SST::Event::Handler<Phnsw>(this, &Phnsw::handle_host));
+    if (host) {
+        if (!layout.queries) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - shard mode needs an image with query vectors\n", getName().c_str());
+        }
+        cores = 1;
+        core_id = 0;
+        host_ep = params.find<uint32_t>("entryPoint", layout.entry_point);
+        primaryComponentOKToEndSim(); // phnswMerge ends the simulation
+        output.verbose(CALL_INFO, 1, 0, "Shard %u: queries from host_link, entry point %u\n", layout.shard, host_ep);
+    } else {
+        Phnsw::load_queries(params);
+    }
 
-Register Phnsw::Registers;
+    // statistics
+    for (size_t op = 0; op < OP_NUM; op++) {
+        stat_inst[op] = registerStatistic<uint64_t>("inst_" + inst_struct[op].asmop);
+    }
+    stat_stall_dma  = registerStatistic<uint64_t>("stall_dma_cycles");
+    stat_dist_evals = registerStatistic<uint64_t>("dist_evals");
+    stat_vst_reads  = registerStatistic<uint64_t>("vst_reads");
+    stat_vst_writes = registerStatistic<uint64_t>("vst_writes");
+    stat_vst_hits   = registerStatistic<uint64_t>("vst_hits");
+    stat_vst_overflows = registerStatistic<uint64_t>("vst_overflows");
+    stat_vst_clears = registerStatistic<uint64_t>("vst_clears");
+    stat_push_c     = registerStatistic<uint64_t>("push_c_ops");
+    stat_push_w     = registerStatistic<uint64_t>("push_w_ops");
+    stat_rmc        = registerStatistic<uint64_t>("rmc_ops");
+    stat_rmw        = registerStatistic<uint64_t>("rmw_ops");
+    stat_stall_hazard    = registerStatistic<uint64_t>("stall_hazard_cycles");
+    stat_stall_dist_busy = registerStatistic<uint64_t>("stall_dist_busy_cycles");
+    stat_stall_queue_busy = registerStatistic<uint64_t>("stall_queue_busy_cycles");
+    stat_queue_evictions = registerStatistic<uint64_t>("queue_evictions");
+    stat_queue_drops = registerStatistic<uint64_t>("queue_drops");
+    stat_pf_issued  = registerStatistic<uint64_t>("prefetch_issued");
+    stat_descent_lists = registerStatistic<uint64_t>("descent_lists");
+    stat_pf_skipped = registerStatistic<uint64_t>("prefetch_skipped");
+    stat_pf_hits    = registerStatistic<uint64_t>("prefetch_hits");
+    stat_pf_misses  = registerStatistic<uint64_t>("prefetch_misses");
+    stat_pq_builds  = registerStatistic<uint64_t>("pq_table_builds");
+    stat_stall_pq_table = registerStatistic<uint64_t>("stall_pq_table_cycles");
+    stat_traversal_cycles = registerStatistic<uint64_t>("traversal_cycles");
+    stat_rerank_cycles = registerStatistic<uint64_t>("rerank_cycles");
+    stat_rerank_evals = registerStatistic<uint64_t>("rerank_evals");
+    stat_suspended = registerStatistic<uint64_t>("suspended_cycles");
+    ctx->vst_read_pending = false;
+    Phnsw::context_init(params);
+}
 
 /**
  * @description: Destructor (unused)
@@ -164,82 +267,328 @@ void Phnsw::setup() {
  * @return {*}
  */
 void Phnsw::complete(unsigned int phase) {
-    size_t w_size;
-    std::array<uint32_t, 40> *W_index = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_index", w_size);
+    uint32_t *W_index = ctx->Registers.ptr<uint32_t>(Reg::W_index);
     std::cout << "W_index: " << std::endl;
     int W_not_0_counts=0;
-    for (int i=0; i<40; i++) {
-        std::cout << W_index->at(i) << " ";
-        W_not_0_counts = W_index->at(i) ? W_not_0_counts+1 : W_not_0_counts;
+    for (uint32_t i=0; i<ctx->Registers.ref<uint32_t>(Reg::W_size); i++) {
+        std::cout << W_index[i] << " ";
+        W_not_0_counts = W_index[i] ? W_not_0_counts+1 : W_not_0_counts;
     }
     std::cout << std::endl;
     std::cout << "W_not_0_counts = " << W_not_0_counts << std::endl;
-    std::array<uint32_t, 40> *W_dist = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_dist", w_size);
+    uint32_t *W_dist = ctx->Registers.ptr<uint32_t>(Reg::W_dist);
     std::cout << "W_dist: " << std::endl;
-    for (int i=0; i<40; i++) {
-        std::cout << W_dist->at(i) << " ";
+    for (uint32_t i=0; i<ctx->Registers.ref<uint32_t>(Reg::W_size); i++) {
+        std::cout << W_dist[i] << " ";
     }
-    std::cout << "push W times = " << pushw_times << std::endl;
+    std::cout << std::endl;
     // output.verbose(CALL_INFO, 1, 0, "Component is participating in phase %d of complete.\n", phase);
 }
 
 /**
- * @description: lifecycle function: finish (unuesd)
+ * @description: lifecycle function: finish,
+ *               print the batch summary and write the per query log.
  * @return {*}
  */
 void Phnsw::finish() {
     std::cout << std::endl;
+    if (query_records.empty()) return;
+    // with several contexts the queries overlap, the last one to start is not the last to end
+    SST::SimTime_t sum_ns = 0, max_ns = 0, first_ns = query_records.front().start_ns, last_ns = 0;
+    for (auto &&r : query_records) {
+        SST::SimTime_t ns = r.end_ns - r.start_ns;
+        sum_ns += ns;
+        max_ns = std::max(max_ns, ns);
+        first_ns = std::min(first_ns, r.start_ns);
+        last_ns = std::max(last_ns, r.end_ns);
+    }
+    SST::SimTime_t span_ns = last_ns - first_ns;
+    output.output("Batch%s: %zu queries, avg latency %.3f us, max latency %.3f us, %.1f QPS\n",
+        cores > 1 ? (" " + getName()).c_str() : "", query_records.size(), (double) sum_ns / query_records.size() / 1000, (double) max_ns / 1000,
+        span_ns ? query_records.size() * 1e9 / span_ns : 0.0);
+    if (ctx->rr.r) {
+        uint64_t traversal = 0, rerank = 0;
+        for (auto &&r : query_records) {
+            traversal += r.traversal_cycles;
+            rerank += r.rerank_cycles;
+        }
+        output.output("Re-rank: top %u to %u, avg %.1f traversal + %.1f re-rank cycles per query\n", ctx->rr.r, ctx->rr.k,
+            (double) traversal / query_records.size(), (double) rerank / query_records.size());
+    }
+    if (context_count > 1) {
+        // utilization: share of the core cycles each context issued a bundle in
+        std::string shares;
+        uint64_t issued = 0;
+        for (uint32_t c = 0; c < context_count; c++) {
+            char share[32];
+            snprintf(share, sizeof(share), " %.1f%%", timestamp ? 100.0 * ctx_issue_cycles[c] / timestamp : 0.0);
+            shares += share;
+            issued += ctx_issue_cycles[c];
+        }
+        output.output("Contexts: %u %s, issue per context%s, core issues %.1f%% of %" PRIu64 " cycles, %" PRIu64 " switches\n",
+            context_count, ctx_policy == ContextPolicy::OLDEST ? "oldest" : "round-robin", shares.c_str(),
+            timestamp ? 100.0 * issued / timestamp : 0.0, timestamp, ctx_switches);
+    }
+    if (cores > 1) {
+        std::lock_guard<std::mutex> guard(core_summary.lock);
+        core_summary.queries += query_records.size();
+        core_summary.start_ns = std::min(core_summary.start_ns, first_ns);
+        core_summary.end_ns = std::max(core_summary.end_ns, last_ns);
+        core_summary.cores = cores;
+        if (++core_summary.reported == cores) {
+            SST::SimTime_t all_ns = core_summary.end_ns - core_summary.start_ns;
+            double qps = all_ns ? core_summary.queries * 1e9 / all_ns : 0.0;
+            output.output("Cores: %u cores, %zu queries in %.3f us, %.1f QPS aggregate, %.1f QPS per core\n",
+                cores, core_summary.queries, (double) all_ns / 1000, qps, qps / cores);
+        }
+    }
+    if (query_log.empty()) return;
+    std::ofstream log_file(query_log);
+    if (!log_file) {
+        output.fatal(CALL_INFO, -1, "ERROR: can not open queryLog %s\n", query_log.c_str());
+    }
+    log_file << "query,ep,start_cycle,end_cycle,cycles,start_ns,end_ns,top_index,top_dist,traversal_cycles,rerank_cycles\n";
+    for (auto &&r : query_records) {
+        log_file << r.query << "," << r.ep << ","
+        << r.start_cycle << "," << r.end_cycle << "," << r.end_cycle - r.start_cycle << ","
+        << r.start_ns << "," << r.end_ns << ","
+        << r.top_index << "," << r.top_dist << ","
+        << r.traversal_cycles << "," << r.rerank_cycles << "\n";
+    }
     // output.verbose(CALL_INFO, 1, 0, "Component is being finished.\n");
 }
 
 
 /**
  * @description: Clock callback function
+ *               Every context moves its in-flight work on and an idle one takes the next query,
+ *               then the active context issues a bundle. If it stalls, the other contexts are
+ *               tried in policy order and the first one that issues becomes the active context.
+ *               Stall statistics count the cycles nothing issued, with the active context's reason.
  * @param {Cycle_t} currentCycle, passed into this function by memory
  * @return {*}
  */
 bool Phnsw::clockTick( SST::Cycle_t currentCycle ) {
     timestamp++;
-    for (auto &i : inst_struct) {
-        // std::cout << "inst: " << i.asmop
-        // << " stage_now: " << *i.stage_now
-        // << " stages: " << i.stages
-        // << std::endl;
-        if (*i.stage_now >= i.stages) {
-            *i.stage_now = 0;
-            if (i.rd != "nord") {
-                size_t rd_size;
-                void *rd = Registers.find_match(i.rd, rd_size);
-                std::memcpy(rd, i.rd_temp, rd_size);
-                // if (i.rd == "dist_res") std::cout << "dist_res: " << *(float *)rd << std::endl;
-            }
-            if (i.rd2 != "nord") {
-                size_t rd2_size;
-                void *rd2 = Registers.find_match(i.rd2, rd2_size);
-                std::memcpy(rd2, i.rd2_temp, rd2_size);
-            }
-        } else {
-            if (*i.stage_now != 0) (*i.stage_now) ++;
-        }
+    const uint32_t active = ctx_now;
+    for (uint32_t c = 0; c < context_count; c++) {
+        Phnsw::switch_to(c);
+        Phnsw::unit_tick();
+        Phnsw::prefetch_tick(); // runs while the pc is stalled too
+        Phnsw::pq_tick();
+        Phnsw::rerank_tick();
+        if (ctx->query_idle && query_now < query_set.size()) Phnsw::start_query();
     }
+    Phnsw::switch_to(active);
 
-    
-    Phnsw::inst_count = 0;
     // std::cout << pc << std::endl;
-    if (dma->stopFlag == false) {
-        inst_now = Phnsw::img[pc];
-        for (auto &inst : inst_now) {
-            for(auto &&i : inst_struct) {
-                if (inst[0].compare(i.asmop) == 0) {
-                    (this->*(i.handeler))(i.rd_temp, i.rd2_temp, i.stage_now); // Exe instruction function
-                }
-            }
-            inst_count ++;
+    if (dma->stopFlag) {
+        Issue stall = ctx->query_idle ? Issue::IDLE : Issue::DMA;
+        Phnsw::count_stall(stall, 1);
+        return Phnsw::suspend(currentCycle, stall, false);
+    }
+    Issue stall = Phnsw::issue_bundle();
+    Issue issued = stall;
+    // a stall that ends by itself, without a DMA completion, keeps the clock running
+    bool timed = stall != Issue::DMA && stall != Issue::IDLE && stall != Issue::PQ_TABLE;
+    if (issued != Issue::ISSUED && context_count > 1) {
+        // the active context waits (DMA, VST, ...): the first other context that can issue does
+        uint32_t *order = ctx_order.data(), *order_end = order + context_count - 1;
+        for (uint32_t n = 1; n < context_count; n++) order[n - 1] = (active + n) % context_count;
+        if (ctx_policy == ContextPolicy::OLDEST) {
+            // earliest started query first, idle contexts last
+            std::stable_sort(order, order_end, [&](uint32_t a, uint32_t b) {
+                const Context &x = contexts[a], &y = contexts[b];
+                return x.query_idle != y.query_idle ? y.query_idle : x.started_at < y.started_at;
+            });
+        }
+        for (const uint32_t *c = order; c != order_end; c++) {
+            Phnsw::switch_to(*c);
+            issued = Phnsw::issue_bundle();
+            if (issued == Issue::ISSUED) break;
+            timed = timed || (issued != Issue::DMA && issued != Issue::IDLE && issued != Issue::PQ_TABLE);
+        }
+    }
+    if (issued == Issue::ISSUED) {
+        if (ctx_now != active) {
+            ctx_switches++;
+            stat_ctx_switches->addData(1);
         }
-        inst_time ++;
-        pc ++;
+        ctx_issue_cycles[ctx_now]++;
+        stat_ctx_issue[ctx_now]->addData(1);
+        return false;
     }
-    return false;
+    Phnsw::switch_to(active);
+    Phnsw::count_stall(stall, 1);
+    return Phnsw::suspend(currentCycle, stall, timed);
+}
+
+/**
+ * @description: Credit cycles nothing issued in to the statistic of the active context's stall.
+ * @param {Issue} stall reason of the active context
+ * @param {uint64_t} cycles
+ * @return {*}
+ */
+void Phnsw::count_stall(Issue stall, uint64_t cycles) {
+    if (!cycles) return;
+    switch (stall) {
+    case Issue::DMA:        stat_stall_dma->addDataNTimes(cycles, 1); break;
+    case Issue::HAZARD:     stat_stall_hazard->addDataNTimes(cycles, 1); break;
+    case Issue::DIST_BUSY:  stat_stall_dist_busy->addDataNTimes(cycles, 1); break;
+    case Issue::QUEUE_BUSY: stat_stall_queue_busy->addDataNTimes(cycles, 1); break;
+    case Issue::PQ_TABLE:   stat_stall_pq_table->addDataNTimes(cycles, 1); break;
+    default: break; // idle, or END waiting for the re-rank (rerank_cycles)
+    }
+}
+
+/**
+ * @description: Whether the active context only waits for the DMA: no unit result in flight, no
+ *               ADC table build or re-rank running on the clock, and a prefetcher that can not
+ *               move before a DMA op completes.
+ * @return {bool}
+ */
+bool Phnsw::dma_bound() {
+    if (!ctx->in_flight.empty()) return false;
+    if (ctx->pq.state == PqTable::BUILD || (ctx->pq.state == PqTable::LOAD && Phnsw::dma_done(ctx->pq.codebook_tag))) return false;
+    if (ctx->rr.state == Reranker::RUN) return false;
+    if (ctx->query_idle && query_now < query_set.size()) return false;
+    if (!ctx->pf.depth || !ctx->pf.active) return true;
+    if (!ctx->pf.list_ready) return !Phnsw::dma_done(ctx->pf.list_tag);
+    for (auto &&slot : ctx->pf.slots) {
+        if (slot.state == PrefetchSlot::TEST && Phnsw::dma_done(slot.tag)) return false;
+    }
+    if (ctx->pf.next < ctx->pf.count && ctx->pf.next < ctx->pf.head + ctx->pf.depth) {
+        const PrefetchSlot &slot = ctx->pf.slots[ctx->pf.next % ctx->pf.depth];
+        return slot.state == PrefetchSlot::TEST && !Phnsw::dma_done(slot.tag);
+    }
+    return true;
+}
+
+/**
+ * @description: End of a cycle nothing issued in: turn the clock off if every context only waits
+ *               for the DMA (or for a query from host_link), resume() turns it on again.
+ * @param {Cycle_t} cycle of this tick
+ * @param {Issue} stall reason of the active context, credited for every cycle skipped
+ * @param {bool} timed some context waits for something that ends by itself
+ * @return {bool} true to unregister the clock handler
+ */
+bool Phnsw::suspend(SST::Cycle_t cycle, Issue stall, bool timed) {
+    if (!suspend_clock || timed) return false;
+    const uint32_t active = ctx_now;
+    bool bound = true;
+    for (uint32_t c = 0; c < context_count && bound; c++) {
+        Phnsw::switch_to(c);
+        bound = Phnsw::dma_bound();
+    }
+    Phnsw::switch_to(active);
+    if (!bound) return false;
+    suspended = true;
+    suspend_cycle = cycle;
+    suspend_stall = stall;
+    return true;
+}
+
+/**
+ * @description: Turn the clock on again after a DMA op completed or a query came in, the cycles
+ *               it was off count as they would have: timestamp and the stall statistic.
+ * @return {*}
+ */
+void Phnsw::resume() {
+    if (!suspended) return;
+    suspended = false;
+    SST::Cycle_t next = reregisterClock(clockTC, clockHandler);
+    uint64_t skipped = next - suspend_cycle - 1;
+    timestamp += skipped;
+    Phnsw::count_stall(suspend_stall, skipped);
+    stat_suspended->addDataNTimes(skipped, 1);
+}
+
+/**
+ * @description: Write back the results of the active context's ops that are due this cycle,
+ *               ops still in flight are not touched.
+ * @return {*}
+ */
+void Phnsw::unit_tick() {
+    while (!ctx->in_flight.empty() && ctx->in_flight.top().done_at <= timestamp) {
+        const InFlight &op = ctx->in_flight.top();
+        if (op.rd != Reg::NONE) {
+            std::memcpy(ctx->Registers.slot(op.rd), &op.rd_temp, ctx->Registers.size(op.rd));
+            ctx->reg_pending[op.rd]--;
+        }
+        if (op.rd2 != Reg::NONE) {
+            std::memcpy(ctx->Registers.slot(op.rd2), &op.rd2_temp, ctx->Registers.size(op.rd2));
+            ctx->reg_pending[op.rd2]--;
+        }
+        ctx->in_flight.pop();
+    }
+}
+
+/**
+ * @description: Issue bundle pc of the active context, unless a register, the DMA, a DIST unit,
+ *               a queue unit, the ADC table or the re-rank holds it.
+ * @return {Issue} ISSUED, or the reason the bundle waits
+ */
+Phnsw::Issue Phnsw::issue_bundle() {
+    if (ctx->query_idle) return Issue::IDLE; // no query left, or shard mode waiting for the next one
+    if (ctx->vst_read_pending && Phnsw::dma_done(ctx->vst_read_tag)) {
+        ctx->vst_read_pending = false;
+        if (ctx->Registers.ref<uint8_t>(Reg::vst_res)) stat_vst_hits->addData(1);
+    }
+    if (!ctx->query_started) { // first bundle of this query
+        ctx->query_started = true;
+        query_records[ctx->record_now].start_cycle = getCurrentSimTime(clockTC);
+        query_records[ctx->record_now].start_ns = getCurrentSimTimeNano();
+    }
+    if ((size_t) ctx->pc + 1 >= bundle_begin.size()) {
+        output.fatal(CALL_INFO, -1, "ERROR: pc=%d runs out of the image\n", ctx->pc);
+    }
+    // interlock: wait for registers the bundle touches that are still being written back
+    for (uint32_t d = deps_begin[ctx->pc]; d < deps_begin[ctx->pc + 1]; d++) {
+        if (ctx->reg_pending[deps[d]]) return Issue::HAZARD;
+        if (!Phnsw::dma_done(ctx->reg_dma_tag[deps[d]])) return Issue::DMA;
+    }
+    // structural hazard: every DIST of the bundle needs a free DIST unit
+    if (bundle_dists[ctx->pc]) {
+        uint32_t free_units = 0;
+        for (auto &&free_at : dist_unit_free) free_units += free_at <= timestamp;
+        if (free_units < bundle_dists[ctx->pc]) return Issue::DIST_BUSY;
+    }
+    const DecodedInst *inst = &code[bundle_begin[ctx->pc]];
+    const DecodedInst *bundle_end = &code[0] + bundle_begin[ctx->pc + 1];
+    for (const DecodedInst *sync = inst; sync != bundle_end; sync++) {
+        if (!Phnsw::dma_wait(*sync)) return Issue::DMA;
+        // structural hazard: the priority queue is still busy with its last operation
+        int q = Phnsw::queue_of(*sync);
+        if (q >= 0 && queues[q].free_at > timestamp) return Issue::QUEUE_BUSY;
+        if (sync->op == OP_DIST && sync->mode == DIST_PQ && !Phnsw::pq_table_ready()) return Issue::PQ_TABLE;
+        // END closes the traversal, the query is done once W is re-ranked
+        if (sync->op == OP_END && ctx->rr.state != Reranker::DONE) {
+            if (ctx->rr.state == Reranker::IDLE) Phnsw::rerank_start();
+            if (ctx->rr.state != Reranker::DONE) return Issue::RERANK;
+        }
+    }
+    for (; inst != bundle_end; inst++) {
+        uint32_t latency = inst->op == OP_DIST ? Phnsw::issue_dist(*inst) : unit_latency[inst->op];
+        InFlight op = {timestamp + std::max<uint32_t>(latency, 1), issue_seq++, inst->unit->rd, inst->unit->rd2, 0, 0};
+        bool writes_back = false;
+        stat_inst[inst->op]->addData(1);
+        (this->*(inst->unit->handeler))(*inst, &op.rd_temp, &op.rd2_temp, &writes_back); // Exe instruction function
+        if (writes_back) { // result is written back after the latency, in its own buffer
+            if (op.rd != Reg::NONE) ctx->reg_pending[op.rd]++;
+            if (op.rd2 != Reg::NONE) ctx->reg_pending[op.rd2]++;
+            ctx->in_flight.push(op);
+        }
+        if (const QueueTiming::Op *qop = Phnsw::queue_op(*inst)) {
+            // every op writes back through its own in-flight entry, the next op only waits for the occupancy
+            QueueUnit &queue = queues[Phnsw::queue_of(*inst)];
+            queue.free_at = std::max(queue.free_at, timestamp) + qop->occupancy;
+        }
+    }
+    // old model: nothing runs while the DMA is busy
+    if (dma_blocking && !dma->idle()) dma->stopFlag = true;
+    inst_time ++;
+    ctx->pc ++;
+    return Issue::ISSUED;
 }
 
 /**
@@ -258,483 +607,282 @@ void Phnsw::handleEvent(SST::Interfaces::StandardMem::Request * response) {
 }
 
 const std::vector<Phnsw::InstStruct> Phnsw::inst_struct = {
-    {"END", "end the simulation", &Phnsw::inst_end, "nord", "nord", 1},
-    {"JMP", "jump to a pc", &Phnsw::inst_jmp, "nord", "nord", 1},
-    {"MOV", "move data between regs", &Phnsw::inst_mov, "nord", "nord", 1},
-    {"ADD", "add two numbers", &Phnsw::inst_add, "alu_res", "nord", 1},
-    {"SUB", "sub two numbers", &Phnsw::inst_sub, "alu_res", "nord", 1},
-    {"CMP", "cmp two numbers", &Phnsw::inst_cmp, "cmp_res", "nord", 1},
-    {"DIST", "calc distance", &Phnsw::inst_dist, "dist_res", "nord", 1},
-    {"LOOK", "look up", &Phnsw::inst_look, "look_res_index", "nord", 1},
-    {"PUSH", "push element to list", &Phnsw::inst_push, "nord", "nord", 1},
-    {"RMC", "remove element from C", &Phnsw::inst_rmc, "C_dist", "C_index", 8},
-    {"RMW", "remove element from W", &Phnsw::inst_rmw, "W_dist", "W_index", 8},
-    {"DMA", "Access read from mem", &Phnsw::inst_dma, "nord", "nord", 1},
-    {"VST", "Access write to mem", &Phnsw::inst_vst, "vst_res", "nord", 1},
-    {"RAW", "Load RAW From SPM to RAW1", &Phnsw::inst_raw, "nord", "nord", 1},
-    {"NEI", "Load N[i] from SPM to DAMindex", &Phnsw::inst_nei, "nord", "nord", 1},
-    {"ACW", "Access to W", &Phnsw::inst_acw, "nord", "nord", 1},
-    {"INFO", "print reg info", &Phnsw::inst_info, "nord", "nord", 1},
-    {"dummy", "dummy inst", &Phnsw::inst_dummy, "nord", "nord", 1}};
-
-int Phnsw::inst_end(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    std::cout << "pc=" << Phnsw::pc << " " << "inst: " << "END" << std::endl;
+    {"END", "end the simulation", OP_END, &Phnsw::inst_end, Reg::NONE, Reg::NONE},
+    {"JMP", "jump to a pc", OP_JMP, &Phnsw::inst_jmp, Reg::NONE, Reg::NONE},
+    {"MOV", "move data between regs", OP_MOV, &Phnsw::inst_mov, Reg::NONE, Reg::NONE},
+    {"ADD", "add two numbers", OP_ADD, &Phnsw::inst_add, Reg::alu_res, Reg::NONE},
+    {"SUB", "sub two numbers", OP_SUB, &Phnsw::inst_sub, Reg::alu_res, Reg::NONE},
+    {"CMP", "cmp two numbers", OP_CMP, &Phnsw::inst_cmp, Reg::cmp_res, Reg::NONE},
+    {"DIST", "calc distance", OP_DIST, &Phnsw::inst_dist, Reg::dist_res, Reg::NONE},
+    {"LOOK", "look up", OP_LOOK, &Phnsw::inst_look, Reg::look_res_index, Reg::NONE},
+    {"PUSH", "push element to list", OP_PUSH, &Phnsw::inst_push, Reg::NONE, Reg::NONE},
+    {"RMC", "pop the min of C", OP_RMC, &Phnsw::inst_rmc, Reg::rmc_dist, Reg::rmc_index},
+    {"RMW", "pop the max of W", OP_RMW, &Phnsw::inst_rmw, Reg::rmw_dist, Reg::rmw_index},
+    {"DMA", "Access read from mem", OP_DMA, &Phnsw::inst_dma, Reg::NONE, Reg::NONE},
+    {"VST", "Access write to mem", OP_VST, &Phnsw::inst_vst, Reg::vst_res, Reg::NONE},
+    {"RAW", "Load RAW From SPM to RAW1", OP_RAW, &Phnsw::inst_raw, Reg::NONE, Reg::NONE},
+    {"NEI", "Load N[i] from SPM to DAMindex", OP_NEI, &Phnsw::inst_nei, Reg::NONE, Reg::NONE},
+    {"ACW", "peek the max of W", OP_ACW, &Phnsw::inst_acw, Reg::acw_dist, Reg::acw_index},
+    {"WAIT", "wait for a dma tag", OP_WAIT, &Phnsw::inst_wait, Reg::NONE, Reg::NONE},
+    {"FENCE", "wait for every dma op", OP_FENCE, &Phnsw::inst_fence, Reg::NONE, Reg::NONE},
+    {"INFO", "print reg info", OP_INFO, &Phnsw::inst_info, Reg::NONE, Reg::NONE},
+    {"dummy", "dummy inst", OP_DUMMY, &Phnsw::inst_dummy, Reg::NONE, Reg::NONE}};
+
+int Phnsw::inst_end(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    std::cout << "pc=" << ctx->pc << " " << "inst: " << "END" << std::endl;
+    if (Phnsw::next_query()) {
+        ctx->pc = -1; // restart the program
+        return 0;
+    }
     primaryComponentOKToEndSim();
     return 0;
 }
 
-int Phnsw::inst_jmp(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    std::string imm_name = inst_now[inst_count][1];
-    int imm;
-    if (imm_name.back() == ']' && imm_name[0] == '[') {
-        imm = std::stoull(imm_name.substr(1, imm_name.size() - 2));
-    } else {
-        output.fatal(CALL_INFO, -1, "ERROR: %s", "jmp imm must be in [imm] format");
-    }
-    uint8_t *cmp_res;
-    size_t cmp_size;
-    try {
-        cmp_res = (uint8_t *) Phnsw::Registers.find_match("cmp_res", cmp_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s cmp_res", e);
-    }
-
-    if (*cmp_res == 1) {
-        // std::cout << "jmp from " << pc << " to " << imm << std::endl;
-        Phnsw::pc = imm;
-        Phnsw::pc --;
+int Phnsw::inst_jmp(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    if (ctx->Registers.ref<uint8_t>(Reg::cmp_res) == 1) {
+        // std::cout << "jmp from " << pc << " to " << inst.target << std::endl;
+        ctx->pc = inst.target;
+        ctx->pc --;
     } else {
         // std::cout << "no jmp" << std::endl;
     }
     return 0;
 }
 
-int Phnsw::inst_mov(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    uint64_t imm;
-    std::string src_name = inst_now[inst_count][1];
-    std::string rd_name = inst_now[inst_count][2];
-    size_t src_size;
-    size_t rd_size;
-    void* src_ptr;
-    void* rd_ptr;
-    void* imm_ptr = &imm;
-    if (src_name.back() == ']' && src_name[0] == '[') { // is imm
-        // std::cout << "is imm" << std::endl;
-        src_ptr = imm_ptr;
-        src_size = sizeof(imm);
-        imm = std::stoull(src_name.substr(1, src_name.size() - 2));
-    } else {
-        // std::cout << "is reg" << std::endl;
-        try {
-            src_ptr = Phnsw::Registers.find_match(src_name, src_size);
-        } catch (char *e) {
-            output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, src_name.c_str());
-        }
-    }
-    try {
-        rd_ptr = Phnsw::Registers.find_match(rd_name, rd_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, rd_name.c_str());
-    }
-    if (rd_size > src_size) { // if rd_size > src_size, reset rd
-        std::memset(rd_ptr, 0, rd_size);
+int Phnsw::inst_mov(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    const Operand &src = inst.src[0];
+    const Operand &rd = inst.src[1];
+    void *rd_ptr = ctx->Registers.slot(rd.reg);
+    if (rd.size > src.size) { // if rd_size > src_size, reset rd
+        std::memset(rd_ptr, 0, rd.size);
     }
     // std::cout << "pc=" << Phnsw::pc << " ";
     // std::cout << "before rd=" << *(uint32_t *) rd_ptr << "; ";
     // std::cout << "inst: " << "MOV ";
-    // std::cout << "reg1: " << inst_now[inst_count][1] << "; ";
-    // std::cout << "reg2: " << inst_now[inst_count][2] << "; ";
-    // uint8_t temp = 't';
-    // std::memcpy(src_ptr, &temp, src_size);
-    // std::cout << "src init as " << std::bitset<sizeof(uint32_t) * 8>(*(uint32_t *) src_ptr) << "; ";
-    std::memcpy(rd_ptr, src_ptr, min(src_size, rd_size));
-    // std::cout << " inst_now length=" << inst_now[inst_count].size() << "; ";
+    // std::cout << "reg1: " << (*inst.text)[1] << "; ";
+    // std::cout << "reg2: " << (*inst.text)[2] << "; ";
+    std::memcpy(rd_ptr, operand_ptr(src), min(src.size, rd.size));
     // std::cout << "after copy rd=" << std::bitset<sizeof(uint8_t) * 8>(*(uint8_t *) rd_ptr) << std::endl;
     return 0;
 }
 
-int Phnsw::inst_add(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    uint8_t *src1_ptr, *src2_ptr, *rd_ptr;
-    uint8_t imm1, imm2;
-    size_t src1_size, src2_size, rd_size;
-    std::string src1_name = inst_now[inst_count][1];
-    std::string src2_name = inst_now[inst_count][2];
-    if (src1_name.back() == ']' && src1_name[0] == '[') {
-        imm1 = std::stoull(src1_name.substr(1, src1_name.size() - 2));
-        src1_ptr = &imm1; src1_size = sizeof(imm1);
-    } else {
-        src1_ptr = (uint8_t *) Phnsw::Registers.find_match(src1_name, src1_size);
-    }
-    if (src2_name.back() == ']' && src2_name[0] == '[') {
-        imm2 = std::stoull(src2_name.substr(1, src2_name.size() - 2));
-        src2_ptr = &imm2; src2_size = sizeof(imm2);
-    } else {
-        src2_ptr = (uint8_t *) Phnsw::Registers.find_match(src2_name, src2_size);
-    }
-
-    rd_ptr = (uint8_t *) rd_temp_ptr;
-    *rd_ptr = *src1_ptr + *src2_ptr;
+int Phnsw::inst_add(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    uint8_t *rd_ptr = (uint8_t *) rd_temp_ptr;
+    *rd_ptr = *(const uint8_t *) operand_ptr(inst.src[0]) + *(const uint8_t *) operand_ptr(inst.src[1]);
     return 0;
 }
 
-int Phnsw::inst_sub(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    uint8_t *src1_ptr, *src2_ptr, *rd_ptr;
-    uint8_t imm1, imm2;
-    size_t src1_size, src2_size, rd_size;
-    std::string src1_name = inst_now[inst_count][1];
-    std::string src2_name = inst_now[inst_count][2];
-    if (src1_name.back() == ']' && src1_name[0] == '[') {
-        imm1 = std::stoull(src1_name.substr(1, src1_name.size() - 2));
-        src1_ptr = &imm1; src1_size = sizeof(imm1);
-    } else {
-        src1_ptr = (uint8_t *) Phnsw::Registers.find_match(src1_name, src1_size);
-    }
-    if (src2_name.back() == ']' && src2_name[0] == '[') {
-        imm2 = std::stoull(src2_name.substr(1, src2_name.size() - 2));
-        src2_ptr = &imm2; src2_size = sizeof(imm2);
-    } else {
-        src2_ptr = (uint8_t *) Phnsw::Registers.find_match(src2_name, src2_size);
-    }
-
-    rd_ptr = (uint8_t *) rd_temp_ptr;
-    *rd_ptr = *src1_ptr - *src2_ptr;
-    // std::cout << "sub  " << src1_name << "=" << (uint32_t) *src1_ptr << " "
-    // << src2_name << "=" << (uint32_t) *src2_ptr << " "
+int Phnsw::inst_sub(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    uint8_t *rd_ptr = (uint8_t *) rd_temp_ptr;
+    *rd_ptr = *(const uint8_t *) operand_ptr(inst.src[0]) - *(const uint8_t *) operand_ptr(inst.src[1]);
+    // std::cout << "sub  " << (*inst.text)[1] << "=" << (uint32_t) *(const uint8_t *) operand_ptr(inst.src[0]) << " "
+    // << (*inst.text)[2] << "=" << (uint32_t) *(const uint8_t *) operand_ptr(inst.src[1]) << " "
     // << "res=" << (uint32_t) *rd_ptr << std::endl;
     return 0;
 }
 
-int Phnsw::inst_cmp(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) { // TODO test this
-    *stage_now = 1;
-    uint32_t src1=0, src2=0;
-    uint32_t src1_tmp=0, src2_tmp=0;
-    void *src1_ptr_8, *src2_ptr_8;
-    uint8_t *rd_ptr;
-    size_t src1_size=0, src2_size=0, rd_size=0;
-    std::string cmp_mode = inst_now[inst_count][1];
-    std::string src1_name = inst_now[inst_count][2];
-    std::string src2_name = inst_now[inst_count][3];
-
-    if (src1_name.back() == ']' && src1_name[0] == '[') { // is imm
-        src1_tmp = std::stoull(src1_name.substr(1, src1_name.size() - 2));
-    } else {
-        src1_ptr_8 = Phnsw::Registers.find_match(src1_name, src1_size);
-        std::memcpy(&src1_tmp, src1_ptr_8, src1_size);
-    }
-    src1 = (uint32_t) src1_tmp;
-    if (src2_name.back() == ']' && src2_name[0] == '[') { // is imm
-        src2_tmp = std::stoull(src2_name.substr(1, src2_name.size() - 2));
-    } else {
-        src2_ptr_8 = Phnsw::Registers.find_match(src2_name, src2_size);
-        std::memcpy((void *) &src2_tmp, src2_ptr_8, src2_size);
-    }
-    src2 = (uint32_t) src2_tmp;
-
-    rd_ptr = (uint8_t *) rd_temp_ptr;
-    if (cmp_mode == "EQ") {
-        *rd_ptr = (src1 == src2);
-    } else if (cmp_mode == "NE") {
-        *rd_ptr = (src1 != src2);
-    } else if (cmp_mode == "GT") {
-        *rd_ptr = (src1 > src2);
-    } else if (cmp_mode == "LT") {
-        *rd_ptr = (src1 < src2);
-    } else if (cmp_mode == "GE") {
-        *rd_ptr = (src1 >= src2);
-    } else if (cmp_mode == "LE") {
-        *rd_ptr = (src1 <= src2);
+int Phnsw::inst_cmp(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    uint32_t src1 = operand_u32(inst.src[0]);
+    uint32_t src2 = operand_u32(inst.src[1]);
+    uint8_t *rd_ptr = (uint8_t *) rd_temp_ptr;
+    switch (inst.mode) {
+        case CMP_EQ: *rd_ptr = (src1 == src2); break;
+        case CMP_NE: *rd_ptr = (src1 != src2); break;
+        case CMP_GT: *rd_ptr = (src1 > src2); break;
+        case CMP_LT: *rd_ptr = (src1 < src2); break;
+        case CMP_GE: *rd_ptr = (src1 >= src2); break;
+        case CMP_LE: *rd_ptr = (src1 <= src2); break;
+        default: break;
     }
     return 0;
 }
 
-int Phnsw::inst_dist(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    std::array<float,  128> *src1_ptr, *src2_ptr;
-    uint32_t *rd_ptr;
-    size_t src1_size, src2_size, rd_size;
-    src1_ptr = (std::array<float, 128> *) Phnsw::Registers.find_match("raw1", src1_size);
-    src2_ptr = (std::array<float, 128> *) Phnsw::Registers.find_match("raw2", src2_size);
-    rd_ptr = (uint32_t *) rd_temp_ptr;
-    *rd_ptr = 0;
-    float dist_tmp = 0;
-    for(size_t i=0; i<src1_ptr->size(); i++) {
-        float t = src1_ptr->at(i) - src2_ptr->at(i);
-        // std::cout << "t^2=" << t * t << "; ";
-        dist_tmp += pow(t, 2);
-    }
-    *rd_ptr = (uint32_t) dist_tmp;
+int Phnsw::inst_dist(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    if (inst.mode == DIST_T) {
+        Phnsw::pq_build(); // no write back, DIST PQ waits for the table
+        return 0;
+    }
+    *writes_back = true;
+    stat_dist_evals->addData(1);
+    if (inst.mode == DIST_PQ) {
+        // DIST PQ: sum of the table entries the code bytes select, in subspace order
+        if (ctx->pq.state == PqTable::NONE) {
+            output.fatal(CALL_INFO, -1, "ERROR: pc=%d DIST PQ without an ADC table, run DIST T first\n", ctx->pc);
+        }
+        const uint8_t *code = ctx->Registers.ptr<uint8_t>(Reg::pq_code);
+        const float *table = ctx->pq.table.data();
+        float sum = 0;
+        for (uint32_t m = 0; m < layout.pq_m; m++) sum += table[m * IMAGE_PQ_KSUB + code[m]];
+        *(uint32_t *) rd_temp_ptr = (uint32_t) sum;
+        return 0;
+    }
+    const uint8_t *src1_ptr = ctx->Registers.ptr<uint8_t>(Reg::raw1);
+    const uint8_t *src2_ptr = ctx->Registers.ptr<uint8_t>(Reg::raw2);
+    uint32_t *rd_ptr = (uint32_t *) rd_temp_ptr;
+    if (ctx->batch_pending) {
+        // RAW S found the distance broadcast by another query of the batch, raw1 was not loaded
+        ctx->batch_pending = false;
+        *rd_ptr = ctx->batch_value;
+        return 0;
+    }
+    *rd_ptr = (uint32_t) Phnsw::raw_dist(src1_ptr, src2_ptr);
+    if (ctx->raw1_node != UINT32_MAX) Phnsw::batch_broadcast(src1_ptr, ctx->raw1_node);
+    ctx->raw1_node = UINT32_MAX;
     // std::cout << std::endl;
     // std::cout << "pc=" << Phnsw::pc << " ";
     // std::cout << "inst: " << "DIST" << "; ";
-    // std::cout << "raw1[0] " << (float) (*src1_ptr)[0] << "; ";
-    // std::cout << "raw2[0] " << (float) (*src2_ptr)[0] << "; ";
+    // std::cout << "raw1[0] " << src1_ptr[0] << "; ";
+    // std::cout << "raw2[0] " << src2_ptr[0] << "; ";
     // std::cout << "Value " << *rd_ptr << std::endl;
     return 0;
 }
 
-int Phnsw::inst_look(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    size_t list_size, list_index_size;
-    std::array<uint32_t, 10> *list = (std::array<uint32_t, 10> *) Phnsw::Registers.find_match("list", list_size);
-    std::array<uint32_t, 10> *list_index = (std::array<uint32_t, 10> *) Phnsw::Registers.find_match("list_index", list_index_size);
-    uint32_t *rd_index_ptr = (uint32_t *) rd_temp_ptr;
-    size_t rd_dist_size;
-    uint32_t *rd_dist_ptr = (uint32_t *) Phnsw::Registers.find_match("look_res_dist", rd_dist_size);
-    uint32_t res_index;
-    if (inst_now[inst_count][1] == "MAX") {
-        *rd_dist_ptr = *max_element(list->begin(), list->end());
-        res_index = (*list_index)[std::distance(list->begin(), max_element(list->begin(), list->end()))];
-    } else if (inst_now[inst_count][1] == "MIN") {
-        *rd_dist_ptr = *min_element(list->begin(), list->end());
-        res_index = (*list_index)[std::distance(list->begin(), min_element(list->begin(), list->end()))];
-    } else {
-        output.fatal(CALL_INFO, -1, "ERROR: look mode not found");
+/**
+ * @description: Squared L2 distance of two raw vectors in the image format, the kernel of DIST.
+ * @param {uint8_t*} a raw vector
+ * @param {uint8_t*} b raw vector
+ * @return {float}
+ */
+float Phnsw::raw_dist(const uint8_t *a, const uint8_t *b) const {
+    switch (layout.elem) {
+    case ImageElem::F16:
+        return l2sq_f16((const uint16_t *) a, (const uint16_t *) b, layout.dim);
+    case ImageElem::U8:
+        return l2sq_u8(a, b, layout.dist_weight.data(), layout.dim);
+    default:
+        return l2sq((const float *) a, (const float *) b, layout.dim);
     }
-    *rd_index_ptr = res_index;
-    return 0;
 }
 
-int Phnsw::inst_push(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    size_t src_size;
-    std::string src_dist_name = inst_now[inst_count][1];
-    std::string src_index_name = inst_now[inst_count][2];
-    std::string rd = inst_now[inst_count][3];
-    uint32_t *src_dist_ptr;
-    try {
-        src_dist_ptr = (uint32_t *) Phnsw::Registers.find_match(src_dist_name, src_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, src_dist_name.c_str());
-    }
-    uint32_t *src_index_ptr;
-    try {
-        src_index_ptr = (uint32_t *) Phnsw::Registers.find_match(src_index_name, src_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, src_index_name.c_str());
-    }
-    size_t X_size_size;
-    uint32_t *X_size;
-    try {
-        X_size = (uint32_t *) Phnsw::Registers.find_match(rd + "_size", X_size_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, rd.c_str());
-    }
-    // std::cout << "X_size = " << *X_size << std::endl;
-    int max_len = rd == "C" ? 360 : 40;
-    if (rd == "C") pushc_times ++; else pushw_times ++;
-    std::array<uint32_t, 360> *X_dist, *X_index;
-    uint32_t insert_pos = 0;
-    if (*X_size <= max_len) {
-        try {
-            X_dist = (std::array<uint32_t, 360> *) Phnsw::Registers.find_match(rd + "_dist", src_size);
-            X_index = (std::array<uint32_t, 360> *) Phnsw::Registers.find_match(rd + "_index", src_size);
-        } catch (char *e) {
-            output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, rd.c_str());
-        }
+int Phnsw::inst_look(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    uint32_t *list = ctx->Registers.ptr<uint32_t>(Reg::list);
+    uint32_t *list_end = list + ctx->Registers.count(Reg::list);
+    uint32_t *list_index = ctx->Registers.ptr<uint32_t>(Reg::list_index);
+    uint32_t *rd_index_ptr = (uint32_t *) rd_temp_ptr;
+    uint32_t *found;
+    if (inst.mode == LOOK_MAX) {
+        found = max_element(list, list_end);
     } else {
-        output.fatal(CALL_INFO, -1, "ERROR: %s_size too large = %d\n", rd.c_str(), *X_size);
+        found = min_element(list, list_end);
     }
-    uint32_t new_dist = *src_dist_ptr;
-    uint32_t new_index = *src_index_ptr;
+    ctx->Registers.ref<uint32_t>(Reg::look_res_dist) = *found;
+    *rd_index_ptr = list_index[found - list];
+    return 0;
+}
 
-    // Find insert pos
-    while (insert_pos  < *X_size && (*X_dist)[insert_pos] < new_dist) {
-        insert_pos++;
-    }
-    if (X_index->at(insert_pos) == new_index) {
-        return 0;
+int Phnsw::inst_push(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    bool is_c = inst.mode == LIST_C;
+    if (is_c) stat_push_c->addData(1); else stat_push_w->addData(1);
+    uint32_t new_dist = *(const uint32_t *) operand_ptr(inst.src[0]);
+    uint32_t new_index = *(const uint32_t *) operand_ptr(inst.src[1]);
+
+    // insert with capacity eviction, a full queue keeps its smallest entries
+    switch (Phnsw::queue(is_c ? 0 : 1).insert(new_dist, new_index)) {
+    case PriorityQueue::EVICTED: stat_queue_evictions->addData(1); break;
+    case PriorityQueue::DROPPED: stat_queue_drops->addData(1); break;
+    default: break;
     }
-    // std::cout << "inseart pos = " << insert_pos << std::endl;
-    // Shift elements to make new space for insertion
-    for (size_t i = max_len - 1; i > insert_pos; i--) {
-        // std::cout << "i=" << i << std::endl;
-        X_dist->at(i) = X_dist->at(i - 1);
-        X_index->at(i) = X_index->at(i - 1);
-    }
-    // insert at right position
-    X_dist->at(insert_pos) = *((uint32_t *) src_dist_ptr);
-    X_index->at(insert_pos) = *((uint32_t *) src_index_ptr);
-
-    // std::cout << "push " << src_dist_name << " = " << *src_dist_ptr << " "
-    // << src_index_name << " = " << *src_index_ptr << " "
-    // << rd << " "
-    // << "insert_pos = " << insert_pos << " "
-    // << "after insertion dist = " << (*X_dist)[insert_pos] << " "
-    // << "after insertion index = " << (*X_index)[insert_pos] << " "
+    // std::cout << "push " << (*inst.text)[1] << " = " << new_dist << " "
+    // << (*inst.text)[2] << " = " << new_index << " "
+    // << (*inst.text)[3] << " "
     // << std::endl;
-    *X_size = *X_size + 1;
     return 0;
 }
 
-int Phnsw::inst_rmc(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    size_t X_dist_size, X_index_size, idx_size, rd_size, rd2_size;
-    std::array<uint32_t, 360> *X_dist_ptr, *X_index_ptr, *rd_ptr, *rd2_ptr;
-    std::string idx = inst_now[inst_count][1];
-    std::string mode = inst_now[inst_count][2]; // R(eal) or C
-    uint32_t index_to_rm;
-    try {
-        index_to_rm = *(uint32_t *) Phnsw::Registers.find_match(idx, idx_size);
-        if (idx_size != sizeof(uint32_t)) {
-            output.fatal(CALL_INFO, -1, "ERROR: %s size not match!", idx.c_str());
-        }
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, idx.c_str());
-    }
-    try {
-        X_dist_ptr = (std::array<uint32_t, 360> *) Phnsw::Registers.find_match("C_dist", X_dist_size);
-        X_index_ptr = (std::array<uint32_t, 360> *) Phnsw::Registers.find_match("C_index", X_index_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "C_index");
-    }
-    uint32_t *rmc_dist, *rmc_index;
-    size_t  rmc_dist_size, rmc_index_size;
-    try {
-        rmc_dist = (uint32_t *) Phnsw::Registers.find_match("rmc_dist", rmc_dist_size);
-        rmc_index = (uint32_t *) Phnsw::Registers.find_match("rmc_index", rmc_index_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s%s", e, "rmc_index or rmc_dist not found");
-    }
-    rd_ptr = (std::array<uint32_t, 360> *) rd_temp_ptr;
-    rd2_ptr = (std::array<uint32_t, 360> *) rd2_temp_ptr;
-    *rd_ptr = *X_dist_ptr;
-    *rd2_ptr = *X_index_ptr;
-    size_t loops = 360;
-    for (size_t i=0; i<loops-1; i++) {
-        if (index_to_rm == loops) {
-            break;
-        }
-        if (i < index_to_rm) {
-            X_dist_ptr->at(i) = X_dist_ptr->at(i);
-            X_index_ptr->at(i) = X_index_ptr->at(i);
-        } else if (i >= index_to_rm) {
-            X_dist_ptr->at(i) = X_dist_ptr->at(i + 1);
-            X_index_ptr->at(i) = X_index_ptr->at(i + 1);
-        }
+int Phnsw::inst_rmc(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    stat_rmc->addData(1);
+    // pop-min of C into rmc_dist / rmc_index, an empty C gives UINT32_MAX / 0
+    uint32_t *rd_dist = (uint32_t *) rd_temp_ptr;
+    uint32_t *rd_index = (uint32_t *) rd2_temp_ptr;
+    if (!Phnsw::queue(0).pop_min(*rd_dist, *rd_index)) {
+        *rd_dist = UINT32_MAX;
+        *rd_index = 0;
     }
-    X_dist_ptr->at(loops-1) = 0;
-    X_index_ptr->at(loops-1) = 0;
-    uint32_t *X_size = (uint32_t *) Phnsw::Registers.find_match("C_size", rd_size);
     // std::cout << "RMC" << std::endl;
-    *X_size = *X_size - 1;
     return 0;
 }
 
-int Phnsw::inst_rmw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    *stage_now = 1;
-    size_t X_dist_size, X_index_size, idx_size, rd_size, rd2_size;
-    std::array<uint32_t, 40> *X_dist_ptr, *X_index_ptr, *rd_ptr, *rd2_ptr;
-    std::string idx = inst_now[inst_count][1];
-    std::string mode = inst_now[inst_count][2]; // R(eal) or W
-    uint32_t index_to_rm;
-    try {
-        index_to_rm = *(uint32_t *) Phnsw::Registers.find_match(idx, idx_size);
-        if (idx_size != sizeof(uint32_t) && idx_size != sizeof(uint8_t)) {
-            output.fatal(CALL_INFO, -1, "ERROR: %s size not match!\n", idx.c_str());
-        }
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s\n", e, idx.c_str());
-    }
-    try {
-        X_dist_ptr = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_dist", X_dist_size);
-        X_index_ptr = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_index", X_index_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "W_index");
-    }
-    uint32_t *rmw_dist, *rmw_index;
-    size_t  rmw_dist_size, rmw_index_size;
-    try {
-        rmw_dist = (uint32_t *) Phnsw::Registers.find_match("rmw_dist", rmw_dist_size);
-        rmw_index = (uint32_t *) Phnsw::Registers.find_match("rmw_index", rmw_index_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s%s", e, "rmw_index or rmw_dist not found");
-    }
-    rd_ptr = (std::array<uint32_t, 40> *) rd_temp_ptr;
-    rd2_ptr = (std::array<uint32_t, 40> *) rd2_temp_ptr;
-    *rd_ptr = *X_dist_ptr;
-    *rd2_ptr = *X_index_ptr;
-    size_t loops = 40;
-    for (size_t i=0; i<loops-1; i++) {
-        if (index_to_rm == loops) {
-            break;
-        }
-        if (i < index_to_rm) {
-            X_dist_ptr->at(i) = X_dist_ptr->at(i);
-            X_index_ptr->at(i) = X_index_ptr->at(i);
-        } else if (i >= index_to_rm) {
-            X_dist_ptr->at(i) = X_dist_ptr->at(i + 1);
-            X_index_ptr->at(i) = X_index_ptr->at(i + 1);
-        }
+int Phnsw::inst_rmw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    stat_rmw->addData(1);
+    // pop-max of W into rmw_dist / rmw_index
+    uint32_t *rd_dist = (uint32_t *) rd_temp_ptr;
+    uint32_t *rd_index = (uint32_t *) rd2_temp_ptr;
+    if (!Phnsw::queue(1).pop_max(*rd_dist, *rd_index)) {
+        *rd_dist = UINT32_MAX;
+        *rd_index = 0;
     }
-    X_dist_ptr->at(loops-1) = 0;
-    X_index_ptr->at(loops-1) = 0;
-    uint32_t *X_size = (uint32_t *) Phnsw::Registers.find_match("W_size", rd_size);
-    *X_size = *X_size - 1;
     return 0;
 }
 
-int Phnsw::inst_dma(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    dma->stopFlag = true;
-    uint64_t *dma_addr, *dma_size, *rd;
-    size_t addr_size, size_size, rd_size;
-    try {
-        dma_addr = (uint64_t *)Phnsw::Registers.find_match("dma_addr", addr_size);
-    }
-    catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "dma_addr");
-    }
-    try {
-        dma_size = (uint64_t *)Phnsw::Registers.find_match("dma_offset", addr_size);
-    }
-    catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "dma_offset");
-    }
-    try {
-        rd = (uint64_t *)Phnsw::Registers.find_match("dma_res", rd_size);
-    } catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "dma_res");
-    }
-    std::string option = inst_now[inst_count][1];
-    size_t index_size;
-    uint32_t *index = (uint32_t *) Phnsw::Registers.find_match("DMAindex", index_size);
+int Phnsw::inst_dma(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    uint64_t *dma_addr = ctx->Registers.ptr<uint64_t>(Reg::dma_addr);
+    uint64_t *dma_size = ctx->Registers.ptr<uint64_t>(Reg::dma_offset);
+    uint64_t *rd = ctx->Registers.ptr<uint64_t>(Reg::dma_res);
+    uint32_t *index = ctx->Registers.ptr<uint32_t>(Reg::DMAindex);
+    uint64_t tag;
     // std::cout << "DMAindex=" << *index << std::endl;
-    if (option == "R") {
+    if (inst.mode == DMA_R) {
         // std::cout << "DMA R" << std::endl;
-        *dma_addr = MEM_ADDR_BASE + MEM_RAW_BASE + *index * 128 * 4; // dim = 128
-        *dma_size = 128 * 4;
-        SST::Interfaces::StandardMem::Addr dstspmAddr = SPM_RAW_BASE;
-        dma->DMAget((SST::Interfaces::StandardMem::Addr) *dma_addr,
+        *dma_addr = Phnsw::raw_addr(*index);
+        *dma_size = layout.raw_size;
+        SST::Interfaces::StandardMem::Addr dstspmAddr = ctx->spm_raw;
+        tag = dma->DMAget((SST::Interfaces::StandardMem::Addr) *dma_addr,
                         dstspmAddr,
                         (uint32_t) *dma_size);
-    } else if (option == "N") {
+        Phnsw::dma_busy(Reg::NONE, tag);
+    } else if (inst.mode == DMA_N) {
         // std::cout << "DMA N" << std::endl;
-        *dma_addr = MEM_ADDR_BASE + *index * 32 * 4; // neighbor_list.size() = 32
+        // M neighbors in layer 0, upperM above
+        uint32_t layer = ctx->Registers.ref<uint32_t>(Reg::layer);
+        if (layer >= layout.levels) {
+            output.fatal(CALL_INFO, -1, "ERROR: pc=%d DMA N of layer %u, the image has %u\n", ctx->pc, layer, layout.levels);
+        }
+        uint32_t count = layer ? layout.upper_degree : layout.degree;
+        if (layer) stat_descent_lists->addData(1);
+        *dma_addr = Phnsw::neighbor_addr(*index, layer);
         // std::cout << "dma_addr=" << *dma_addr << std::endl;
-        *dma_size = 32 * 4;
-        SST::Interfaces::StandardMem::Addr dstspmAddr = 0;
-        dma->DMAget((SST::Interfaces::StandardMem::Addr) *dma_addr,
+        *dma_size = count * sizeof(uint32_t);
+        SST::Interfaces::StandardMem::Addr dstspmAddr = ctx->spm_neighbor;
+        tag = dma->DMAget((SST::Interfaces::StandardMem::Addr) *dma_addr,
                         dstspmAddr,
                         (uint32_t) *dma_size);
-    } else if (option == "A") {
-        *dma_addr = *dma_addr;
-        std::cout << "time=" << getCurrentSimTime() << " inst=DMA"
-        << " size=" << *dma_size << std::endl;
-        if (*dma_addr < 1024 /* TODO */ && *dma_size > 2) {
-            std::cout << "long read" << std::endl;
-            dma->DMAspmrd((SST::Interfaces::StandardMem::Addr) *dma_addr,
+        Phnsw::dma_busy(Reg::NONE, tag);
+        Phnsw::prefetch_start(count);
+    } else if (inst.mode == DMA_P) {
+        // PQ code of DMAindex, staged where DMA R puts a raw vector
+        *dma_addr = Phnsw::pq_addr(*index);
+        *dma_size = layout.pq_m;
+        tag = dma->DMAget((SST::Interfaces::StandardMem::Addr) *dma_addr, ctx->spm_raw, layout.pq_m);
+        Phnsw::dma_busy(Reg::NONE, tag);
+    } else if (inst.mode == DMA_L) {
+        // top layer of DMAindex, a flat image has only layer 0
+        uint32_t *max_level = ctx->Registers.ptr<uint32_t>(Reg::max_level);
+        *max_level = 0;
+        if (layout.levels > 1) {
+            *dma_addr = Phnsw::level_addr(*index);
+            *dma_size = 1;
+            Phnsw::dma_busy(Reg::max_level, dma->DMAread((SST::Interfaces::StandardMem::Addr) *dma_addr, 1, max_level, 1));
+        }
+    } else {
+        // addresses below mem_base are the scratchpad, the image starts at mem_base
+        if (*dma_addr < mem_base && *dma_size > 2) {
+            tag = dma->DMAspmrd((SST::Interfaces::StandardMem::Addr) *dma_addr,
                             (size_t) *dma_size,
                             (void *) rd,
-                            rd_size);
+                            sizeof(*rd));
         } else {
-            std::cout << "normal read" << std::endl;
-            dma->DMAread((SST::Interfaces::StandardMem::Addr) *dma_addr,
+            tag = dma->DMAread((SST::Interfaces::StandardMem::Addr) *dma_addr,
             (size_t) *dma_size,
-            (void *) rd, rd_size);
+            (void *) rd, sizeof(*rd));
         }
+        Phnsw::dma_busy(Reg::dma_res, tag);
         return 0;
-    } else {
-        output.fatal(CALL_INFO, -1, "ERROR: %s is invalid dma_option", option.c_str());
     }
 
     // Read R: mem -> ?
@@ -746,120 +894,1198 @@ int Phnsw::inst_dma(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now)
     return 0;
 }
 
-int Phnsw::inst_vst(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    uint32_t *vst_index;
-    uint8_t *vst_res;
-    size_t addr_size, res_size;
-    try {
-        vst_index = (uint32_t *)Phnsw::Registers.find_match("vst_index", addr_size);
-    }
-    catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "vst_index");
-    }
-    try {
-        vst_res = (uint8_t *)Phnsw::Registers.find_match("vst_res", res_size);
-    }
-    catch (char *e) {
-        output.fatal(CALL_INFO, -1, "ERROR: %s %s", e, "vst_res");
-    }
-    SST::Interfaces::StandardMem::Addr spm_addr = SPM_VISIT_BASE + *vst_index / 8;
-    uint32_t  spm_offset = *vst_index % 8;
+int Phnsw::inst_vst(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    uint32_t vst_index = ctx->Registers.ref<uint32_t>(Reg::vst_index);
+    uint8_t *vst_res = ctx->Registers.ptr<uint8_t>(Reg::vst_res);
     // std::cout << "time=" << getCurrentSimTime()
     // << " inst=VST"
-    // << " addr=" << spm_addr
-    // << " offset=" << spm_offset
+    // << " index=" << vst_index
     // << std::endl;
 
-    if (inst_now[inst_count][1] == "R") {
-        // std::cout << "VST R index=" << *vst_index << std::endl;
-        dma->stopFlag = true;
-        dma->is_vst = true;
-        dma->vst_offset = spm_offset;
-        dma->DMAread(spm_addr, 1, (void *) vst_res, res_size);
-    } else if (inst_now[inst_count][1] == "W") {
-        dma->stopFlag = true;
-        dma->is_vst = true;
-        dma->is_vst_write = true;
-        dma->vst_offset = spm_offset;
-        int wr_size = 1;
-        std::vector<uint8_t> data(wr_size, 0x1 << spm_offset);
-        // std::cout << "VST W data=" << (uint32_t) data[0] << " \tindex=" << *vst_index << " \taddr=" << spm_addr << std::endl;
-        dma->DMAvst(spm_addr, 1, vst_res, res_size);
+    if (inst.mode != VST_W) stat_vst_reads->addData(1);
+    if (inst.mode != VST_R) stat_vst_writes->addData(1);
+
+    if (visit_mode != VisitMode::SPM && visit_mode != VisitMode::EPOCH) {
+        // on-chip unit, vst_res is written back after visitLatency cycles
+        if (visit_mode == VisitMode::BITMAP && vst_index >= ctx->visited.capacity()) {
+            output.fatal(CALL_INFO, -1, "ERROR: pc=%d vst_index %u out of the visited bitmap (visitCapacity)\n", ctx->pc, vst_index);
+        }
+        uint64_t overflows = ctx->visited.overflows;
+        bool old = inst.mode == VST_R ? ctx->visited.test(vst_index) : ctx->visited.test_and_set(vst_index);
+        if (ctx->visited.overflows != overflows) stat_vst_overflows->addData(1);
+        if (inst.mode == VST_W) return 0;
+        if (old) stat_vst_hits->addData(1);
+        *(uint8_t *) rd_temp_ptr = old;
+        *writes_back = true;
+        return 0;
+    }
+
+    if (visit_mode == VisitMode::EPOCH && vst_index >= ve.capacity) {
+        output.fatal(CALL_INFO, -1, "ERROR: pc=%d vst_index %u out of the epoch visited set (visitCapacity)\n", ctx->pc, vst_index);
+    }
+    if (inst.mode == VST_W) {
+        // std::cout << "VST W index=" << vst_index << std::endl;
+        Phnsw::dma_busy(Reg::NONE, Phnsw::visit_dma(vst_index, true, nullptr));
     } else {
-        output.fatal(CALL_INFO, -1, "ERROR: vst mode not found");
+        // std::cout << "VST R index=" << vst_index << std::endl;
+        // VST T sets the bit in the same read-modify-write, vst_res gets the old bit
+        ctx->vst_read_pending = true;
+        ctx->vst_read_tag = Phnsw::visit_dma(vst_index, inst.mode == VST_T, vst_res);
+        Phnsw::dma_busy(Reg::vst_res, ctx->vst_read_tag);
     }
 
     return 0;
 }
 
-int Phnsw::inst_raw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    dma->stopFlag = true;
-    size_t rd_size = 0;
-    std::array<float, 128> *rd;
-    rd = (std::array<float, 128> *) Phnsw::Registers.find_match("raw1", rd_size);
-
-    dma->DMAspmrd(SPM_RAW_BASE, SPM_RAW_SIZE, (void *) rd, rd_size);
+int Phnsw::inst_raw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    // RAW P / RAW PS move the PQ code into pq_code instead of the raw vector into raw1
+    bool code = inst.mode == RAW_P || inst.mode == RAW_PS;
+    Reg::Id rd = code ? Reg::pq_code : Reg::raw1;
+    uint64_t size = code ? layout.pq_m : layout.raw_size;
+    uint64_t spm_addr = ctx->spm_raw;
+    ctx->raw1_node = UINT32_MAX;
+    if (inst.mode == RAW_S || inst.mode == RAW_PS) {
+        // RAW S: raw vector of nei_index, from the prefetch ring if it is there
+        uint32_t node = ctx->Registers.ref<uint32_t>(Reg::nei_index);
+        auto shared = ctx->batch_dist.find(node);
+        if (inst.mode == RAW_S && shared != ctx->batch_dist.end()) {
+            // batched DIST: the distance is already here, nothing to fetch
+            stat_batch_hits->addData(1);
+            ctx->batch_pending = true;
+            ctx->batch_value = shared->second;
+            ctx->batch_dist.erase(shared);
+            for (auto &&slot : ctx->pf.slots) {
+                if (slot.gen == ctx->pf.gen && slot.node == node && slot.state != PrefetchSlot::TEST) slot.state = PrefetchSlot::FREE;
+            }
+            for (uint32_t pos = ctx->pf.head; ctx->pf.active && ctx->pf.list_ready && pos < ctx->pf.next; pos++) {
+                if (ctx->pf.list[pos] == node) {
+                    ctx->pf.head = pos + 1;
+                    break;
+                }
+            }
+            if (ctx->pf.next < ctx->pf.head) ctx->pf.next = ctx->pf.head;
+            return 0;
+        }
+        if (inst.mode == RAW_S && batch_size > 1) ctx->raw1_node = node;
+        PrefetchSlot *hit = nullptr;
+        for (auto &&slot : ctx->pf.slots) {
+            if (ctx->pf.codes == code && slot.state == PrefetchSlot::FETCH && slot.gen == ctx->pf.gen && slot.node == node) {
+                hit = &slot;
+                break;
+            }
+        }
+        if (hit) {
+            stat_pf_hits->addData(1);
+            spm_addr = Phnsw::prefetch_slot_addr(hit - ctx->pf.slots.data());
+            hit->state = PrefetchSlot::FREE;
+            if (ctx->pf.head < hit->pos + 1) ctx->pf.head = hit->pos + 1;
+        } else {
+            stat_pf_misses->addData(1);
+            dma->DMAget(code ? Phnsw::pq_addr(node) : Phnsw::raw_addr(node), ctx->spm_raw, size);
+            // skip the prefetcher past this neighbor
+            for (uint32_t pos = ctx->pf.head; ctx->pf.active && ctx->pf.list_ready && pos < ctx->pf.next; pos++) {
+                if (ctx->pf.list[pos] == node) {
+                    ctx->pf.head = pos + 1;
+                    break;
+                }
+            }
+        }
+        if (ctx->pf.next < ctx->pf.head) ctx->pf.next = ctx->pf.head;
+    }
+    uint64_t tag = dma->DMAspmrd(spm_addr, size, ctx->Registers.slot(rd), ctx->Registers.size(rd));
+    Phnsw::dma_busy(rd, tag);
     return 0;
 }
 
-int Phnsw::inst_nei(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    dma->stopFlag = true;
-    size_t rd_size = 0, i_size = 0;
-    uint32_t *rd = (uint32_t *) Phnsw::Registers.find_match("nei_index", rd_size);
-    uint32_t *i = (uint32_t *) Phnsw::Registers.find_match("i", rd_size);
-    uint32_t addr_of_nei = SPM_NEIGHBOR_ADDR + (*i * 4);
-    // std::cout << "<NEI> nei_index: " << *rd << std::endl;
+int Phnsw::inst_nei(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    uint32_t addr_of_nei = ctx->spm_neighbor + (ctx->Registers.ref<uint32_t>(Reg::i) * 4);
+    // std::cout << "<NEI> nei_index: " << Registers.ref<uint32_t>(Reg::nei_index) << std::endl;
 
-    dma->DMAread(addr_of_nei, 4, (void *) rd, rd_size);
+    uint64_t tag = dma->DMAread(addr_of_nei, 4, ctx->Registers.slot(Reg::nei_index), ctx->Registers.size(Reg::nei_index));
+    Phnsw::dma_busy(Reg::nei_index, tag);
     return 0;
 }
 
-int Phnsw::inst_acw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    size_t wsize=0;
-    std::array<uint32_t, 40> *windex = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_index", wsize);
-    std::array<uint32_t, 40> *wdist = (std::array<uint32_t, 40> *) Phnsw::Registers.find_match("W_dist", wsize);
-    uint32_t *index = (uint32_t *) Phnsw::Registers.find_match("acw_index", wsize);
-    uint32_t *rd_dist = (uint32_t *) Phnsw::Registers.find_match("acw_dist", wsize);
-    uint32_t *rd_index = (uint32_t *) Phnsw::Registers.find_match("acw_index", wsize);
+int Phnsw::inst_acw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    *writes_back = true;
+    // peek-max of W: its max once W is full, UINT32_MAX before, i.e. the bound a new node must beat
+    Phnsw::queue(1).peek_max(*(uint32_t *) rd_temp_ptr, *(uint32_t *) rd2_temp_ptr);
+    return 0;
+}
+
+/**
+ * @description: Shape and memory regions of an image with a header, in place of the params.
+ * @param {string&} image_file the memory_file of the memory controller
+ * @return {*}
+ */
+void Phnsw::init_image_layout(const std::string &image_file) {
+    ImageHeader header;
+    std::string error;
+    if (!read_image_header(image_file, header, error)) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - %s\n", getName().c_str(), error.c_str());
+    }
+    layout.dim = header.dim;
+    layout.degree = header.degree;
+    layout.mem_neighbor = header.neighbor_offset;
+    layout.neighbor_stride = header.neighbor_stride;
+    layout.mem_raw = header.raw_offset;
+    layout.raw_stride = header.raw_stride;
+    layout.levels = header.levels;
+    layout.nodes = header.nodes;
+    layout.upper_degree = header.levels > 1 ? header.upper_degree : 1;
+    layout.mem_upper = header.upper_offset;
+    layout.upper_stride = header.upper_stride;
+    layout.upper_layer_stride = header.upper_layer_stride;
+    layout.mem_level = header.level_offset;
+    layout.image_size = header.image_size;
+    layout.entry_point = header.entry_point;
+    layout.queries = header.queries;
+    layout.shard = header.shard;
+    layout.elem = (ImageElem) header.elem_type;
+    if (layout.elem == ImageElem::U8) {
+        std::vector<float> scale, offset;
+        if (!read_image_quant(image_file, header, scale, offset, error)) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - %s\n", getName().c_str(), error.c_str());
+        }
+        layout.dist_weight.resize(header.dim);
+        for (uint32_t d = 0; d < header.dim; d++) layout.dist_weight[d] = scale[d] * scale[d];
+    }
+    layout.pq_m = header.pq_m;
+    layout.mem_pq = header.pq_offset;
+    layout.pq_stride = header.pq_stride;
+    layout.mem_pq_codebook = header.pq_codebook_offset;
+    if (layout.pq_m && !read_image_codebook(image_file, header, layout.pq_codebook, error)) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - %s\n", getName().c_str(), error.c_str());
+    }
+    output.verbose(CALL_INFO, 1, 0, "Image %s: %" PRIu64 " nodes, %" PRIu64 " queries, %u levels, entry point %u\n",
+        image_file.c_str(), header.nodes, header.queries, header.levels, header.entry_point);
+}
+
+/**
+ * @description: Shape and memory regions from the params, for images without a header
+ *               (layer 0 lists at the start of memory, packed regions).
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::init_param_layout(SST::Params& params) {
+    layout.dim = params.find<uint32_t>("dim", 128);
+    layout.degree = params.find<uint32_t>("M", 32);
+    bool elem_ok;
+    std::string vec_format = params.find<std::string>("vecFormat", "f32");
+    layout.elem = parse_image_elem(vec_format, elem_ok);
+    if (!elem_ok) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'vecFormat' - %s\n", getName().c_str(), vec_format.c_str());
+    if (layout.elem == ImageElem::U8) layout.dist_weight.assign(layout.dim, 1.0f);
+    layout.mem_neighbor = 0;
+    layout.neighbor_stride = (uint64_t) layout.degree * sizeof(uint32_t);
+    layout.mem_raw = params.find<uint64_t>("memRawBase", IMAGE_LEGACY_RAW_BASE);
+    layout.raw_stride = (uint64_t) layout.dim * image_elem_size(layout.elem);
+    layout.entry_point = UINT32_MAX;
+    layout.queries = 0;
+    layout.shard = 0;
+    layout.pq_m = 0; // PQ codes need the codebook of an image header
+    layout.image_size = 0;
+    if (layout.mem_raw < layout.neighbor_stride) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'memRawBase' - overlaps the neighbor lists\n", getName().c_str());
+    }
+
+    // HNSW layers above 0, node indexed regions one after the other by default
+    layout.levels = params.find<uint32_t>("levels", 1);
+    layout.nodes = params.find<uint32_t>("nodes", 10000);
+    layout.upper_degree = params.find<uint32_t>("upperM", 16);
+    layout.mem_upper = params.find<uint64_t>("memUpperBase", 0);
+    layout.mem_level = params.find<uint64_t>("memLevelBase", 0);
+    if (layout.levels < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'levels' - must be at least 1\n", getName().c_str());
+    if (layout.levels > 1) {
+        if (layout.upper_degree < 1 || layout.upper_degree > layout.degree) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'upperM' - must be in [1, M]\n", getName().c_str());
+        }
+        if (!layout.mem_upper) layout.mem_upper = layout.mem_raw + (uint64_t) layout.nodes * layout.raw_stride;
+        if (!layout.mem_level) {
+            layout.mem_level = layout.mem_upper + (uint64_t) (layout.levels - 1) * layout.nodes * layout.upper_degree * sizeof(uint32_t);
+        }
+    }
+    layout.upper_stride = (uint64_t) layout.upper_degree * sizeof(uint32_t);
+    layout.upper_layer_stride = (uint64_t) layout.nodes * layout.upper_stride;
+}
+
+/**
+ * @description: Index shape params (dim, M, ef, C capacity): size the raw, C and W registers,
+ *               lay out the scratchpad (neighbor list, raw vector, visited bitmap) and
+ *               define the named asm immediates. The shape and memory regions come from
+ *               the header of imageFile if given, else from the params.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::init_layout(SST::Params& params) {
+    layout.ef = params.find<uint32_t>("ef", 40);
+    layout.c_capacity = params.find<uint32_t>("queueCCapacity", 360);
+    std::string image_file = params.find<std::string>("imageFile", "");
+    if (!image_file.empty()) {
+        Phnsw::init_image_layout(image_file);
+    } else {
+        Phnsw::init_param_layout(params);
+    }
+    if (layout.dim < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'dim' - must be at least 1\n", getName().c_str());
+    if (layout.degree < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'M' - must be at least 1\n", getName().c_str());
+    if (layout.ef < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'ef' - must be at least 1\n", getName().c_str());
+    if (layout.c_capacity < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'queueCCapacity' - must be at least 1\n", getName().c_str());
+    layout.raw_size = (uint64_t) layout.dim * image_elem_size(layout.elem);
+    layout.neighbor_size = (uint64_t) layout.degree * sizeof(uint32_t);
+
+    // scratchpad: neighbor list and raw vector of every context, then the visited bitmap (720 as before for dim 128, M 32)
+    layout.spm_neighbor = SPM_NEIGHBOR_ADDR;
+    layout.spm_raw = layout.spm_neighbor + layout.neighbor_size;
+    layout.spm_visit = std::max<uint64_t>(SPM_VISIT_BASE, SPM_NEIGHBOR_ADDR + context_count * (layout.neighbor_size + layout.raw_size));
+    if (layout.spm_visit >= scratchSize) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'scratchSize' - no room for the visited bitmap after dim %u and M %u\n",
+            getName().c_str(), layout.dim, layout.degree);
+    }
+
+    ctx->Registers.resize({{Reg::raw1, (uint32_t) layout.raw_size}, {Reg::raw2, (uint32_t) layout.raw_size}, {Reg::raw_res, (uint32_t) layout.raw_size},
+        {Reg::pq_code, std::max<uint32_t>(layout.pq_m, 1)},
+        {Reg::C_dist, layout.c_capacity}, {Reg::C_index, layout.c_capacity},
+        {Reg::W_dist, layout.ef}, {Reg::W_index, layout.ef}});
+    asm_symbols = {{"DIM", layout.dim}, {"M", layout.degree}, {"EF", layout.ef}, {"C_CAP", layout.c_capacity},
+        {"M_UP", layout.upper_degree}, {"PQ_M", layout.pq_m}};
+    output.verbose(CALL_INFO, 1, 0, "Index shape: dim %u (%s, %" PRIu64 " B), M %u, ef %u, C capacity %u, visited bitmap at %" PRIu64 "\n",
+        layout.dim, image_elem_name(layout.elem), layout.raw_size, layout.degree, layout.ef, layout.c_capacity, layout.spm_visit);
+}
+
+/**
+ * @description: Prefetcher params, the ring must fit in the scratchpad above the visited bitmap.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::prefetch_init(SST::Params& params) {
+    ctx->pf.depth = params.find<uint32_t>("prefetchDepth", 0);
+    ctx->pf.base = params.find<uint64_t>("prefetchBase", 2048);
+    ctx->pf.active = false;
+    ctx->pf.list_ready = false;
+    ctx->pf.gen = 0;
+    ctx->pf.head = ctx->pf.next = 0;
+    ctx->pf.list.assign(layout.degree, 0);
+    ctx->pf.count = 0;
+    ctx->pf.codes = false;
+    visit_end = scratchSize;
+    if (ctx->pf.depth) {
+        // one ring per context, back to back
+        if (ctx->pf.base < layout.spm_visit || ctx->pf.base + (uint64_t) context_count * ctx->pf.depth * layout.raw_size > scratchSize) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid params 'prefetchBase'/'prefetchDepth' - the ring of every context must fit in [%" PRIu64 ", scratchSize)\n",
+                getName().c_str(), layout.spm_visit);
+        }
+        visit_end = ctx->pf.base;
+    }
+    ctx->pf.slots.assign(ctx->pf.depth, {PrefetchSlot::FREE, 0, 0, 0, 0, 0});
+}
+
+/**
+ * @description: Visited set params, the unit latency is the write back delay of vst_res.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::visit_init(SST::Params& params) {
+    bool mode_ok;
+    std::string mode = params.find<std::string>("visitMode", "bitmap");
+    visit_mode = parse_visit_mode(mode, mode_ok);
+    if (!mode_ok) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitMode' - %s, must be spm, bitmap, hash, bloom or epoch\n", getName().c_str(), mode.c_str());
+    }
+    uint64_t capacity = params.find<uint64_t>("visitCapacity", 1048576);
+    uint32_t hashes = params.find<uint32_t>("visitHashes", 3);
+    visit_latency = params.find<uint32_t>("visitLatency", 1);
+    if (visit_latency < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitLatency' - must be at least 1\n", getName().c_str());
+    if (visit_mode != VisitMode::SPM && capacity < 1) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitCapacity' - must be at least 1\n", getName().c_str());
+    }
+    if (visit_mode == VisitMode::EPOCH) {
+        std::string placement = params.find<std::string>("visitPlacement", "dram");
+        // in dram the array goes after the image by default, past every region of the graph
+        uint64_t image_end = (layout.image_size + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+        ve.base = params.find<uint64_t>("visitBase", placement == "dram" && image_end ? image_end : 0x800000);
+        ve.capacity = capacity;
+        ve.tag_bytes = params.find<uint32_t>("visitTagBytes", 2);
+        if (ve.tag_bytes != 1 && ve.tag_bytes != 2) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitTagBytes' - must be 1 or 2\n", getName().c_str());
+        }
+        if (ve.base % ve.tag_bytes) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitBase' - must be aligned to 'visitTagBytes'\n", getName().c_str());
+        }
+        if (placement == "spm") {
+            // shares the scratchpad with the bitmap area, below the prefetch ring
+            if (ve.base < layout.spm_visit || ve.base + ve.capacity * ve.tag_bytes > visit_end) {
+                output.fatal(CALL_INFO, -1, "Error (%s): invalid params 'visitBase'/'visitCapacity' - the tag array must fit in [%" PRIu64 ", %" PRIu64 ")\n",
+                    getName().c_str(), layout.spm_visit, visit_end);
+            }
+        } else if (placement == "dram") {
+            // VST writes would corrupt the graph, and epoch 1 needs the array to start cleared
+            if (ve.base < layout.image_size) {
+                output.fatal(CALL_INFO, -1, "Error (%s): invalid params 'visitBase'/'visitCapacity' - the tag array [%" PRIu64 ", %" PRIu64 ") overlaps the image [0, %" PRIu64 ")\n",
+                    getName().c_str(), ve.base, ve.base + ve.capacity * ve.tag_bytes, layout.image_size);
+            }
+            ve.base += mem_base;
+        } else {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitPlacement' - %s, must be spm or dram\n", getName().c_str(), placement.c_str());
+        }
+        // the array starts cleared, like the scratchpad bitmap
+        ve.epoch = 1;
+        ve.epoch_max = (1u << (8 * ve.tag_bytes)) - 1;
+    } else if (visit_mode != VisitMode::SPM) {
+        ctx->visited.init(visit_mode, capacity, hashes);
+    }
+    output.verbose(CALL_INFO, 1, 0, "Visited set: %s, capacity %" PRIu64 ", latency %u\n", mode.c_str(), capacity, visit_latency);
+}
+
+/**
+ * @description: Queue a visited test (and set if write) of node in scratchpad or memory,
+ *               the SPM bitmap or the EPOCH tag array.
+ * @param {uint32_t} node id
+ * @param {bool} write set node visited
+ * @param {uint8_t} *res gets 1 if node was visited, nullptr to drop it
+ * @return {uint64_t} DMA tag
+ */
+uint64_t Phnsw::visit_dma(uint32_t node, bool write, uint8_t *res) {
+    if (visit_mode == VisitMode::EPOCH) {
+        return dma->DMAepoch(ve.base + (uint64_t) node * ve.tag_bytes, ve.tag_bytes, ve.epoch, write, res, res ? 1 : 0);
+    }
+    return dma->DMAvst(layout.spm_visit + node / 8, node % 8, write, res, res ? 1 : 0);
+}
+
+/**
+ * @description: A new neighbor list is on its way to the scratchpad (DMA N),
+ *               read it once it lands and restart the ring on it.
+ * @return {*}
+ */
+void Phnsw::prefetch_start(uint32_t count) {
+    if (!ctx->pf.depth) return;
+    ctx->pf.gen++;
+    ctx->pf.active = true;
+    ctx->pf.list_ready = false;
+    ctx->pf.head = ctx->pf.next = 0;
+    ctx->pf.count = count;
+    ctx->batch_dist.clear(); // broadcasts are for the neighbors of the last list only
+    // queued after DMA N, the DMA orders the read after the neighbor list write
+    ctx->pf.list_tag = dma->DMAread(ctx->spm_neighbor, count * sizeof(uint32_t), ctx->pf.list.data(), count * sizeof(uint32_t));
+}
+
+/**
+ * @description: Keep positions [head, head + depth) of the neighbor list in flight:
+ *               test the visited bit of a neighbor, fetch its raw vector if not visited.
+ * @return {*}
+ */
+void Phnsw::prefetch_tick() {
+    if (!ctx->pf.depth || !ctx->pf.active) return;
+    if (!ctx->pf.list_ready) {
+        if (!Phnsw::dma_done(ctx->pf.list_tag)) return;
+        ctx->pf.list_ready = true;
+    }
+    for (size_t s = 0; s < ctx->pf.slots.size(); s++) {
+        PrefetchSlot &slot = ctx->pf.slots[s];
+        if (slot.state != PrefetchSlot::TEST || !Phnsw::dma_done(slot.tag)) continue;
+        if (slot.gen != ctx->pf.gen || slot.pos < ctx->pf.head) {
+            slot.state = PrefetchSlot::FREE;
+        } else if (slot.visited || (!ctx->pf.codes && ctx->batch_dist.count(slot.node))) {
+            // visited, or its distance was broadcast by another query of the batch
+            stat_pf_skipped->addData(1);
+            slot.state = PrefetchSlot::FREE;
+        } else {
+            stat_pf_issued->addData(1);
+            if (ctx->pf.codes) {
+                slot.tag = dma->DMAget(Phnsw::pq_addr(slot.node), Phnsw::prefetch_slot_addr(s), layout.pq_m);
+            } else {
+                slot.tag = dma->DMAget(Phnsw::raw_addr(slot.node), Phnsw::prefetch_slot_addr(s), layout.raw_size);
+            }
+            slot.state = PrefetchSlot::FETCH;
+        }
+    }
+    const uint32_t count = ctx->pf.count;
+    while (ctx->pf.next < count && ctx->pf.next < ctx->pf.head + ctx->pf.depth) {
+        PrefetchSlot &slot = ctx->pf.slots[ctx->pf.next % ctx->pf.depth];
+        // the visited test of the old position still writes into this slot
+        if (slot.state == PrefetchSlot::TEST && !Phnsw::dma_done(slot.tag)) break;
+        uint32_t node = ctx->pf.list[ctx->pf.next];
+        slot = {PrefetchSlot::TEST, ctx->pf.gen, ctx->pf.next, node, 0, 0};
+        if (visit_mode == VisitMode::EPOCH && node >= ve.capacity) {
+            slot.visited = 1; // not fetched, VST of it is fatal anyway
+        } else if (visit_mode == VisitMode::SPM || visit_mode == VisitMode::EPOCH) {
+            slot.tag = Phnsw::visit_dma(node, false, &slot.visited);
+        } else {
+            slot.visited = ctx->visited.test(node); // tag 0 is always done
+        }
+        ctx->pf.next++;
+    }
+}
+
+/**
+ * @description: ADC table params of a PQ image, the table must fit in the scratchpad above the
+ *               visited bitmap and must not overlap the prefetch ring. The bitmap ends below it.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::pq_init(SST::Params& params) {
+    ctx->pq.state = PqTable::NONE;
+    ctx->pq.codebook_tag = ctx->pq.ready_at = ctx->pq.tag = 0;
+    ctx->pq.base = 0;
+    if (!layout.pq_m) return;
+    if (layout.elem == ImageElem::U8) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - PQ needs f32 or f16 raw vectors for the query table\n", getName().c_str());
+    }
+    // one table per context, back to back
+    uint64_t table = (uint64_t) layout.pq_m * IMAGE_PQ_KSUB * sizeof(float);
+    uint64_t size = context_count * table;
+    ctx->pq.base = params.find<uint64_t>("pqTableBase", 0);
+    if (!ctx->pq.base && scratchSize >= size) ctx->pq.base = scratchSize - size;
+    uint64_t ring_end = ctx->pf.base + (uint64_t) context_count * ctx->pf.depth * layout.raw_size;
+    bool ring_overlap = ctx->pf.depth && ctx->pq.base < ring_end && ctx->pf.base < ctx->pq.base + size;
+    if (ctx->pq.base < layout.spm_visit || ctx->pq.base + size > scratchSize || ring_overlap) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'pqTableBase' - the %" PRIu64 " B table must fit in [%" PRIu64 ", scratchSize) next to the prefetch ring\n",
+            getName().c_str(), size, layout.spm_visit);
+    }
+    visit_end = std::min(visit_end, ctx->pq.base);
+    ctx->pq.table.assign(table / sizeof(float), 0);
+    output.verbose(CALL_INFO, 1, 0, "PQ: %u subspaces of %u dims, ADC table of %" PRIu64 " B at %" PRIu64 "\n",
+        layout.pq_m, layout.dim / layout.pq_m, table, ctx->pq.base);
+}
+
+/**
+ * @description: DIST T, compute the ADC table of the query in raw2 and start streaming the codebook,
+ *               pq_tick builds and writes the table once the codebook is in.
+ * @return {*}
+ */
+void Phnsw::pq_build() {
+    stat_pq_builds->addData(1);
+    const uint8_t *raw = ctx->Registers.ptr<uint8_t>(Reg::raw2);
+    std::vector<float> query(layout.dim);
+    if (layout.elem == ImageElem::F16) {
+        for (uint32_t d = 0; d < layout.dim; d++) query[d] = half_to_float(((const uint16_t *) raw)[d]);
+    } else {
+        std::memcpy(query.data(), raw, layout.dim * sizeof(float));
+    }
+    const uint32_t dsub = layout.dim / layout.pq_m;
+    for (uint32_t m = 0; m < layout.pq_m; m++) {
+        const float *q = query.data() + m * dsub;
+        for (uint32_t c = 0; c < IMAGE_PQ_KSUB; c++) {
+            const float *centroid = layout.pq_codebook.data() + ((size_t) m * IMAGE_PQ_KSUB + c) * dsub;
+            float sum = 0;
+            for (uint32_t j = 0; j < dsub; j++) {
+                float t = q[j] - centroid[j];
+                sum += t * t;
+            }
+            ctx->pq.table[m * IMAGE_PQ_KSUB + c] = sum;
+        }
+    }
+    ctx->pq.codebook_tag = dma->DMAread(mem_base + layout.mem_pq_codebook, layout.pq_codebook.size() * sizeof(float), nullptr, 0);
+    ctx->pq.state = PqTable::LOAD;
+}
+
+/**
+ * @description: Move the ADC table on: once the codebook is in, every DIST unit builds the table
+ *               for pq_build cycles, then it is written to the scratchpad.
+ * @return {*}
+ */
+void Phnsw::pq_tick() {
+    if (ctx->pq.state == PqTable::LOAD && Phnsw::dma_done(ctx->pq.codebook_tag)) {
+        ctx->pq.state = PqTable::BUILD;
+        ctx->pq.ready_at = timestamp + dist_model.pq_build;
+        for (auto &&free_at : dist_unit_free) free_at = std::max(free_at, ctx->pq.ready_at);
+    } else if (ctx->pq.state == PqTable::BUILD && timestamp >= ctx->pq.ready_at) {
+        std::vector<uint8_t> data(ctx->pq.table.size() * sizeof(float));
+        std::memcpy(data.data(), ctx->pq.table.data(), data.size());
+        ctx->pq.tag = dma->DMAwrite(ctx->pq.base, data.size(), &data);
+        ctx->pq.state = PqTable::WRITE;
+    }
+}
+
+/**
+ * @description: Whether a DIST PQ may issue: the table of this query is in the scratchpad.
+ * @return {bool} true without a table too, DIST PQ stops the simulation then
+ */
+bool Phnsw::pq_table_ready() const {
+    switch (ctx->pq.state) {
+    case PqTable::LOAD:
+    case PqTable::BUILD:
+        return false;
+    case PqTable::WRITE:
+        return dma->completed_tag >= ctx->pq.tag;
+    default:
+        return true;
+    }
+}
+
+/**
+ * @description: Re-rank params, and the scratchpad slots the raw vectors of W are fetched into.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::rerank_init(SST::Params& params) {
+    ctx->rr.state = Reranker::IDLE;
+    ctx->rr.r = params.find<uint32_t>("rerankR", 0);
+    ctx->rr.k = params.find<uint32_t>("rerankK", 10);
+    ctx->rr.depth = params.find<uint32_t>("rerankDepth", 4);
+    ctx->rr.base = 0;
+    ctx->rr.fetched = ctx->rr.computed = ctx->rr.inserted = 0;
+    if (!ctx->rr.r) return;
+    if (ctx->rr.r > layout.ef) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'rerankR' - must be at most ef (%u)\n", getName().c_str(), layout.ef);
+    if (ctx->rr.k < 1 || ctx->rr.k > layout.ef) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'rerankK' - must be in [1, ef (%u)]\n", getName().c_str(), layout.ef);
+    if (ctx->rr.depth < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'rerankDepth' - must be at least 1\n", getName().c_str());
+    // the re-rank DISTs the raw vectors of the image, only f32 ones give back the exact distances
+    if (layout.elem != ImageElem::F32) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'rerankR' - the re-rank needs f32 raw vectors, the image has %s\n",
+            getName().c_str(), image_elem_name(layout.elem));
+    }
+    // the slots of every context, back to back
+    uint64_t size = (uint64_t) context_count * ctx->rr.depth * layout.raw_size;
+    uint64_t top = layout.pq_m ? ctx->pq.base : scratchSize;
+    ctx->rr.base = params.find<uint64_t>("rerankBase", 0);
+    if (!ctx->rr.base && top >= size) ctx->rr.base = top - size;
+    uint64_t ring_end = ctx->pf.base + (uint64_t) context_count * ctx->pf.depth * layout.raw_size;
+    bool ring_overlap = ctx->pf.depth && ctx->rr.base < ring_end && ctx->pf.base < ctx->rr.base + size;
+    bool table_overlap = layout.pq_m && ctx->rr.base < ctx->pq.base + context_count * ctx->pq.table.size() * sizeof(float) && ctx->pq.base < ctx->rr.base + size;
+    if (ctx->rr.base < layout.spm_visit || ctx->rr.base + size > scratchSize || ring_overlap || table_overlap) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid params 'rerankBase'/'rerankDepth' - the slots must fit in [%" PRIu64 ", scratchSize) next to the prefetch ring and the ADC table\n",
+            getName().c_str(), layout.spm_visit);
+    }
+    visit_end = std::min(visit_end, ctx->rr.base);
+    ctx->rr.slots.assign(ctx->rr.depth, {0, std::vector<uint8_t>(layout.raw_size)});
+    output.verbose(CALL_INFO, 1, 0, "Re-rank: top %u of W to %u, %u slots at %" PRIu64 "\n", ctx->rr.r, ctx->rr.k, ctx->rr.depth, ctx->rr.base);
+}
 
-    *rd_dist = (*wdist)[*index];
-    *rd_index = (*windex)[*index];
+/**
+ * @description: END of the program: close the traversal of the query and take the first R
+ *               entries of W as re-rank candidates, W is emptied for the exact distances.
+ * @return {*}
+ */
+void Phnsw::rerank_start() {
+    QueryRecord &record = query_records[ctx->record_now];
+    record.traversal_cycles = getCurrentSimTime(clockTC) - record.start_cycle;
+    stat_traversal_cycles->addData(record.traversal_cycles);
+    uint32_t *W_index = ctx->Registers.ptr<uint32_t>(Reg::W_index);
+    uint32_t *W_dist = ctx->Registers.ptr<uint32_t>(Reg::W_dist);
+    uint32_t &W_size = ctx->Registers.ref<uint32_t>(Reg::W_size);
+    uint32_t n = std::min(ctx->rr.r, W_size);
+    if (!n) {
+        ctx->rr.state = Reranker::DONE;
+        return;
+    }
+    ctx->rr.cand.assign(W_index, W_index + n);
+    ctx->rr.dist.assign(n, 0);
+    ctx->rr.ready_at.assign(n, 0);
+    ctx->rr.fetched = ctx->rr.computed = ctx->rr.inserted = 0;
+    std::fill(W_index, W_index + ctx->Registers.count(Reg::W_index), 0);
+    std::fill(W_dist, W_dist + ctx->Registers.count(Reg::W_dist), 0);
+    W_size = 0;
+    ctx->rr.state = Reranker::RUN;
+}
+
+/**
+ * @description: Move the re-rank on: fetch candidates into free slots, DIST the oldest fetched
+ *               ones on the free DIST units, and insert finished distances into W in order.
+ * @return {*}
+ */
+void Phnsw::rerank_tick() {
+    if (ctx->rr.state != Reranker::RUN) return;
+    stat_rerank_cycles->addData(1);
+    query_records[ctx->record_now].rerank_cycles++;
+    const uint32_t n = ctx->rr.cand.size();
+    // a slot is free again once its vector went into a DIST unit
+    while (ctx->rr.fetched < n && ctx->rr.fetched < ctx->rr.computed + ctx->rr.depth) {
+        RerankSlot &slot = ctx->rr.slots[ctx->rr.fetched % ctx->rr.depth];
+        uint64_t spm_addr = Phnsw::rerank_slot_addr(ctx->rr.fetched % ctx->rr.depth);
+        dma->DMAget(Phnsw::raw_addr(ctx->rr.cand[ctx->rr.fetched]), spm_addr, layout.raw_size);
+        slot.tag = dma->DMAspmrd(spm_addr, layout.raw_size, slot.raw.data(), slot.raw.size());
+        ctx->rr.fetched++;
+    }
+    const uint8_t *query = ctx->Registers.ptr<uint8_t>(Reg::raw2);
+    for (auto &&free_at : dist_unit_free) {
+        if (ctx->rr.computed >= ctx->rr.fetched) break;
+        RerankSlot &slot = ctx->rr.slots[ctx->rr.computed % ctx->rr.depth];
+        if (!Phnsw::dma_done(slot.tag)) break;
+        if (free_at > timestamp) continue;
+        free_at = timestamp + dist_model.occupancy;
+        stat_rerank_evals->addData(1);
+        ctx->rr.dist[ctx->rr.computed] = (uint32_t) Phnsw::raw_dist(slot.raw.data(), query);
+        ctx->rr.ready_at[ctx->rr.computed] = timestamp + dist_model.latency;
+        ctx->rr.computed++;
+    }
+    // W keeps the k nearest, one insert per queue occupancy
+    QueueUnit &w = queues[1];
+    if (ctx->rr.inserted < ctx->rr.computed && ctx->rr.ready_at[ctx->rr.inserted] <= timestamp && w.free_at <= timestamp) {
+        PriorityQueue(ctx->Registers.ptr<uint32_t>(w.dist), ctx->Registers.ptr<uint32_t>(w.index), ctx->Registers.ptr<uint32_t>(w.size), ctx->rr.k)
+            .insert(ctx->rr.dist[ctx->rr.inserted], ctx->rr.cand[ctx->rr.inserted]);
+        w.free_at = timestamp + std::max(w.timing.insert.occupancy, w.timing.insert.latency);
+        ctx->rr.inserted++;
+    }
+    if (ctx->rr.inserted == n && w.free_at <= timestamp) ctx->rr.state = Reranker::DONE;
+}
+
+/**
+ * @description: WAIT tag, clockTick holds the bundle until the DMA op with this tag is done.
+ */
+int Phnsw::inst_wait(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
     return 0;
 }
 
-int Phnsw::inst_info(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
-    size_t rd_size;
-    uint64_t tmp_value;
-    void *rd_ptr = Phnsw::Registers.find_match(inst_now[inst_count][1], rd_size);
-    std::cout << "pc=" << Phnsw::pc << " ";
+/**
+ * @description: FENCE, clockTick holds the bundle until every DMA op is done.
+ */
+int Phnsw::inst_fence(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    return 0;
+}
+
+/**
+ * @description: Mark reg busy until the DMA op tag is done, and publish tag in dma_tag.
+ * @param {Reg::Id} reg written by the DMA op, Reg::NONE if the op only touches memory
+ * @param {uint64_t} tag returned by the DMA
+ * @return {*}
+ */
+void Phnsw::dma_busy(Reg::Id reg, uint64_t tag) {
+    if (reg != Reg::NONE) ctx->reg_dma_tag[reg] = tag;
+    ctx->Registers.ref<uint32_t>(Reg::dma_tag) = (uint32_t) tag;
+}
+
+/**
+ * @description: Whether inst may issue now as far as DMA ordering goes:
+ *               WAIT needs its tag done, FENCE and END need every DMA op of the active
+ *               context done; ops retire in order, so its last one is enough.
+ * @param {DecodedInst&} inst decoded instruction
+ * @return {bool} true if inst can issue
+ */
+bool Phnsw::dma_wait(const DecodedInst &inst) {
+    switch (inst.op) {
+    case OP_WAIT:
+        // dma_tag holds the low 32 bits of a tag
+        return (int32_t) ((uint32_t) dma->completed_tag - Phnsw::operand_u32(inst.src[0])) >= 0;
+    case OP_FENCE:
+    case OP_END:
+        return Phnsw::dma_done(Phnsw::dma_last());
+    default:
+        return true;
+    }
+}
+
+int Phnsw::inst_info(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
+    const Operand &rd = inst.src[0];
+    uint64_t tmp_value = 0;
+    std::cout << "pc=" << ctx->pc << " ";
     std::cout << "inst: " << "INFO" << "; ";
-    std::cout << "RegName: " << inst_now[inst_count][1];
-    if (rd_size == sizeof(uint8_t)) {
-        tmp_value = (uint64_t) *((uint8_t *) rd_ptr);
-    } else if (rd_size == sizeof(uint32_t)) {
-        tmp_value = (uint64_t) *((uint32_t *) rd_ptr);
-    } else if (rd_size == sizeof(uint64_t)) {
-        tmp_value = (uint64_t) *((uint64_t*) rd_ptr);
-    } else if (rd_size == sizeof(std::array<uint8_t, 128>)) {
-        tmp_value = (uint64_t) (*(std::array<uint8_t, 128> *) rd_ptr)[0];
-    } else if (rd_size == sizeof(std::array<uint32_t, 10>)) {
-        tmp_value = (uint64_t) (*(std::array<uint32_t, 10> *) rd_ptr)[0];
+    std::cout << "RegName: " << (*inst.text)[1];
+    if (rd.is_imm) {
+        tmp_value = rd.imm;
+    } else {
+        // print the first element of arrays
+        const void *rd_ptr = ctx->Registers.slot(rd.reg);
+        switch (Reg::desc[rd.reg].type) {
+            case Reg::U8:  tmp_value = (uint64_t) *((const uint8_t *) rd_ptr); break;
+            case Reg::U32: tmp_value = (uint64_t) *((const uint32_t *) rd_ptr); break;
+            case Reg::U64: tmp_value = (uint64_t) *((const uint64_t *) rd_ptr); break;
+            case Reg::F32: tmp_value = (uint64_t) *((const float *) rd_ptr); break;
+        }
     }
     std::cout<< ", Value " << /* std::hex << */ tmp_value << std::dec << "(" << std::bitset<sizeof(uint64_t) * 8>(tmp_value) << ")";
-    std::cout << ", Size " << rd_size
+    std::cout << ", Size " << rd.size
     << std::endl;
     return 0;
 }
 
-int Phnsw::inst_dummy(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now) {
+int Phnsw::inst_dummy(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back) {
     return 0;
 }
 
+/**
+ * @description: Build the query set from params,
+ *               queryFile lines are '<query index> [entry point]', otherwise queryIndex/queryStride are used.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::load_queries(SST::Params& params) {
+    std::string query_file = params.find<std::string>("queryFile", "");
+    uint32_t queries = params.find<uint32_t>("queries", 0);
+    std::string ep_policy = params.find<std::string>("epPolicy", "fixed");
+    uint32_t entry_point = params.find<uint32_t>("entryPoint", layout.entry_point != UINT32_MAX ? layout.entry_point : 9806);
+    uint32_t ep_stride = params.find<uint32_t>("epStride", 100);
+    std::vector<uint32_t> entry_points;
+    params.find_array<uint32_t>("entryPoints", entry_points);
+    query_log = params.find<std::string>("queryLog", "");
+    cores = params.find<uint32_t>("cores", 1);
+    core_id = params.find<uint32_t>("coreId", 0);
+    if (cores < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'cores' - must be at least 1\n", getName().c_str());
+    if (core_id >= cores) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'coreId' - must be below cores (%u)\n", getName().c_str(), cores);
+    if (cores > 1 && getNumRanks().rank > 1) {
+        output.output("WARNING (%s): %u cores on %u ranks, the aggregate QPS needs every core on one rank\n",
+            getName().c_str(), cores, getNumRanks().rank);
+    }
+
+    const uint32_t no_ep = UINT32_MAX;
+    query_set.clear();
+    if (!query_file.empty()) {
+        std::ifstream file(query_file);
+        if (!file) {
+            output.fatal(CALL_INFO, -1, "ERROR: can not open queryFile %s\n", query_file.c_str());
+        }
+        std::string line;
+        while (std::getline(file, line) && (queries == 0 || query_set.size() < queries)) {
+            std::stringstream ss(line);
+            QueryJob job = {0, no_ep};
+            if (!(ss >> job.query)) continue; // empty or comment line
+            if (!(ss >> job.ep)) job.ep = no_ep;
+            query_set.push_back(job);
+        }
+    } else {
+        uint32_t query_index = params.find<uint32_t>("queryIndex", 1);
+        uint32_t query_stride = params.find<uint32_t>("queryStride", 1);
+        for (uint32_t n = 0; n < std::max<uint32_t>(queries, 1); n++) {
+            query_set.push_back({query_index + n * query_stride, no_ep});
+        }
+    }
+    if (query_set.empty()) {
+        output.fatal(CALL_INFO, -1, "ERROR: no query to run\n");
+    }
+
+    for (size_t n = 0; n < query_set.size(); n++) {
+        if (query_set[n].ep != no_ep) continue;
+        if (ep_policy == "fixed") {
+            query_set[n].ep = entry_point;
+        } else if (ep_policy == "list") {
+            if (entry_points.empty()) {
+                output.fatal(CALL_INFO, -1, "ERROR: epPolicy 'list' needs entryPoints\n");
+            }
+            query_set[n].ep = entry_points[n % entry_points.size()];
+        } else if (ep_policy == "stride") {
+            query_set[n].ep = entry_point + n * ep_stride;
+        } else {
+            output.fatal(CALL_INFO, -1, "ERROR: unknown epPolicy %s\n", ep_policy.c_str());
+        }
+    }
+    // this core's share: every cores-th query from coreId, eps stay those of the whole set
+    if (cores > 1) {
+        std::vector<QueryJob> share;
+        for (size_t n = core_id; n < query_set.size(); n += cores) share.push_back(query_set[n]);
+        if (share.empty()) {
+            output.fatal(CALL_INFO, -1, "ERROR: core %u of %u has no query, run at least %u queries\n", core_id, cores, cores);
+        }
+        query_set.swap(share);
+    }
+    output.verbose(CALL_INFO, 1, 0, "%zu queries loaded\n", query_set.size());
+}
+
+/**
+ * @description: Give the next job of query_set to the active context: load query_index/ep_index
+ *               and open its record, the start time is taken when its first bundle issues.
+ * @return {*}
+ */
+void Phnsw::start_query() {
+    ctx->job_now = Phnsw::pick_job();
+    const QueryJob &job = query_set[ctx->job_now];
+    ctx->Registers.ref<uint32_t>(Reg::query_index) = job.query;
+    ctx->Registers.ref<uint32_t>(Reg::ep_index) = job.ep;
+    query_records.push_back({job.query, job.ep, 0, 0, 0, 0, 0, 0, 0, 0});
+    ctx->record_now = query_records.size() - 1;
+    ctx->started_at = timestamp;
+    ctx->query_started = false;
+    ctx->query_idle = false;
+}
+
+/**
+ * @description: Close the record of the active context's query and reset its C/W/visited state,
+ *               it takes the next job if there is one, else it goes idle.
+ * @return {bool} false if every query of every context is done
+ */
+bool Phnsw::next_query() {
+    QueryRecord &record = query_records[ctx->record_now];
+    record.end_cycle = getCurrentSimTime(clockTC);
+    record.end_ns = getCurrentSimTimeNano();
+    record.top_index = ctx->Registers.ptr<uint32_t>(Reg::W_index)[0];
+    record.top_dist = ctx->Registers.ptr<uint32_t>(Reg::W_dist)[0];
+    if (host) {
+        ShardResultEvent *result = new ShardResultEvent(host_seq[ctx->job_now], layout.shard, record.end_ns - record.start_ns,
+            record.start_ns - host_arrive_ns[ctx->job_now]);
+        uint32_t W_size = ctx->Registers.ref<uint32_t>(Reg::W_size);
+        result->index.assign(ctx->Registers.ptr<uint32_t>(Reg::W_index), ctx->Registers.ptr<uint32_t>(Reg::W_index) + W_size);
+        result->dist.assign(ctx->Registers.ptr<uint32_t>(Reg::W_dist), ctx->Registers.ptr<uint32_t>(Reg::W_dist) + W_size);
+        host->send(result);
+    }
+
+    ctx->query_idle = true;
+    if (query_now >= query_set.size() && !host) {
+        // W of the last query stays in the registers, the run ends with the last busy context
+        for (uint32_t c = 0; c < context_count; c++) {
+            if (c != ctx_now && !contexts[c].query_idle) return true;
+        }
+        return false;
+    }
+
+    // drop results still in flight, clear every register
+    ctx->in_flight = InFlightQueue();
+    ctx->reg_pending.fill(0);
+    ctx->Registers.reset();
+    ctx->batch_dist.clear();
+    ctx->raw1_node = UINT32_MAX;
+    ctx->batch_pending = false;
+    // in shard mode clockTick starts the next one once handle_host queued it
+    if (query_now < query_set.size()) Phnsw::start_query();
+    // clear the visited bitmap in scratchpad, the next query starts once it is done
+    if (visit_mode == VisitMode::EPOCH) {
+        // a new epoch makes every tag stale, the array is only cleared when the epoch wraps
+        if (++ve.epoch > ve.epoch_max) {
+            ve.epoch = 1;
+            stat_vst_clears->addData(1);
+            dma->stopFlag = true;
+            dma->DMAfill(ve.base, ve.capacity * ve.tag_bytes, 0);
+        }
+    } else if (visit_mode != VisitMode::SPM) {
+        ctx->visited.clear();
+    } else if (visit_end > layout.spm_visit) {
+        dma->stopFlag = true;
+        dma->DMAfill(layout.spm_visit, visit_end - layout.spm_visit, 0);
+    }
+    // the next query starts with a new neighbor list, and builds its own ADC table
+    ctx->pf.active = false;
+    ctx->pf.gen++;
+    ctx->pq.state = PqTable::NONE;
+    ctx->rr.state = Reranker::IDLE;
+    return true;
+}
+
+/**
+ * @description: Shard mode: queue a query from phnswMerge, an idle context starts it on the next clockTick.
+ * @param {Event*} ev ShardQueryEvent
+ * @return {*}
+ */
+void Phnsw::handle_host(SST::Event *ev) {
+    ShardQueryEvent *query = dynamic_cast<ShardQueryEvent *>(ev);
+    if (!query) output.fatal(CALL_INFO, -1, "ERROR: unexpected event on host_link\n");
+    if (query->query >= layout.queries) {
+        output.fatal(CALL_INFO, -1, "ERROR: query %u, the image of shard %u has %" PRIu64 "\n", query->query, layout.shard, layout.queries);
+    }
+    query_set.push_back({(uint32_t) (layout.nodes + query->query), host_ep});
+    host_seq.push_back(query->seq);
+    host_arrive_ns.push_back(getCurrentSimTimeNano());
+    job_taken.push_back(0);
+    delete ev;
+    Phnsw::resume();
+}
+
+/**
+ * @description: Query context params: copy the state built so far into every context,
+ *               each with its own staging area, prefetch ring, ADC table and re-rank slots in the
+ *               scratchpad. Context 0 is the active one.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::context_init(SST::Params& params) {
+    std::string policy = params.find<std::string>("contextPolicy", "round-robin");
+    if (policy == "round-robin") {
+        ctx_policy = ContextPolicy::ROUND_ROBIN;
+    } else if (policy == "oldest") {
+        ctx_policy = ContextPolicy::OLDEST;
+    } else {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'contextPolicy' - %s, must be round-robin or oldest\n", getName().c_str(), policy.c_str());
+    }
+    if (context_count > 1 && (visit_mode == VisitMode::SPM || visit_mode == VisitMode::EPOCH)) {
+        // the scratchpad bitmap and the tag array are one per core, and are cleared with the DMA stopped
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'visitMode' - several contexts need an on-chip visited set (bitmap, hash or bloom)\n", getName().c_str());
+    }
+    batch_size = params.find<uint32_t>("batchSize", 1);
+    batch_window = params.find<uint32_t>("batchWindow", 8);
+    if (batch_size < 1 || batch_size > context_count) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'batchSize' - must be in [1, contexts (%u)]\n", getName().c_str(), context_count);
+    }
+    if (batch_window < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'batchWindow' - must be at least 1\n", getName().c_str());
+    if (batch_size > 1 && !ctx->pf.depth) {
+        // the neighbor lists of the other queries are the prefetcher's copies
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'batchSize' - batched DIST needs the prefetcher (prefetchDepth > 0)\n", getName().c_str());
+    }
+    ctx->batch_dist.clear();
+    ctx->raw1_node = UINT32_MAX;
+    ctx->batch_pending = false;
+    ctx->batch_value = 0;
+    job_taken.assign(query_set.size(), 0);
+
+    const uint64_t stage = layout.neighbor_size + layout.raw_size;
+    ctx->dma_last_tag = Phnsw::dma_last();
+    dma_mark = dma->issued_tag;
+    Context first = contexts[0];
+    contexts.resize(context_count, first); // the only resize, pointers into contexts[] stay valid after it
+    for (uint32_t c = 0; c < context_count; c++) {
+        Context &context = contexts[c];
+        context.pf.base += (uint64_t) c * context.pf.depth * layout.raw_size;
+        context.pq.base += (uint64_t) c * context.pq.table.size() * sizeof(float);
+        context.rr.base += (uint64_t) c * context.rr.depth * layout.raw_size;
+        context.spm_neighbor = SPM_NEIGHBOR_ADDR + c * stage;
+        context.spm_raw = context.spm_neighbor + layout.neighbor_size;
+    }
+    ctx = &contexts[0];
+    ctx_order.assign(context_count, 0);
+    ctx_issue_cycles.assign(context_count, 0);
+    ctx_switches = 0;
+    stat_ctx_switches = registerStatistic<uint64_t>("context_switches");
+    stat_batch_broadcasts = registerStatistic<uint64_t>("batch_broadcasts");
+    stat_batch_hits = registerStatistic<uint64_t>("batch_hits");
+    for (uint32_t c = 0; c < context_count; c++) {
+        stat_ctx_issue.push_back(registerStatistic<uint64_t>("context_issue_cycles", std::to_string(c)));
+    }
+    output.verbose(CALL_INFO, 1, 0, "Query contexts: %u, %s, %" PRIu64 " B of staging each\n", context_count, policy.c_str(), stage);
+    if (batch_size > 1) {
+        output.verbose(CALL_INFO, 1, 0, "Batched DIST: %u queries per batch, jobs picked from a window of %u\n", batch_size, batch_window);
+    }
+}
+
+/**
+ * @description: Batched DIST: the raw vector of node is in the DIST unit, compute its distance to
+ *               the query of every other busy context of the batch whose current neighbor list
+ *               still has node ahead of its RAW S, and leave it for that RAW S.
+ * @param {uint8_t*} raw raw vector of node
+ * @param {uint32_t} node
+ * @return {*}
+ */
+void Phnsw::batch_broadcast(const uint8_t *raw, uint32_t node) {
+    uint32_t first = ctx_now / batch_size * batch_size;
+    uint32_t last = std::min(first + batch_size, context_count);
+    for (uint32_t c = first; c < last; c++) {
+        if (c == ctx_now) continue;
+        Context &peer = contexts[c];
+        if (peer.query_idle || !peer.pf.active || !peer.pf.list_ready || peer.pf.codes || peer.batch_dist.count(node)) continue;
+        for (uint32_t pos = peer.pf.head; pos < peer.pf.count; pos++) {
+            if (peer.pf.list[pos] != node) continue;
+            peer.batch_dist[node] = (uint32_t) Phnsw::raw_dist(raw, peer.Registers.ptr<uint8_t>(Reg::raw2));
+            stat_batch_broadcasts->addData(1);
+            break;
+        }
+    }
+}
+
+/**
+ * @description: Scheduler of the active (idle) context: take the first pending job, or with
+ *               batched DIST the one of the next batchWindow pending jobs whose entry point most
+ *               busy queries of the batch start from or have in their current neighbor list.
+ * @return {size_t} index of the job in query_set, marked taken
+ */
+size_t Phnsw::pick_job() {
+    size_t best = query_now;
+    uint32_t best_score = 0;
+    if (batch_size > 1) {
+        uint32_t first = ctx_now / batch_size * batch_size;
+        uint32_t last = std::min(first + batch_size, context_count);
+        uint32_t seen = 0;
+        for (size_t j = query_now; j < query_set.size() && seen < batch_window; j++) {
+            if (job_taken[j]) continue;
+            seen++;
+            uint32_t ep = query_set[j].ep, score = 0;
+            for (uint32_t c = first; c < last; c++) {
+                const Context &peer = contexts[c];
+                if (c == ctx_now || peer.query_idle) continue;
+                const uint32_t *list = peer.pf.list.data();
+                bool in_list = peer.pf.list_ready && std::find(list, list + peer.pf.count, ep) != list + peer.pf.count;
+                score += query_set[peer.job_now].ep == ep || in_list;
+            }
+            if (score > best_score) {
+                best = j;
+                best_score = score;
+            }
+        }
+    }
+    job_taken[best] = 1;
+    while (query_now < query_set.size() && job_taken[query_now]) query_now++;
+    return best;
+}
+
+/**
+ * @description: Set the issue to write back latency of every opcode and derive the DIST unit timing:
+ *               a DIST streams ceil(dim / lanes) beats, one every II cycles, through the
+ *               subtract/multiply stage and the adder tree into the accumulator, so
+ *               latency = (beats - 1) * II + mul latency + tree depth + 1 (accumulate).
+ *               A unit is busy for beats * II cycles, every DIST in flight keeps its own
+ *               result in the in-flight queue of its context.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::init_units(SST::Params& params) {
+    dist_model.lanes = params.find<uint32_t>("distLanes", 16);
+    dist_model.mul_latency = params.find<uint32_t>("distMulLatency", 3);
+    dist_model.tree_depth = params.find<uint32_t>("distTreeDepth", 0);
+    dist_model.ii = params.find<uint32_t>("distII", 1);
+    dist_model.count = params.find<uint32_t>("distUnits", 1);
+    if (dist_model.lanes < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'distLanes' - must be at least 1\n", getName().c_str());
+    if (dist_model.ii < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'distII' - must be at least 1\n", getName().c_str());
+    if (dist_model.count < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'distUnits' - must be at least 1\n", getName().c_str());
+    if (dist_model.tree_depth == 0) {
+        while ((1u << dist_model.tree_depth) < dist_model.lanes) dist_model.tree_depth++;
+    }
+    uint32_t dim = layout.dim;
+    dist_model.beats = (dim + dist_model.lanes - 1) / dist_model.lanes;
+    dist_model.latency = (dist_model.beats - 1) * dist_model.ii + dist_model.mul_latency + dist_model.tree_depth + 1;
+    dist_model.occupancy = dist_model.beats * dist_model.ii;
+    // DIST PQ: pq_m lookups, lanes per beat, then the same adder tree
+    dist_model.lookup_latency = params.find<uint32_t>("pqLookupLatency", 2);
+    dist_model.pq_beats = (std::max<uint32_t>(layout.pq_m, 1) + dist_model.lanes - 1) / dist_model.lanes;
+    dist_model.pq_latency = (dist_model.pq_beats - 1) * dist_model.ii + dist_model.lookup_latency + dist_model.tree_depth + 1;
+    dist_model.pq_occupancy = dist_model.pq_beats * dist_model.ii;
+    // DIST T: a DIST of every centroid row (IMAGE_PQ_KSUB x dim), spread over all units
+    uint64_t build_beats = ((uint64_t) IMAGE_PQ_KSUB * dist_model.beats + dist_model.count - 1) / dist_model.count;
+    dist_model.pq_build = (uint32_t) (build_beats * dist_model.ii) + dist_model.mul_latency + dist_model.tree_depth + 1;
+    output.verbose(CALL_INFO, 1, 0, "DIST unit: %u x %u lanes, latency %u, occupancy %u\n",
+        dist_model.count, dist_model.lanes, dist_model.latency, dist_model.occupancy);
+    if (layout.pq_m) {
+        output.verbose(CALL_INFO, 1, 0, "DIST PQ: %u subspaces, latency %u, occupancy %u, DIST T %u cycles\n",
+            layout.pq_m, dist_model.pq_latency, dist_model.pq_occupancy, dist_model.pq_build);
+    }
+
+    Phnsw::init_queues(params);
+    for (size_t op = 0; op < OP_NUM; op++) {
+        sst_assert(inst_struct[op].op == op, CALL_INFO, -1, "inst_struct must be in Opcode order\n");
+        const InstStruct &i = inst_struct[op];
+        for (Reg::Id r : {i.rd, i.rd2}) {
+            if (r != Reg::NONE && ctx->Registers.size(r) > sizeof(InFlight::rd_temp)) {
+                output.fatal(CALL_INFO, -1, "ERROR: %s writes back %zu bytes, an op in flight holds %zu\n",
+                    i.asmop.c_str(), ctx->Registers.size(r), sizeof(InFlight::rd_temp));
+            }
+        }
+    }
+    unit_latency.fill(1);
+    unit_latency[OP_DIST] = dist_model.latency; // DIST PQ and DIST T: issue_dist
+    unit_latency[OP_VST] = visit_latency;
+    unit_latency[OP_RMC] = queues[0].timing.pop_min.latency;
+    unit_latency[OP_RMW] = queues[1].timing.pop_max.latency;
+    unit_latency[OP_ACW] = queues[1].timing.peek_max.latency;
+    ctx->in_flight = InFlightQueue();
+    issue_seq = 0;
+    dist_unit_free.assign(dist_model.count, 0);
+    ctx->reg_pending.fill(0);
+}
+
+/**
+ * @description: Priority queue units of C and W, capacity from params up to the register size.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void Phnsw::init_queues(SST::Params& params) {
+    bool kind_ok;
+    std::string kind = params.find<std::string>("queueKind", "shift");
+    queue_kind = parse_queue_kind(kind, kind_ok);
+    if (!kind_ok) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'queueKind' - %s, must be shift, systolic or heap\n", getName().c_str(), kind.c_str());
+    }
+    // the registers are sized to the capacities by init_layout
+    queues[0] = {Reg::C_dist, Reg::C_index, Reg::C_size, layout.c_capacity};
+    queues[1] = {Reg::W_dist, Reg::W_index, Reg::W_size, layout.ef};
+    const char *names[2] = {"C", "W"};
+    for (int q = 0; q < 2; q++) {
+        QueueUnit &queue = queues[q];
+        queue.timing = queue_timing(queue_kind, queue.capacity);
+        queue.free_at = 0;
+        const QueueTiming &t = queue.timing;
+        output.verbose(CALL_INFO, 1, 0, "Queue %s: %s, %u entries, insert %u/%u, pop min %u/%u, pop max %u/%u, peek max %u/%u (latency/occupancy), "
+            "%u register cells, %u SRAM cells, %u comparators\n",
+            names[q], kind.c_str(), queue.capacity, t.insert.latency, t.insert.occupancy, t.pop_min.latency, t.pop_min.occupancy,
+            t.pop_max.latency, t.pop_max.occupancy, t.peek_max.latency, t.peek_max.occupancy, t.reg_cells, t.sram_cells, t.comparators);
+    }
+}
+
+/**
+ * @description: Functional view of queue q over its registers.
+ * @param {int} q 0 for C, 1 for W
+ * @return {PriorityQueue}
+ */
+PriorityQueue Phnsw::queue(int q) {
+    QueueUnit &queue = queues[q];
+    return PriorityQueue(ctx->Registers.ptr<uint32_t>(queue.dist), ctx->Registers.ptr<uint32_t>(queue.index),
+        ctx->Registers.ptr<uint32_t>(queue.size), queue.capacity);
+}
+
+/**
+ * @description: Priority queue an instruction works on.
+ * @param {DecodedInst&} inst
+ * @return {int} 0 for C, 1 for W, -1 if none
+ */
+int Phnsw::queue_of(const DecodedInst &inst) {
+    switch (inst.op) {
+    case OP_PUSH: return inst.mode == LIST_C ? 0 : 1;
+    case OP_RMC: return 0;
+    case OP_RMW: case OP_ACW: return 1;
+    default: return -1;
+    }
+}
+
+const QueueTiming::Op *Phnsw::queue_op(const DecodedInst &inst) const {
+    int q = Phnsw::queue_of(inst);
+    if (q < 0) return nullptr;
+    const QueueTiming &t = queues[q].timing;
+    switch (inst.op) {
+    case OP_PUSH: return &t.insert;
+    case OP_RMC: return &t.pop_min;
+    case OP_RMW: return &t.pop_max;
+    default: return &t.peek_max;
+    }
+}
+
+/**
+ * @description: Take a free DIST unit for a DIST issued this cycle,
+ *               clockTick has checked that a unit is free.
+ * @param {DecodedInst&} inst DIST, DIST PQ or DIST T
+ * @return {uint32_t} cycles to the write back of its result
+ */
+uint32_t Phnsw::issue_dist(const DecodedInst &inst) {
+    uint32_t occupancy = dist_model.occupancy;
+    uint32_t latency = dist_model.latency;
+    if (inst.mode == DIST_PQ) {
+        occupancy = dist_model.pq_occupancy;
+        latency = dist_model.pq_latency;
+    } else if (inst.mode == DIST_T) {
+        occupancy = 1; // the units are taken once the codebook is in
+    }
+    for (auto &&free_at : dist_unit_free) {
+        if (free_at <= timestamp) {
+            free_at = timestamp + occupancy;
+            break;
+        }
+    }
+    return latency;
+}
+
+/**
+ * @description: Registers an instruction reads or writes, a bundle is held while any of them
+ *               still has a write back in flight.
+ * @param {DecodedInst&} inst decoded instruction
+ * @param {vector<Reg::Id>&} out registers are appended here
+ * @return {*}
+ */
+void Phnsw::inst_deps(const DecodedInst &inst, std::vector<Reg::Id> &out) {
+    for (auto &&operand : inst.src) {
+        if (!operand.is_imm && operand.reg != Reg::NONE) out.push_back(operand.reg);
+    }
+    bool is_c = inst.mode == LIST_C;
+    switch (inst.op) {
+    case OP_JMP:  out.push_back(Reg::cmp_res); break;
+    case OP_DIST:
+        if (inst.mode == DIST_PQ) out.push_back(Reg::pq_code);
+        else if (inst.mode == DIST_T) out.push_back(Reg::raw2);
+        else out.insert(out.end(), {Reg::raw1, Reg::raw2});
+        break;
+    case OP_LOOK: out.insert(out.end(), {Reg::list, Reg::list_index}); break;
+    case OP_PUSH:
+        if (is_c) out.insert(out.end(), {Reg::C_dist, Reg::C_index, Reg::C_size});
+        else out.insert(out.end(), {Reg::W_dist, Reg::W_index, Reg::W_size});
+        break;
+    case OP_RMC:  out.insert(out.end(), {Reg::C_dist, Reg::C_index, Reg::C_size, Reg::rmc_dist, Reg::rmc_index}); break;
+    case OP_RMW:  out.insert(out.end(), {Reg::W_dist, Reg::W_index, Reg::W_size, Reg::rmw_dist, Reg::rmw_index}); break;
+    case OP_DMA:  out.insert(out.end(), {Reg::DMAindex, Reg::dma_addr, Reg::dma_offset, Reg::dma_res, Reg::layer, Reg::max_level}); break;
+    case OP_VST:  out.insert(out.end(), {Reg::vst_index, Reg::vst_res}); break;
+    case OP_RAW:
+        out.push_back(inst.mode == RAW_P || inst.mode == RAW_PS ? Reg::pq_code : Reg::raw1);
+        if (inst.mode == RAW_S || inst.mode == RAW_PS) out.push_back(Reg::nei_index);
+        break;
+    case OP_NEI:  out.insert(out.end(), {Reg::i, Reg::nei_index}); break;
+    case OP_ACW:  out.insert(out.end(), {Reg::W_dist, Reg::W_index, Reg::W_size, Reg::acw_dist, Reg::acw_index}); break;
+    default: break;
+    }
+}
+
 void Phnsw::load_inst_creat_img() {
-    Phnsw::pc = 0; // reset pc
+    ctx->pc = 0; // reset pc
     std::ifstream img_file;
-    img_file.open("instructions/instructions.asm");
-    assert(img_file);
+    img_file.open(program);
+    if (!img_file) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'program' - can not open %s\n", getName().c_str(), program.c_str());
+    }
     std::string inst_line;
     std::vector<std::vector<std::string>> inst_single_cycle;
     while (std::getline(img_file, inst_line)) {
@@ -895,6 +2121,200 @@ void Phnsw::load_inst_creat_img() {
     }
     Phnsw::display_img();
     img_file.close();
+    Phnsw::decode_img();
+}
+
+/**
+ * @description: Parse one operand word, [imm] or register name.
+ * @param {string&} word operand in asm
+ * @param {size_t} line index of the bundle in img, for error messages
+ * @return {Operand}
+ */
+Phnsw::Operand Phnsw::decode_operand(const std::string &word, size_t line) {
+    Operand operand = {false, 0, Reg::NONE, 0};
+    if (word.size() >= 2 && word.back() == ']' && word[0] == '[') { // is imm
+        operand.is_imm = true;
+        operand.size = sizeof(operand.imm);
+        std::string imm = word.substr(1, word.size() - 2);
+        auto symbol = asm_symbols.find(imm);
+        if (symbol != asm_symbols.end()) { // named imm from params, e.g. [M]
+            operand.imm = symbol->second;
+        } else {
+            try {
+                operand.imm = std::stoull(imm);
+            } catch (std::exception &e) {
+                output.fatal(CALL_INFO, -1, "ERROR: pc=%zu invalid imm %s\n", line, word.c_str());
+            }
+        }
+    } else {
+        operand.reg = Register::find(word);
+        if (operand.reg == Reg::NONE) {
+            output.fatal(CALL_INFO, -1, "ERROR: pc=%zu Register not found: %s\n", line, word.c_str());
+        }
+        operand.size = ctx->Registers.size(operand.reg);
+    }
+    return operand;
+}
+
+/**
+ * @description: Parse the mode word of CMP / LOOK / PUSH / DMA / VST.
+ * @param {string&} word mode in asm
+ * @param {size_t} line index of the bundle in img, for error messages
+ * @return {InstMode}
+ */
+Phnsw::InstMode Phnsw::decode_mode(const std::string &word, size_t line) {
+    static const std::unordered_map<std::string, InstMode> modes = {
+        {"EQ", CMP_EQ}, {"NE", CMP_NE}, {"GT", CMP_GT}, {"LT", CMP_LT}, {"GE", CMP_GE}, {"LE", CMP_LE},
+        {"MAX", LOOK_MAX}, {"MIN", LOOK_MIN},
+        {"C", LIST_C}, {"W", LIST_W}
+    };
+    auto found = modes.find(word);
+    if (found == modes.end()) {
+        output.fatal(CALL_INFO, -1, "ERROR: pc=%zu unknown mode %s\n", line, word.c_str());
+    }
+    return found->second;
+}
+
+/**
+ * @description: Lower the string img into the decoded image (code + bundle_begin),
+ *               every name, imm and mode is resolved here once.
+ * @return {*}
+ */
+void Phnsw::decode_img() {
+    code.clear();
+    bundle_begin.clear();
+    deps.clear();
+    deps_begin.clear();
+    bundle_dists.clear();
+    for (size_t line = 0; line < img.size(); line++) {
+        bundle_begin.push_back(code.size());
+        deps_begin.push_back(deps.size());
+        bundle_dists.push_back(0);
+        for (auto &&words : img[line]) {
+            if (words.empty()) continue;
+            DecodedInst inst = {OP_DUMMY, MODE_NONE, nullptr, {}, 0, &words};
+            for (auto &&i : inst_struct) {
+                if (words[0] == i.asmop) {
+                    inst.unit = &i;
+                    inst.op = i.op;
+                    break;
+                }
+            }
+            if (inst.unit == nullptr) {
+                output.fatal(CALL_INFO, -1, "ERROR: pc=%zu unknown instruction %s\n", line, words[0].c_str());
+            }
+            auto need = [&](size_t n) {
+                if (words.size() < n + 1) {
+                    output.fatal(CALL_INFO, -1, "ERROR: pc=%zu %s needs %zu operands\n", line, words[0].c_str(), n);
+                }
+            };
+            switch (inst.op) {
+            case OP_JMP:
+                need(1);
+                if (!(words[1].back() == ']' && words[1][0] == '[')) {
+                    output.fatal(CALL_INFO, -1, "ERROR: %s", "jmp imm must be in [imm] format");
+                }
+                inst.target = decode_operand(words[1], line).imm;
+                break;
+            case OP_MOV:
+                need(2);
+                inst.src[0] = decode_operand(words[1], line);
+                inst.src[1] = decode_operand(words[2], line);
+                if (inst.src[1].is_imm) {
+                    output.fatal(CALL_INFO, -1, "ERROR: pc=%zu MOV destination can not be imm\n", line);
+                }
+                break;
+            case OP_ADD:
+            case OP_SUB:
+                need(2);
+                inst.src[0] = decode_operand(words[1], line);
+                inst.src[1] = decode_operand(words[2], line);
+                break;
+            case OP_CMP:
+                need(3);
+                inst.mode = decode_mode(words[1], line);
+                if (inst.mode < CMP_EQ || inst.mode > CMP_LE) {
+                    output.fatal(CALL_INFO, -1, "ERROR: pc=%zu invalid cmp mode %s\n", line, words[1].c_str());
+                }
+                inst.src[0] = decode_operand(words[2], line);
+                inst.src[1] = decode_operand(words[3], line);
+                break;
+            case OP_LOOK:
+                need(1);
+                inst.mode = decode_mode(words[1], line);
+                if (inst.mode != LOOK_MAX && inst.mode != LOOK_MIN) {
+                    output.fatal(CALL_INFO, -1, "ERROR: look mode not found");
+                }
+                break;
+            case OP_PUSH:
+                need(3);
+                inst.src[0] = decode_operand(words[1], line);
+                inst.src[1] = decode_operand(words[2], line);
+                inst.mode = decode_mode(words[3], line);
+                if (inst.mode != LIST_C && inst.mode != LIST_W) {
+                    output.fatal(CALL_INFO, -1, "ERROR: pc=%zu push list must be C or W\n", line);
+                }
+                break;
+            case OP_RMC:
+            case OP_RMW:
+            case OP_ACW:
+                // queue operations, the list is implied: RMC pops C, RMW and ACW work on W
+                if (words.size() > 1) {
+                    output.fatal(CALL_INFO, -1, "ERROR: pc=%zu %s takes no operands\n", line, words[0].c_str());
+                }
+                break;
+            case OP_DMA:
+                need(1);
+                if (words[1] == "R") inst.mode = DMA_R;
+                else if (words[1] == "N") inst.mode = DMA_N;
+                else if (words[1] == "A") inst.mode = DMA_A;
+                else if (words[1] == "L") inst.mode = DMA_L;
+                else if (words[1] == "P") inst.mode = DMA_P;
+                else output.fatal(CALL_INFO, -1, "ERROR: %s is invalid dma_option", words[1].c_str());
+                break;
+            case OP_VST:
+                need(1);
+                if (words[1] == "R") inst.mode = VST_R;
+                else if (words[1] == "W") inst.mode = VST_W;
+                else if (words[1] == "T") inst.mode = VST_T;
+                else output.fatal(CALL_INFO, -1, "ERROR: vst mode not found");
+                break;
+            case OP_RAW:
+                if (words.size() > 1) {
+                    if (words[1] == "S") inst.mode = RAW_S;
+                    else if (words[1] == "P") inst.mode = RAW_P;
+                    else if (words[1] == "PS") inst.mode = RAW_PS;
+                    else output.fatal(CALL_INFO, -1, "ERROR: pc=%zu raw mode %s not found\n", line, words[1].c_str());
+                }
+                // the prefetch ring streams what RAW S / RAW PS consume
+                if (inst.mode == RAW_PS) ctx->pf.codes = true;
+                break;
+            case OP_DIST:
+                if (words.size() > 1) {
+                    if (words[1] == "PQ") inst.mode = DIST_PQ;
+                    else if (words[1] == "T") inst.mode = DIST_T;
+                    else output.fatal(CALL_INFO, -1, "ERROR: pc=%zu dist mode %s not found\n", line, words[1].c_str());
+                }
+                break;
+            case OP_WAIT:
+            case OP_INFO:
+                need(1);
+                inst.src[0] = decode_operand(words[1], line);
+                break;
+            default:
+                break;
+            }
+            bool pq_inst = inst.mode == DIST_PQ || inst.mode == DIST_T || inst.mode == DMA_P || inst.mode == RAW_P || inst.mode == RAW_PS;
+            if (pq_inst && !layout.pq_m) {
+                output.fatal(CALL_INFO, -1, "ERROR: pc=%zu %s %s needs an image with PQ codes\n", line, words[0].c_str(), words[1].c_str());
+            }
+            Phnsw::inst_deps(inst, deps);
+            if (inst.op == OP_DIST) bundle_dists.back()++;
+            code.push_back(inst);
+        }
+    }
+    bundle_begin.push_back(code.size());
+    deps_begin.push_back(deps.size());
 }
 
 void Phnsw::display_img() {
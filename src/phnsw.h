@@ -57,6 +57,10 @@
 #include <sst/core/rng/marsaglia.h>
 
 #include <unordered_map>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <queue>
 // #include <variant>
 // #include <algorithm>
 
@@ -64,6 +68,11 @@
 #include "phnswDMA.h"
 
 #include "Register/Register.h"
+#include "distance.h"
+#include "visited.h"
+#include "pqueue.h"
+#include "image.h"
+#include "shardEvent.h"
 
 namespace SST {
 namespace phnsw {
@@ -101,7 +110,59 @@ public:
     { "clock",                   "(string) Clock frequency in Hz or period in s", "1GHz"},
     { "maxOutstandingRequests",  "(uint) Maximum number of requests outstanding at a time", "8"},
     { "maxRequestsPerCycle",     "(uint) Maximum number of requests to issue per cycle", "2"},
-    { "reqsToIssue",             "(uint) Number of requests to issue before ending simulation", "1000"}
+    { "reqsToIssue",             "(uint) Number of requests to issue before ending simulation", "1000"},
+    { "queryFile",               "(string) Batch mode: text file with one query per line, '<query index> [entry point]'", ""},
+    { "queries",                 "(uint) Batch mode: number of queries to run, 0 means every line of queryFile", "0"},
+    { "queryIndex",              "(uint) Index of the first query when no queryFile is given", "1"},
+    { "queryStride",             "(uint) Index step between queries when no queryFile is given, 0 repeats one query", "1"},
+    { "epPolicy",                "(string) Entry point of queries without one in queryFile: fixed, list or stride", "fixed"},
+    { "entryPoint",              "(uint) Entry point for 'fixed', first entry point for 'stride'; the image entry point with imageFile", "9806"},
+    { "entryPoints",             "(list) Entry points for 'list', used round robin", "[]"},
+    { "epStride",                "(uint) Entry point step between queries for 'stride'", "100"},
+    { "queryLog",                "(string) CSV file for per query start/end records, empty to disable", ""},
+    { "cores",                   "(uint) Cores of the accelerator, the query set is split between them", "1"},
+    { "coreId",                  "(uint) Core of this component, it runs queries coreId, coreId + cores, ...", "0"},
+    { "contexts",                "(uint) Query contexts of the core, each runs its own query; issue switches to another one when the active context stalls", "1"},
+    { "batchSize",               "(uint) Batched DIST: contexts per batch, a raw vector fetched by one is DISTed against the queries of all, 1 disables it", "1"},
+    { "batchWindow",             "(uint) Batched DIST: pending queries an idle context picks from, the one sharing most entry points/neighbor lists of its batch wins", "8"},
+    { "contextPolicy",           "(string) Context the core switches to: round-robin (next after the stalled one) or oldest (earliest started query first)", "round-robin"},
+    { "distKernel",              "(string) Host kernel of DIST: auto, scalar, avx2 or avx512, all give identical results", "auto"},
+    { "distLanes",               "(uint) DIST unit: elements subtracted/squared per beat", "16"},
+    { "distMulLatency",          "(uint) DIST unit: cycles of the subtract and multiply stage", "3"},
+    { "distTreeDepth",           "(uint) DIST unit: adder tree levels, 0 means log2(distLanes)", "0"},
+    { "distII",                  "(uint) DIST unit: initiation interval between beats", "1"},
+    { "distUnits",               "(uint) Number of DIST units", "1"},
+    { "prefetchDepth",           "(uint) Raw vectors of the current neighbor list prefetched ahead of RAW S, 0 disables the prefetcher", "0"},
+    { "prefetchBase",            "(uint) Scratchpad address of the prefetch ring, prefetchDepth slots of one raw vector each", "2048"},
+    { "visitMode",               "(string) Visited set of VST: spm (bitmap in scratchpad through the DMA), bitmap, hash or bloom (on-chip), epoch (tag array through the DMA)", "bitmap"},
+    { "visitCapacity",           "(uint) Visited set: node ids of bitmap, hash and epoch, bits of bloom", "1048576"},
+    { "visitPlacement",          "(string) Epoch visited set: tag array in spm or dram", "dram"},
+    { "visitBase",               "(uint) Epoch visited set: address of the tag array, in scratchpad (spm) or from the start of memory (dram); dram defaults to the end of the image with imageFile, else 0x800000", "0x800000"},
+    { "visitTagBytes",           "(uint) Epoch visited set: bytes per tag, 1 or 2, the array is cleared once every 2^(8*visitTagBytes)-1 queries", "2"},
+    { "visitHashes",             "(uint) Hash functions of the bloom visited set", "3"},
+    { "visitLatency",            "(uint) Cycles of an on-chip VST", "1"},
+    { "queueKind",               "(string) Priority queue unit of C and W: shift, systolic or heap", "shift"},
+    { "queueCCapacity",          "(uint) Entries of the candidate queue C, sizes C_dist/C_index, [C_CAP] in asm", "360"},
+    { "dim",                     "(uint) Vector dimension, sizes raw1/raw2/raw_res, [DIM] in asm", "128"},
+    { "M",                       "(uint) Neighbors per list (degree), [M] in asm", "32"},
+    { "ef",                      "(uint) Entries of the result queue W, sizes W_dist/W_index, [EF] in asm", "40"},
+    { "memRawBase",              "(uint) Raw vectors in memory, from the start of memory (neighbor lists start at 0)", "0x138800"},
+    { "imageFile",               "(string) Memory image with a header (datasetx/build_image.py); its shape and regions replace dim, M, vecFormat, memRawBase, levels, nodes, upperM, memUpperBase, memLevelBase and the default entryPoint", ""},
+    { "vecFormat",               "(string) Raw vectors of a header-less image: f32, f16 or u8 (unit scale); DIST computes on this format", "f32"},
+    { "levels",                  "(uint) HNSW layers in the image, 1 is a flat graph (DMA L gives 0 without a memory access)", "1"},
+    { "nodes",                   "(uint) Nodes in the image, stride of the upper layer regions", "10000"},
+    { "upperM",                  "(uint) Neighbors per list in layers above 0, at most M, [M_UP] in asm", "16"},
+    { "memUpperBase",            "(uint) Neighbor lists of layer 1, layer l at memUpperBase + (l - 1) * nodes * upperM * 4, from the start of memory; 0 places them after the raw vectors", "0"},
+    { "memLevelBase",            "(uint) Top layer of every node, one byte each, from the start of memory; 0 places it after the upper layers", "0"},
+    { "pqTableBase",             "(uint) Scratchpad address of the ADC table of DIST PQ (pq_m * 256 float32), 0 places it at the end of the scratchpad", "0"},
+    { "pqLookupLatency",         "(uint) DIST PQ: cycles of a table lookup in the scratchpad banks", "2"},
+    { "rerankR",                 "(uint) Re-rank: candidates of W whose raw vectors are DISTed again after END, at most ef, 0 disables it; needs an f32 image", "0"},
+    { "rerankK",                 "(uint) Re-rank: results kept in W after the re-rank, at most ef", "10"},
+    { "rerankDepth",             "(uint) Re-rank: raw vectors in flight, one scratchpad slot each", "4"},
+    { "rerankBase",              "(uint) Re-rank: scratchpad address of the slots, 0 places them at the end of the scratchpad (below the ADC table)", "0"},
+    { "program",                 "(string) Search program (asm), e.g. instructions/pq.asm for a PQ image", "instructions/instructions.asm"},
+    { "dmaBlocking",             "(bool) Stall the core after every DMA instruction until the DMA is idle (the old model)", "false"},
+    { "suspendClock",            "(bool) Turn the core clock off while it only waits for the DMA, skipped cycles are credited on wake up; timing is unchanged", "true"}
     )
 
 
@@ -109,13 +170,66 @@ public:
      *  Format: { "portname", "description", { "eventtype0", "eventtype1" } }
      */
     SST_ELI_DOCUMENT_PORTS(
-        {"mem_link", "Connection to spm", { "memHierarchy.MemEventBase" } }
+        {"mem_link", "Connection to spm", { "memHierarchy.MemEventBase" } },
+        {"host_link", "Sharded index: queries from phnswMerge, W goes back when a query is done", { "phnsw.ShardQueryEvent", "phnsw.ShardResultEvent" } }
     )
 
     /* Document statistics (optional if no statistics declared)
      *  Format: { "statisticname", "description", "units", "enablelevel" }
      */
-    SST_ELI_DOCUMENT_STATISTICS( )
+    SST_ELI_DOCUMENT_STATISTICS(
+        { "inst_END",             "Executed END instructions", "instructions", 2 },
+        { "inst_JMP",             "Executed JMP instructions", "instructions", 2 },
+        { "inst_MOV",             "Executed MOV instructions", "instructions", 2 },
+        { "inst_ADD",             "Executed ADD instructions", "instructions", 2 },
+        { "inst_SUB",             "Executed SUB instructions", "instructions", 2 },
+        { "inst_CMP",             "Executed CMP instructions", "instructions", 2 },
+        { "inst_DIST",            "Executed DIST instructions", "instructions", 2 },
+        { "inst_LOOK",            "Executed LOOK instructions", "instructions", 2 },
+        { "inst_PUSH",            "Executed PUSH instructions", "instructions", 2 },
+        { "inst_RMC",             "Executed RMC instructions", "instructions", 2 },
+        { "inst_RMW",             "Executed RMW instructions", "instructions", 2 },
+        { "inst_DMA",             "Executed DMA instructions", "instructions", 2 },
+        { "inst_VST",             "Executed VST instructions", "instructions", 2 },
+        { "inst_RAW",             "Executed RAW instructions", "instructions", 2 },
+        { "inst_NEI",             "Executed NEI instructions", "instructions", 2 },
+        { "inst_ACW",             "Executed ACW instructions", "instructions", 2 },
+        { "inst_WAIT",            "Executed WAIT instructions", "instructions", 2 },
+        { "inst_FENCE",           "Executed FENCE instructions", "instructions", 2 },
+        { "inst_INFO",            "Executed INFO instructions", "instructions", 2 },
+        { "inst_dummy",           "Executed dummy instructions", "instructions", 2 },
+        { "stall_dma_cycles",     "Cycles the pc waits for the DMA: stopFlag, WAIT, FENCE or a register the DMA is writing", "cycles", 1 },
+        { "dist_evals",           "DIST evaluations", "evaluations", 1 },
+        { "vst_reads",            "VST R (visited test) operations", "operations", 1 },
+        { "vst_writes",           "VST W (visited set) operations", "operations", 1 },
+        { "vst_overflows",        "VST T/W ids the hash visited set had no room for", "operations", 1 },
+        { "vst_hits",             "VST R/T that found the node already visited", "operations", 1 },
+        { "vst_clears",           "Full clears of the epoch visited set when the epoch wraps", "operations", 1 },
+        { "push_c_ops",           "PUSH to the candidate list C", "operations", 1 },
+        { "push_w_ops",           "PUSH to the result list W", "operations", 1 },
+        { "rmc_ops",              "RMC operations", "operations", 1 },
+        { "rmw_ops",              "RMW operations", "operations", 1 },
+        { "stall_hazard_cycles",  "Cycles a bundle waits for a register still being written back", "cycles", 1 },
+        { "stall_dist_busy_cycles", "Cycles a DIST waits for a free DIST unit", "cycles", 1 },
+        { "stall_queue_busy_cycles", "Cycles a PUSH/RMC/RMW/ACW waits for its priority queue", "cycles", 1 },
+        { "queue_evictions",      "PUSH to a full queue that evicted its max", "operations", 1 },
+        { "queue_drops",          "PUSH to a full queue that was not below its max", "operations", 1 },
+        { "descent_lists",        "Neighbor lists fetched by DMA N above layer 0", "lists", 1 },
+        { "prefetch_issued",      "Raw vectors fetched by the prefetcher", "vectors", 1 },
+        { "prefetch_skipped",     "Neighbors not prefetched because they were visited", "vectors", 1 },
+        { "prefetch_hits",        "RAW S served from the prefetch ring", "instructions", 1 },
+        { "prefetch_misses",      "RAW S fetched on demand", "instructions", 1 },
+        { "pq_table_builds",      "ADC tables built by DIST T", "tables", 1 },
+        { "stall_pq_table_cycles", "Cycles a DIST PQ waits for the ADC table of its query", "cycles", 1 },
+        { "traversal_cycles",     "Cycles from the first bundle of a query to its END", "cycles", 1 },
+        { "rerank_cycles",        "Cycles END waits for the re-rank of W", "cycles", 1 },
+        { "rerank_evals",         "DIST evaluations of the re-rank", "evaluations", 1 },
+        { "context_switches",     "Cycles issue moved to another query context because the active one stalled", "switches", 1 },
+        { "context_issue_cycles", "Cycles a query context issued a bundle, one statistic per context (subId)", "cycles", 1 },
+        { "batch_broadcasts",     "Distances a batched DIST computed for the other queries of its batch", "evaluations", 1 },
+        { "batch_hits",           "RAW S served by a broadcast distance, without a fetch", "instructions", 1 },
+        { "suspended_cycles",     "Cycles the core clock was off waiting for the DMA, also counted in the stall statistics", "cycles", 1 }
+    )
 
     /* Document subcomponent slots (optional if no subcomponent slots declared)
      *  Format: { "slotname", "description", "subcomponentAPI" }
@@ -172,7 +286,9 @@ private:
 
     SST::phnsw::phnswDMAAPI *dma;
   
-    static Register Registers;
+    L2sqFn l2sq;        // host kernels of DIST, the one of the image format is used
+    L2sqF16Fn l2sq_f16;
+    L2sqU8Fn l2sq_u8;
 
     // instructions
     std::ifstream inst_file;
@@ -183,57 +299,435 @@ private:
     out: instructions fro all clks (very lot vec elements)
     */
     std::vector<std::vector<std::vector<std::string>>> img;
-    std::vector<std::vector<std::string>> inst_now;
-    int inst_count; // only will be 0 or 1
+    std::string program;    // asm file of the search program
     void load_inst_creat_img();
     void display_img();
 
 public:
-    int pc;
+    /* Opcode of a decoded instruction, one per entry of inst_struct */
+    enum Opcode : uint8_t {
+        OP_END, OP_JMP, OP_MOV, OP_ADD, OP_SUB, OP_CMP, OP_DIST, OP_LOOK, OP_PUSH,
+        OP_RMC, OP_RMW, OP_DMA, OP_VST, OP_RAW, OP_NEI, OP_ACW, OP_WAIT, OP_FENCE, OP_INFO, OP_DUMMY,
+        OP_NUM
+    };
+    /* Mode word of CMP / LOOK / PUSH / DMA / VST, resolved at assembly time */
+    enum InstMode : uint8_t {
+        MODE_NONE,
+        CMP_EQ, CMP_NE, CMP_GT, CMP_LT, CMP_GE, CMP_LE,
+        LOOK_MAX, LOOK_MIN,
+        LIST_C, LIST_W,
+        DMA_R, DMA_N, DMA_A, DMA_L,
+        VST_R, VST_W, VST_T,
+        RAW_S, RAW_P, RAW_PS,
+        DIST_PQ, DIST_T, DMA_P
+    };
+    /* Register or [imm] operand, register index is resolved once by the assembler */
+    struct Operand {
+        bool is_imm = false;
+        uint64_t imm = 0;
+        Reg::Id reg = Reg::NONE;
+        uint32_t size = 0;
+    };
+    struct InstStruct;
+    /* One instruction of the image after lowering, no string work is needed to execute it */
+    struct DecodedInst {
+        Opcode op;
+        InstMode mode;
+        const InstStruct *unit;                 // dispatch entry in inst_struct
+        Operand src[2];
+        uint32_t target;                        // JMP target pc
+        const std::vector<std::string> *text;   // source words, for INFO and diagnostics only
+    };
+
+private:
+    /* Decoded image: instructions of bundle pc are code[bundle_begin[pc]] .. code[bundle_begin[pc + 1] - 1] */
+    std::vector<DecodedInst> code;
+    std::vector<uint32_t> bundle_begin;
+    /* Registers read or written by bundle pc: deps[deps_begin[pc]] .. deps[deps_begin[pc + 1] - 1] */
+    std::vector<Reg::Id> deps;
+    std::vector<uint32_t> deps_begin;
+    std::vector<uint8_t> bundle_dists; // DIST count of each bundle
+    void inst_deps(const DecodedInst &inst, std::vector<Reg::Id> &out);
+    void decode_img();
+    Operand decode_operand(const std::string &word, size_t line);
+    InstMode decode_mode(const std::string &word, size_t line);
+
+    const void *operand_ptr(const Operand &operand) {
+        return operand.is_imm ? (const void *) &operand.imm : ctx->Registers.slot(operand.reg);
+    }
+    uint32_t operand_u32(const Operand &operand) {
+        if (operand.is_imm) return (uint32_t) operand.imm;
+        uint32_t value = 0;
+        std::memcpy(&value, ctx->Registers.slot(operand.reg), std::min<size_t>(operand.size, sizeof(value)));
+        return value;
+    }
+
+public:
     struct InstStruct {
         std::string asmop;
         std::string description;
-        int (Phnsw::*handeler) (void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-        std::string rd;
-        std::string rd2;
-        void *rd_temp;
-        void *rd2_temp;
-        uint32_t stages;
-        uint32_t *stage_now;
-
-        InstStruct(std::string asmop, std::string description, int (Phnsw::*handeler) (void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now), std::string rd, std::string rd2, uint32_t stages) :
-            asmop(asmop), description(description), handeler(handeler), rd(rd), rd2(rd2), stages(stages) {
-                stage_now = new uint32_t(0);
-                // std::cout << "stage_now=" << *stage_now;
-                rd_temp = new char[Phnsw::Registers.find_size(rd)];
-                rd2_temp = new char[Phnsw::Registers.find_size(rd2)];
-                std::cout << "Create tmp reg " << rd << " size " << Phnsw::Registers.find_size(rd);
-                std::cout << "\t\tCreate tmp reg2 " << rd2 << " size " << Phnsw::Registers.find_size(rd2) << std::endl;
-            }
+        Opcode op;
+        int (Phnsw::*handeler) (const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+        Reg::Id rd;
+        Reg::Id rd2;
+    };
+    /* One unit op in flight: its own result buffers, written back at done_at. Results are at most
+     * 8 bytes (init_units checks), so ops of the same opcode overlap without sharing storage */
+    struct InFlight {
+        uint64_t done_at;   // timestamp of the write back
+        uint64_t seq;       // issue order, write backs of the same cycle keep it
+        Reg::Id rd;
+        Reg::Id rd2;
+        uint64_t rd_temp;
+        uint64_t rd2_temp;
+        bool operator>(const InFlight &o) const { return done_at != o.done_at ? done_at > o.done_at : seq > o.seq; }
+    };
+    /* Ops in flight of a context, earliest write back on top */
+    using InFlightQueue = std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>>;
+    uint64_t issue_seq;
+    std::array<uint32_t, OP_NUM> unit_latency;  // cycles from issue to write back per opcode, DIST from dist_model
+
+    /* Pipelined distance unit, latency and occupancy derived from params */
+    struct DistUnitModel {
+        uint32_t lanes;
+        uint32_t mul_latency;
+        uint32_t tree_depth;
+        uint32_t ii;
+        uint32_t count;
+        uint32_t beats;     // ceil(dim / lanes)
+        uint32_t latency;   // issue to write back of dist_res
+        uint32_t occupancy; // cycles before the same unit accepts the next DIST
+        /* DIST PQ: one table lookup per lane and beat */
+        uint32_t lookup_latency;
+        uint32_t pq_beats;  // ceil(pq_m / lanes)
+        uint32_t pq_latency;
+        uint32_t pq_occupancy;
+        uint32_t pq_build;  // DIST T: cycles every unit works on the table
+    } dist_model;
+    std::vector<uint64_t> dist_unit_free;  // timestamp each DIST unit accepts a new op
+    void init_units(SST::Params& params);
+    uint32_t issue_dist(const DecodedInst &inst);
+    float raw_dist(const uint8_t *a, const uint8_t *b) const;
+
+    /* Priority queue units of C (0) and W (1), the lists stay in their registers */
+    struct QueueUnit {
+        Reg::Id dist, index, size;
+        uint32_t capacity;
+        QueueTiming timing;
+        uint64_t free_at;       // timestamp the queue accepts the next operation
+    } queues[2];
+    QueueKind queue_kind;
+    void init_queues(SST::Params& params);
+    PriorityQueue queue(int q);
+    static int queue_of(const DecodedInst &inst);
+    const QueueTiming::Op *queue_op(const DecodedInst &inst) const;
+
+    /* DMA scoreboard: a register is busy until the DMA op with tag reg_dma_tag[reg] is done */
+    bool dma_blocking;
+    void dma_busy(Reg::Id reg, uint64_t tag);
+    bool dma_done(uint64_t tag) { return dma->completed_tag >= tag; }
+    bool dma_wait(const DecodedInst &inst);
+
+    /* Memory layout: memory starts right after the scratchpad */
+    uint64_t mem_base;
+    uint64_t visit_end;     // end of the visited bitmap in scratchpad
+    /* Shape of the index (dim, M, ef) and the scratchpad/memory layout derived from it */
+    struct Layout {
+        uint32_t dim;
+        uint32_t degree;        // M
+        uint32_t ef;
+        uint32_t c_capacity;
+        uint64_t raw_size;      // bytes of a raw vector
+        uint64_t neighbor_size; // bytes of a neighbor list
+        uint64_t spm_neighbor;  // neighbor list of DMA N, of context 0
+        uint64_t spm_raw;       // raw vector of DMA R / RAW, of context 0
+        uint64_t spm_visit;     // visited bitmap
+        uint64_t mem_neighbor;  // layer 0 neighbor lists, from the start of memory
+        uint64_t neighbor_stride;
+        uint64_t mem_raw;       // raw vectors, from the start of memory
+        uint64_t raw_stride;
+        /* HNSW layers: layer 0 is the graph above, layers 1 .. levels - 1 have their own regions */
+        uint32_t levels;
+        uint32_t nodes;
+        uint32_t upper_degree;  // upperM
+        uint64_t mem_upper;     // layer 1 neighbor lists, from the start of memory
+        uint64_t upper_stride;
+        uint64_t upper_layer_stride;
+        uint64_t mem_level;     // one byte per node
+        uint32_t entry_point;   // of the image header, UINT32_MAX without one
+        uint64_t queries;       // query vectors after the nodes, 0 without a header
+        uint32_t shard;         // shard of the image, 0 without a header
+        /* Format of the raw vectors, in memory, scratchpad and raw1/raw2 */
+        ImageElem elem;
+        std::vector<float> dist_weight; // u8: scale^2 of every dimension
+        /* PQ codes of the nodes, pq_m 0 without */
+        uint32_t pq_m;
+        uint64_t mem_pq;        // codes, from the start of memory
+        uint64_t pq_stride;
+        uint64_t mem_pq_codebook;
+        std::vector<float> pq_codebook; // [pq_m][IMAGE_PQ_KSUB][dim / pq_m]
+        uint64_t image_size;    // bytes of memory the image fills, 0 without an image header
+    } layout;
+    std::unordered_map<std::string, uint64_t> asm_symbols; // [DIM], [M], [EF], [C_CAP], [M_UP], [PQ_M]
+    void init_layout(SST::Params& params);
+    void init_image_layout(const std::string &image_file);
+    void init_param_layout(SST::Params& params);
+    uint64_t raw_addr(uint32_t index) const { return mem_base + layout.mem_raw + (uint64_t) index * layout.raw_stride; }
+    uint64_t neighbor_addr(uint32_t index) const { return mem_base + layout.mem_neighbor + (uint64_t) index * layout.neighbor_stride; }
+    uint64_t neighbor_addr(uint32_t index, uint32_t layer) const {
+        if (layer == 0) return Phnsw::neighbor_addr(index);
+        return mem_base + layout.mem_upper + (uint64_t) (layer - 1) * layout.upper_layer_stride + (uint64_t) index * layout.upper_stride;
+    }
+    uint64_t level_addr(uint32_t index) const { return mem_base + layout.mem_level + index; }
+    uint64_t pq_addr(uint32_t index) const { return mem_base + layout.mem_pq + (uint64_t) index * layout.pq_stride; }
+
+    /* ADC table of DIST PQ: entry m * IMAGE_PQ_KSUB + c is |q_m - centroid c of subspace m|^2 of the
+     * query in raw2. DIST T streams the codebook in, builds the table on the DIST units and writes
+     * it to the scratchpad, a DIST PQ waits until it is there */
+    struct PqTable {
+        enum State { NONE, LOAD, BUILD, WRITE } state;
+        uint64_t base;          // scratchpad address
+        uint64_t codebook_tag;  // codebook read (LOAD)
+        uint64_t ready_at;      // end of the build (BUILD)
+        uint64_t tag;           // table write (WRITE)
+        std::vector<float> table;
     };
+    void pq_init(SST::Params& params);
+    void pq_build();
+    void pq_tick();
+    bool pq_table_ready() const;
+
+    /* Re-rank: when the program reaches END, the raw vectors of the first R entries of W are
+     * fetched into depth scratchpad slots and DISTed against raw2 on the DIST units, then W is
+     * refilled with the exact distances through its queue unit, capped at k entries */
+    struct RerankSlot {
+        uint64_t tag;           // read of the raw vector out of its slot
+        std::vector<uint8_t> raw;
+    };
+    struct Reranker {
+        enum State { IDLE, RUN, DONE } state;
+        uint32_t r;
+        uint32_t k;
+        uint32_t depth;
+        uint64_t base;
+        std::vector<uint32_t> cand;     // W_index of the traversal, nearest first
+        std::vector<uint32_t> dist;     // exact distance of cand[i]
+        std::vector<uint64_t> ready_at; // timestamp dist[i] leaves the DIST unit
+        uint32_t fetched;       // cand[i] below fetched are fetched or in flight
+        uint32_t computed;      // ... issued to a DIST unit
+        uint32_t inserted;      // ... inserted into W
+        std::vector<RerankSlot> slots;
+    };
+    void rerank_init(SST::Params& params);
+    void rerank_start();
+    void rerank_tick();
+    uint64_t rerank_slot_addr(size_t slot) const { return ctx->rr.base + slot * layout.raw_size; }
+
+    /* Neighbor vector prefetcher: once DMA N lands, the raw vectors of the unvisited
+     * neighbors are fetched into a ring of scratchpad slots, position p in slot p % depth */
+    struct PrefetchSlot {
+        enum State { FREE, TEST, FETCH } state;
+        uint32_t gen;           // neighbor list the slot belongs to
+        uint32_t pos;
+        uint32_t node;
+        uint64_t tag;           // visited test (TEST) or raw fetch (FETCH)
+        uint8_t visited;
+    };
+    struct Prefetcher {
+        uint32_t depth;
+        uint64_t base;
+        bool active;
+        bool list_ready;
+        uint64_t list_tag;
+        uint32_t gen;
+        uint32_t head;          // positions below head are consumed
+        uint32_t next;          // first position not started yet
+        std::vector<uint32_t> list;
+        uint32_t count;         // entries of list, M or upperM
+        bool codes;             // the ring holds PQ codes (RAW PS) instead of raw vectors (RAW S)
+        std::vector<PrefetchSlot> slots;
+    };
+    void prefetch_init(SST::Params& params);
+
+    /* Visited set of VST, on-chip unless visit_mode is SPM or EPOCH */
+    VisitMode visit_mode;
+    uint32_t visit_latency;
+    struct EpochSet {
+        uint64_t base;          // address of the tag of node 0, scratchpad or memory
+        uint64_t capacity;      // nodes
+        uint32_t tag_bytes;
+        uint32_t epoch;         // tag of the current query, 0 is never visited
+        uint32_t epoch_max;
+    } ve;
+    void visit_init(SST::Params& params);
+    uint64_t visit_dma(uint32_t node, bool write, uint8_t *res);
+    void prefetch_start(uint32_t count);
+    void prefetch_tick();
+    uint64_t prefetch_slot_addr(size_t slot) const { return ctx->pf.base + slot * layout.raw_size; }
     static const std::vector<InstStruct> inst_struct;
     // module functions
-    int inst_end(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_jmp(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_mov(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_add(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_sub(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_cmp(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_dist(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_look(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_push(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_rmc(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_rmw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_dma(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_vst(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_raw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_nei(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_acw(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_info(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
-    int inst_dummy(void *rd_temp_ptr, void *rd2_temp_ptr, uint32_t *stage_now);
+    int inst_end(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_jmp(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_mov(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_add(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_sub(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_cmp(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_dist(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_look(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_push(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_rmc(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_rmw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_dma(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_vst(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_raw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_nei(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_acw(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_wait(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_fence(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_info(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
+    int inst_dummy(const DecodedInst &inst, void *rd_temp_ptr, void *rd2_temp_ptr, bool *writes_back);
     // function statistics
-    int pushc_times;
-    int pushw_times;
+    std::array<Statistic<uint64_t>*, OP_NUM> stat_inst;
+    Statistic<uint64_t>* stat_stall_dma;
+    Statistic<uint64_t>* stat_dist_evals;
+    Statistic<uint64_t>* stat_vst_reads;
+    Statistic<uint64_t>* stat_vst_writes;
+    Statistic<uint64_t>* stat_vst_hits;
+    Statistic<uint64_t>* stat_vst_overflows;
+    Statistic<uint64_t>* stat_vst_clears;
+    Statistic<uint64_t>* stat_push_c;
+    Statistic<uint64_t>* stat_push_w;
+    Statistic<uint64_t>* stat_rmc;
+    Statistic<uint64_t>* stat_rmw;
+    Statistic<uint64_t>* stat_stall_hazard;
+    Statistic<uint64_t>* stat_stall_dist_busy;
+    Statistic<uint64_t>* stat_stall_queue_busy;
+    Statistic<uint64_t>* stat_queue_evictions;
+    Statistic<uint64_t>* stat_queue_drops;
+    Statistic<uint64_t>* stat_descent_lists;
+    Statistic<uint64_t>* stat_pf_issued;
+    Statistic<uint64_t>* stat_pf_skipped;
+    Statistic<uint64_t>* stat_pf_hits;
+    Statistic<uint64_t>* stat_pf_misses;
+    Statistic<uint64_t>* stat_pq_builds;
+    Statistic<uint64_t>* stat_stall_pq_table;
+    Statistic<uint64_t>* stat_traversal_cycles;
+    Statistic<uint64_t>* stat_rerank_cycles;
+    Statistic<uint64_t>* stat_rerank_evals;
+    Statistic<uint64_t>* stat_ctx_switches;
+    std::vector<Statistic<uint64_t>*> stat_ctx_issue;
+    Statistic<uint64_t>* stat_batch_broadcasts;
+    Statistic<uint64_t>* stat_batch_hits;
+    Statistic<uint64_t>* stat_suspended;
+
+private:
+    /* Batch mode: the search program is run once per query inside one simulation */
+    struct QueryJob {
+        uint32_t query;
+        uint32_t ep;
+    };
+    struct QueryRecord {
+        uint32_t query;
+        uint32_t ep;
+        SST::SimTime_t start_cycle;
+        SST::SimTime_t end_cycle;
+        SST::SimTime_t start_ns;
+        SST::SimTime_t end_ns;
+        uint32_t top_index;
+        uint32_t top_dist;
+        uint64_t traversal_cycles;  // first bundle to END
+        uint64_t rerank_cycles;     // END waiting for the re-rank
+    };
+    std::vector<QueryJob> query_set;
+    std::vector<QueryRecord> query_records;
+    size_t query_now;       // first job of query_set not taken yet
+    std::vector<uint8_t> job_taken;
+    std::string query_log;
+    uint32_t cores;
+    uint32_t core_id;
+    void load_queries(SST::Params& params);
+    void start_query();
+    bool next_query();
+
+    /* Shard mode: with host_link connected, queries come from phnswMerge one by one, the
+     * core idles without one, and W is sent back at the end of every query */
+    SST::Link *host;
+    uint32_t host_ep;
+    std::vector<uint32_t> host_seq;     // seq of query_set[n]
+    std::vector<SST::SimTime_t> host_arrive_ns; // query_set[n] came in on host_link
+    void handle_host(SST::Event *ev);
+
+    /* Query contexts: every context runs its own query with its own pc, register file, result
+     * buffers, visited set, prefetch ring, ADC table and re-rank slots; the DIST units, the queue
+     * units and the DMA are shared. The state stays in contexts[], ctx points at the active one */
+    struct Context {
+        int pc;
+        Register Registers;
+        InFlightQueue in_flight;
+        std::array<uint8_t, Reg::NUM> reg_pending;  // write backs in flight per register
+        std::array<uint64_t, Reg::NUM> reg_dma_tag; // DMA scoreboard
+        bool vst_read_pending;  // VST R issued, vst_res is checked for a hit once the DMA returns
+        uint64_t vst_read_tag;
+        VisitedSet visited;     // on-chip unless visit_mode is SPM or EPOCH
+        Prefetcher pf;
+        PqTable pq;
+        Reranker rr;
+        uint64_t spm_neighbor;  // staging area of the context: neighbor list of DMA N
+        uint64_t spm_raw;       // ... and raw vector of DMA R / RAW
+        size_t job_now;         // job of the query
+        size_t record_now;      // its record in query_records
+        uint64_t started_at;    // timestamp it started
+        bool query_started;
+        bool query_idle;        // the context has no query
+        std::unordered_map<uint32_t, uint32_t> batch_dist;  // node -> distance broadcast to this query
+        uint32_t raw1_node;     // node RAW S fetched into raw1, UINT32_MAX if none
+        bool batch_pending;     // the next DIST returns batch_value
+        uint32_t batch_value;
+        uint64_t dma_last_tag;  // last DMA op the context issued before it became active, see dma_last()
+    };
+    enum class ContextPolicy { ROUND_ROBIN, OLDEST };
+    /* Outcome of one issue attempt of the active context */
+    enum class Issue { ISSUED, IDLE, DMA, HAZARD, DIST_BUSY, QUEUE_BUSY, PQ_TABLE, RERANK };
+    uint32_t context_count;
+    std::vector<Context> contexts;  // sized once, ctx and DMA destinations point into it
+    Context *ctx;           // active context, &contexts[ctx_now]
+    uint32_t ctx_now;
+    ContextPolicy ctx_policy;
+    std::vector<uint32_t> ctx_order;    // contexts to try after a stall, sized once
+    std::vector<uint64_t> ctx_issue_cycles;
+    uint64_t ctx_switches;
+    void context_init(SST::Params& params);
+    uint64_t dma_mark;      // dma->issued_tag when ctx became active, the ops after it are ctx's
+    /* Last DMA op the active context issued, FENCE and END wait for it and not for the others' */
+    uint64_t dma_last() const { return dma->issued_tag != dma_mark ? dma->issued_tag : ctx->dma_last_tag; }
+    void switch_to(uint32_t c) {
+        ctx->dma_last_tag = dma_last();
+        dma_mark = dma->issued_tag;
+        ctx_now = c;
+        ctx = &contexts[c];
+    }
+    void unit_tick();
+    Issue issue_bundle();
+
+    /* Batched DIST: contexts c / batch_size form a batch whose raw2 registers are the B query
+     * vectors. The DIST of a raw vector that RAW S fetched also computes its distance to every
+     * other query of the batch that has the node in its current neighbor list; that query's
+     * RAW S then skips the fetch and its DIST returns the broadcast distance */
+    uint32_t batch_size;
+    uint32_t batch_window;
+    void batch_broadcast(const uint8_t *raw, uint32_t node);
+    size_t pick_job();
+
+    /* Clock suspension: a cycle in which nothing issues and every context only waits for the
+     * DMA unregisters the clock, the DMA calls resume() when an op retires */
+    bool suspend_clock;
+    bool suspended;
+    SST::Cycle_t suspend_cycle; // last cycle ticked
+    Issue suspend_stall;
+    void count_stall(Issue stall, uint64_t cycles);
+    bool dma_bound();
+    bool suspend(SST::Cycle_t cycle, Issue stall, bool timed);
+    void resume();
 };
 
 } } // namespace phnsw
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "phnswDMA.h"
+#include "image.h"
 
 #ifndef _UTIL_H_
 #define _UTIL_H_
@@ -65,6 +66,25 @@ phnswDMA::phnswDMA(ComponentId_t id, Params& params, TimeConverter *time) :
 
     reqQueueSize = params.find<uint32_t>("maxOutstandingRequests", 8);
     reqPerCycle = params.find<uint32_t>("maxRequestsPerCycle", 2);
+    spmPortWidth = params.find<uint64_t>("spmPortWidth", 64);
+    memRawBase = params.find<uint64_t>("memRawBase", IMAGE_LEGACY_RAW_BASE);
+    memRawEnd = UINT64_MAX;
+    memPqBase = memPqEnd = 0;
+    std::string image_file = params.find<std::string>("imageFile", "");
+    if (!image_file.empty()) {
+        ImageHeader header;
+        std::string error;
+        if (!read_image_header(image_file, header, error)) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'imageFile' - %s\n", getName().c_str(), error.c_str());
+        }
+        memRawBase = header.raw_offset;
+        memRawEnd = header.raw_offset + (header.nodes + header.queries) * header.raw_stride;
+        if (header.pq_m) {
+            // the codebook comes first
+            memPqBase = header.pq_codebook_offset;
+            memPqEnd = header.pq_offset + header.nodes * header.pq_stride;
+        }
+    }
 
     reqsToIssue = params.find<uint64_t>("reqsToIssue", 1000);
 
@@ -80,16 +100,34 @@ phnswDMA::phnswDMA(ComponentId_t id, Params& params, TimeConverter *time) :
             );
 
     sst_assert(memory, CALL_INFO, -1, "Unable to load scratchInterface subcomponent\n");
-    res = malloc(sizeof(uint64_t));
-    
+    if (reqQueueSize < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'maxOutstandingRequests' - must be at least 1\n", getName().c_str());
+    if (reqPerCycle < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'maxRequestsPerCycle' - must be at least 1\n", getName().c_str());
+    if (spmPortWidth < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'spmPortWidth' - must be at least 1\n", getName().c_str());
+
+    // Requests are issued on the core clock
+    clockHandler = new SST::Clock::Handler<phnswDMA>(this, &phnswDMA::clockTick);
+    registerClock(clockTC, clockHandler);
+    timestamp = 0;
+    clock_off = wake_pending = false;
+    issue_cycle = UINT64_MAX;
+    cycle_reqs = 0;
+    cycle_spm_bytes = 0;
+    wake_link = configureSelfLink("wake", "1ps", new SST::Event::Handler<phnswDMA>(this, &phnswDMA::handle_wake));
+    num_events_issued = num_events_returned = 0;
+
     // Disable StOP Flag
     phnswDMA::stopFlag = false;
 
-    phnswDMA::is_spm = false;
+    phnswDMA::issued_tag = 0;
+    phnswDMA::completed_tag = 0;
 
-    phnswDMA::is_vst = false;
-    phnswDMA::is_vst_write = false;
-    phnswDMA::vst_offset = 0;
+    // statistics
+    stat_bytes_neighbor = registerStatistic<uint64_t>("bytes_neighbor");
+    stat_bytes_raw      = registerStatistic<uint64_t>("bytes_raw");
+    stat_bytes_spm      = registerStatistic<uint64_t>("bytes_spm");
+    stat_bytes_visit    = registerStatistic<uint64_t>("bytes_visit");
+    stat_bytes_pq       = registerStatistic<uint64_t>("bytes_pq");
+    stat_req_latency    = registerStatistic<uint64_t>("req_latency");
 }
 
 /**
@@ -99,78 +137,101 @@ phnswDMA::phnswDMA(ComponentId_t id, Params& params, TimeConverter *time) :
 phnswDMA::~phnswDMA() { }
 
 /**
- * @description: DMA send Read request to memroy or scratchpad, call by phnsw core (parent Component).
+ * @description: DMA Read from memroy or scratchpad into the core, call by phnsw core (parent Component).
  * @param {Addr} addr to read
  * @param {size_t} size of read data
- * @return {*}
+ * @param {void} *rd_res where the data goes when the responses arrive
+ * @param {size_t} rd_res_size bytes available at rd_res, the rest of the data is dropped
+ * @return {uint64_t} tag
  */
-void phnswDMA::DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *rd_res, size_t rd_res_size) {
+uint64_t phnswDMA::DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *rd_res, size_t rd_res_size) {
     // std::cout << "<File: phnswDMA.cc> <Function: phnswDMA::DMAread()> DMA read called with addr 0x"
     // << std::hex << addr
     // << std::dec << " and size " << size
     // << " at cycle " << std::dec << getCurrentSimTime()
     // << std::endl;
+    return phnswDMA::enqueue({DMAOp::READ, addr, 0, size, (uint8_t *) rd_res, rd_res_size});
+}
 
-    SST::Interfaces::StandardMem::Request *req;
-    req = new SST::Interfaces::StandardMem::Read(addr, size);
-    req->setNoncacheable();
-    // output.output("%s\n", req->getString().c_str());
-    requests[req->getID()] = timestamp;
-    memory->send(req);
-    num_events_issued++;
-    res = rd_res;
-    // std::cout << "res=" << std::hex <<  (uint32_t) *(uint8_t *) res << std::dec << std::endl;
-    res_size = rd_res_size;
+/**
+ * @description: Test (and set if write) bit offset of the visited byte at addr.
+ * @param {Addr} addr of the visited byte
+ * @param {uint32_t} offset of the bit
+ * @param {bool} write set the bit
+ * @param {void} *res gets the old bit, nullptr (res_size 0) to drop it
+ * @param {size_t} res_size
+ * @return {uint64_t} tag
+ */
+uint64_t phnswDMA::DMAvst(SST::Interfaces::StandardMem::Addr addr, uint32_t offset, bool write, void *res, size_t res_size) {
+    return phnswDMA::enqueue({DMAOp::VST, addr, 0, 1, (uint8_t *) res, res_size, offset, write});
 }
 
-void phnswDMA::DMAvst(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) {
-    vst_tmp_addr = addr;
-    phnswDMA::DMAread(addr, size, res, res_size);
+/**
+ * @description: Test (and set if write) the epoch tag at addr, in scratchpad or memory.
+ *               The node is visited if its tag equals epoch, a set writes epoch into the tag.
+ * @param {Addr} addr of the tag, aligned to tag_bytes
+ * @param {uint32_t} tag_bytes 1 or 2, little endian
+ * @param {uint32_t} epoch of the current query
+ * @param {bool} write set the tag
+ * @param {void} *res gets 1 if the node was visited, nullptr (res_size 0) to drop it
+ * @param {size_t} res_size
+ * @return {uint64_t} tag
+ */
+uint64_t phnswDMA::DMAepoch(SST::Interfaces::StandardMem::Addr addr, uint32_t tag_bytes, uint32_t epoch, bool write, void *res, size_t res_size) {
+    return phnswDMA::enqueue({DMAOp::EPOCH, addr, 0, tag_bytes, (uint8_t *) res, res_size, epoch, write});
 }
 
-void phnswDMA::DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) {
+/**
+ * @description: Move data_size bytes from memory to scratchpad.
+ * @param {Addr} srcAddr in memory
+ * @param {Addr} dstAddr in scratchpad
+ * @param {uint32_t} data_size in bytes
+ * @return {uint64_t} tag
+ */
+uint64_t phnswDMA::DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) {
     // std::cout << "<File: phnswDMA.cc> <Function: phnswDMA::DMAget()> DMA get called with srcAddr 0x"
     // << std::hex << srcAddr
     // << std::dec << " and dstAddr 0x"<< std::hex << dstAddr
     // << " at cycle " << std::dec << getCurrentSimTime()
     // << std::dec << " and data_size " << data_size
     // << std::endl;
-
-    SST::Interfaces::StandardMem::Request *req;
-    req = new Interfaces::StandardMem::MoveData(srcAddr, dstAddr, data_size);
-    requests[req->getID()] = timestamp;
-    memory->send(req);
-    num_events_issued++;
+    return phnswDMA::enqueue({DMAOp::GET, srcAddr, dstAddr, data_size});
 }
 
-void phnswDMA::DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *rd_res, size_t rd_res_size) {
+/**
+ * @description: Read a scratchpad region into the core, e.g. a raw vector into raw1.
+ * @param {Addr} addr in scratchpad
+ * @param {size_t} size in bytes
+ * @param {void} *rd_res destination in the core
+ * @param {size_t} rd_res_size bytes available at rd_res
+ * @return {uint64_t} tag
+ */
+uint64_t phnswDMA::DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *rd_res, size_t rd_res_size) {
     // std::cout << "<File: phnswDMA.cc> <Function: phnswDMA::DMAspmrd()> DMA spmrd called with addr 0x"
     // << std::hex << addr
     // <<std::dec << " and size " << size << std::endl;
+    return phnswDMA::enqueue({DMAOp::SPMRD, addr, 0, size, (uint8_t *) rd_res, rd_res_size});
+}
 
-    is_spm = true;
-    spm_size = (int) size;
-    spm_size_now = 0;
-    spm_addr = addr;
-
-    SST::Interfaces::StandardMem::Request *req;
-    req = new SST::Interfaces::StandardMem::Read(spm_addr, 8);
-    req->setNoncacheable();
-    // output.output("%s\n", req->getString().c_str());
-    memory->send(req);
-    res = rd_res;
-    res_size = 8;
-    spm_size_now += 8;
+/**
+ * @description: Fill [addr, addr + size) with value, e.g. clear the visited bitmap between queries.
+ * @param {Addr} addr to start
+ * @param {size_t} size of the region in bytes
+ * @param {uint8_t} value to write
+ * @return {uint64_t} tag
+ */
+uint64_t phnswDMA::DMAfill(SST::Interfaces::StandardMem::Addr addr, size_t size, uint8_t value) {
+    return phnswDMA::enqueue({DMAOp::FILL, addr, 0, size, nullptr, 0, 0, false, value});
 }
 
 /**
- * @description: DMA send Write request to memroy or scratchpad, call by phnsw core (parent Component).
+ * @description: DMA Write to memroy or scratchpad, call by phnsw core (parent Component).
  * @param {Addr} addr to write
  * @param {size_t} size of write data
  * @param {std::vector<uint8_t>*} data to write, generated in phnsw core (parent Component)
- * @return {*}
+ * @return {uint64_t} tag
  */
-void phnswDMA::DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) {
+uint64_t phnswDMA::DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) {
     // std::cout << "<File: phnswDMA.cc> <Function: phnswDMA::DMAwrite()> DMA write called with addr 0x"
     // << std::hex << addr
     // << std::dec << " and size " << size
@@ -180,17 +241,270 @@ void phnswDMA::DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, st
     //     std::cout << static_cast<int>(element);
     // }
     // std::cout << std::dec << std::endl;
+    DMAOp op = {DMAOp::WRITE, addr, 0, size};
+    op.data = *data;
+    op.data.resize(size);
+    return phnswDMA::enqueue(std::move(op));
+}
+
+/**
+ * @description: Queue a DMA operation, its requests are issued by clockTick. Once this cycle's
+ *               issue has run, or with the clock off, the op gets the rest of this cycle's issue
+ *               right away, so it goes out in the cycle it was queued whatever order the core
+ *               and DMA clock handlers run in.
+ * @param {DMAOp&&} op to queue, tag and progress are set here
+ * @return {uint64_t} tag of the operation
+ */
+uint64_t phnswDMA::enqueue(DMAOp &&op) {
+    op.tag = ++issued_tag;
+    op.issued = 0;
+    op.inflight = 0;
+    op.done = op.size == 0;
+    ops.push_back(std::move(op));
+    if (ops.back().done) {
+        phnswDMA::retire();
+        return issued_tag;
+    }
+    SST::Cycle_t now = getCurrentSimTime(clockTC);
+    if (clock_off || now == issue_cycle) {
+        bool all_issued = phnswDMA::issue(now);
+        if (clock_off && !all_issued && !wake_pending) {
+            wake_pending = true;
+            wake_link->send(new SST::NullEvent());
+        }
+    }
+    return issued_tag;
+}
 
+/**
+ * @description: Turn the clock on again for ops queued while it was off that did not all go
+ *               out in the cycle they were queued in. The clock takes over from the next cycle.
+ * @param {Event*} ev wake event
+ * @return {*}
+ */
+void phnswDMA::handle_wake(SST::Event *ev) {
+    delete ev;
+    wake_pending = false;
+    if (!clock_off) return;
+    // ops may have gone out since the wake was sent
+    if (phnswDMA::issue(getCurrentSimTime(clockTC))) return;
+    clock_off = false;
+    reregisterClock(clockTC, clockHandler);
+}
+
+/**
+ * @description: Whether a later op must wait for an earlier one,
+ *               i.e. one writes scratchpad/memory bytes the other reads or writes.
+ *               Reads into the core only conflict through the core scoreboard.
+ * @param {DMAOp&} earlier op, not done yet
+ * @param {DMAOp&} later op
+ * @return {bool}
+ */
+bool phnswDMA::conflict(const DMAOp &earlier, const DMAOp &later) {
+    struct Range { SST::Interfaces::StandardMem::Addr addr; size_t size; };
+    auto reads = [](const DMAOp &op) -> Range {
+        switch (op.kind) {
+        case DMAOp::READ: case DMAOp::SPMRD: case DMAOp::GET: return {op.addr, op.size};
+        case DMAOp::VST: return {op.addr, 1};
+        case DMAOp::EPOCH: return {op.addr, op.size};
+        default: return {0, 0};
+        }
+    };
+    auto writes = [](const DMAOp &op) -> Range {
+        switch (op.kind) {
+        case DMAOp::GET: return {op.dst, op.size};
+        case DMAOp::WRITE: case DMAOp::FILL: return {op.addr, op.size};
+        case DMAOp::VST: return {op.addr, op.vst_write ? 1u : 0u};
+        case DMAOp::EPOCH: return {op.addr, op.vst_write ? op.size : 0};
+        default: return {0, 0};
+        }
+    };
+    auto overlap = [](Range a, Range b) {
+        return a.size && b.size && a.addr < b.addr + b.size && b.addr < a.addr + a.size;
+    };
+    Range earlier_w = writes(earlier);
+    Range later_w = writes(later);
+    return overlap(earlier_w, reads(later)) || overlap(earlier_w, later_w) || overlap(reads(earlier), later_w);
+}
+
+bool phnswDMA::op_ready(size_t index) const {
+    for (size_t i = 0; i < index; i++) {
+        if (!ops[i].done && phnswDMA::conflict(ops[i], ops[index])) return false;
+    }
+    return true;
+}
+
+/**
+ * @description: Bytes of the next request of op. A request never crosses a line
+ *               (scratchLineSize in scratchpad, memLineSize in memory), and a
+ *               scratchpad read is at most spmPortWidth.
+ * @param {DMAOp&} op with bytes left to issue
+ * @return {size_t}
+ */
+size_t phnswDMA::chunk_size(const DMAOp &op) const {
+    SST::Interfaces::StandardMem::Addr addr = op.addr + op.issued;
+    uint64_t line = addr < scratchSize ? scratchLineSize : memLineSize;
+    size_t size = std::min<size_t>(line - (addr & (line - 1)), op.size - op.issued);
+    if (op.kind == DMAOp::GET) {
+        // the scratchpad side must not cross a line either
+        SST::Interfaces::StandardMem::Addr spm = op.dst + op.issued;
+        size = std::min<size_t>(size, scratchLineSize - (spm & (scratchLineSize - 1)));
+    }
+    if (phnswDMA::spm_read(op)) size = std::min<size_t>(size, spmPortWidth);
+    return size;
+}
+
+/**
+ * @description: Whether the next request of op goes through the scratchpad read port.
+ * @param {DMAOp&} op
+ * @return {bool}
+ */
+bool phnswDMA::spm_read(const DMAOp &op) const {
+    bool read = op.kind == DMAOp::READ || op.kind == DMAOp::SPMRD || op.kind == DMAOp::VST || op.kind == DMAOp::EPOCH;
+    return read && op.addr + op.issued < scratchSize;
+}
+
+/**
+ * @description: Issue the next request of op.
+ * @param {DMAOp&} op with bytes left to issue
+ * @param {size_t} size of the request, from chunk_size
+ * @return {*}
+ */
+void phnswDMA::issue_chunk(DMAOp &op, size_t size) {
+    SST::Interfaces::StandardMem::Addr addr = op.addr + op.issued;
+    uint8_t *dst = nullptr;
+    size_t dst_size = 0;
     SST::Interfaces::StandardMem::Request *req;
-    req = new SST::Interfaces::StandardMem::Write(addr, size, *data);
-    req->setNoncacheable(); // Key point! if non-cacheable not set, nothing will be written
-    // output.output("ScratchCPU (%s) sending Write. Addr: %" PRIu64 ", Size: %lu, simtime: %" PRIu64 "ns\n", getName().c_str(), addr, size, getCurrentSimCycle()/1000);
+    switch (op.kind) {
+    case DMAOp::GET:
+        req = new Interfaces::StandardMem::MoveData(addr, op.dst + op.issued, size);
+        break;
+    case DMAOp::SPMRD:
+    case DMAOp::READ:
+    case DMAOp::VST:
+    case DMAOp::EPOCH:
+        req = new SST::Interfaces::StandardMem::Read(addr, size);
+        req->setNoncacheable();
+        if (op.kind != DMAOp::VST && op.kind != DMAOp::EPOCH && op.issued < op.res_size) {
+            dst = op.res + op.issued;
+            dst_size = std::min(size, op.res_size - op.issued);
+        }
+        break;
+    case DMAOp::WRITE:
+        req = new SST::Interfaces::StandardMem::Write(addr, size,
+            std::vector<uint8_t>(op.data.begin() + op.issued, op.data.begin() + op.issued + size));
+        req->setNoncacheable(); // Key point! if non-cacheable not set, nothing will be written
+        break;
+    case DMAOp::FILL:
+    default:
+        req = new SST::Interfaces::StandardMem::Write(addr, size, std::vector<uint8_t>(size, op.value));
+        req->setNoncacheable();
+        break;
+    }
     // output.output("%s\n", req->getString().c_str());
-    // requests[req->getID()] = timestamp;
+    count_bytes(addr, size);
+    if (op.kind == DMAOp::EPOCH) stat_bytes_visit->addData(size);
+    phnswDMA::send(req, op, dst, dst_size);
+    op.issued += size;
+}
+
+/**
+ * @description: Send a request to memory and add it to the request table.
+ * @param {Request} *req to send
+ * @param {DMAOp&} op the request belongs to
+ * @param {uint8_t} *dst where the response data goes, nullptr if none
+ * @param {size_t} dst_size bytes available at dst
+ * @return {*}
+ */
+void phnswDMA::send(SST::Interfaces::StandardMem::Request *req, DMAOp &op, uint8_t *dst, size_t dst_size) {
+    requests[req->getID()] = {op.tag, dst, dst_size, getCurrentSimTime()};
+    op.inflight++;
     memory->send(req);
     num_events_issued++;
 }
 
+/**
+ * @description: Retire done ops in order, publish their tags.
+ * @return {*}
+ */
+void phnswDMA::retire() {
+    uint64_t before = completed_tag;
+    while (!ops.empty() && ops.front().done) {
+        completed_tag = ops.front().tag;
+        ops.pop_front();
+    }
+    if (ops.empty()) phnsw::phnswDMA::stopFlag = false;
+    if (completed_tag != before && on_retire) on_retire();
+}
+
+/**
+ * @description: Issue of this cycle. Once every op is fully issued the clock goes off,
+ *               the responses come in as events without it.
+ * @param {Cycle_t} currentCycle
+ * @return {bool} true to unregister the clock handler
+ */
+bool phnswDMA::clockTick(SST::Cycle_t currentCycle) {
+    if (!phnswDMA::issue(currentCycle)) return false;
+    clock_off = true;
+    return true;
+}
+
+/**
+ * @description: Issue up to maxRequestsPerCycle memory side requests and up to
+ *               spmPortWidth bytes of scratchpad reads per cycle, while fewer than
+ *               maxOutstandingRequests are in flight. Ops issue in order unless
+ *               an earlier one touches the same bytes. Runs more than once in a cycle
+ *               when ops are queued after it, the budgets of the cycle carry over.
+ * @param {Cycle_t} cycle to issue in, cycles since the last issue are counted in timestamp
+ * @return {bool} true once every op is fully issued
+ */
+bool phnswDMA::issue(SST::Cycle_t cycle) {
+    if (cycle != issue_cycle) {
+        timestamp += issue_cycle == UINT64_MAX ? 1 : cycle - issue_cycle;
+        issue_cycle = cycle;
+        cycle_reqs = 0;
+        cycle_spm_bytes = 0;
+    }
+    for (size_t i = 0; i < ops.size() && requests.size() < reqQueueSize; i++) {
+        DMAOp &op = ops[i];
+        if (op.issued >= op.size || !phnswDMA::op_ready(i)) continue;
+        while (op.issued < op.size && requests.size() < reqQueueSize) {
+            size_t size = phnswDMA::chunk_size(op);
+            if (phnswDMA::spm_read(op)) {
+                if (cycle_spm_bytes + size > spmPortWidth) break;
+                cycle_spm_bytes += size;
+            } else {
+                if (cycle_reqs >= reqPerCycle) break;
+                cycle_reqs++;
+            }
+            phnswDMA::issue_chunk(op, size);
+        }
+    }
+    for (auto &&op : ops) {
+        if (op.issued < op.size) return false;
+    }
+    return true;
+}
+
+/**
+ * @description: Account bytes moved by a request to the memory region it touches.
+ * @param {Addr} addr source (memory) or scratchpad address of the request
+ * @param {size_t} size in bytes
+ * @return {*}
+ */
+void phnswDMA::count_bytes(SST::Interfaces::StandardMem::Addr addr, size_t size) {
+    if (addr < scratchSize) {
+        stat_bytes_spm->addData(size);
+    } else if (addr >= scratchSize + memRawBase && addr - scratchSize < memRawEnd) {
+        stat_bytes_raw->addData(size);
+    } else if (addr >= scratchSize + memPqBase && addr - scratchSize < memPqEnd) {
+        stat_bytes_pq->addData(size);
+    } else {
+        // neighbor lists of every layer, and the header and level bytes of an image
+        stat_bytes_neighbor->addData(size);
+    }
+}
+
 /**
  * @description: Serializer function, I don't know what it does,
  *               it just exist in the Subcomponent Template so I copy it.
@@ -205,60 +519,65 @@ void phnswDMA::serialize_order(SST::Core::Serialization::serializer& ser) {
 
 /**
  * @description: Memory response handler, execute when the memory returns a response.
-                 Whenever received an respone, print some information about the respobne,
-                 and delete respone.
+                 Find the request in the request table, place read data directly at its
+                 destination, and retire the op once all of its requests are back.
  * @param {Request} *respone
  * @return {*}
  */
 void phnswDMA::handleEvent( SST::Interfaces::StandardMem::Request *respone ) {
-    std::vector<uint8_t> data;
-    if (typeid(*respone) == typeid(SST::Interfaces::StandardMem::ReadResp))
-        data = ((SST::Interfaces::StandardMem::ReadResp*) respone)->data;
-    uint8_t temp_data[512] = {0};
     // std::cout << "<File: phnswDMA.cc> <Function: phnswDMA::handleEvent()> time=" << getCurrentSimTime()
     // << "; respone: " << respone->getString()
-    // // << " Data=" << (uint16_t) data.back()
     // << std::endl;
+    auto found = requests.find(respone->getID());
+    if (found == requests.end()) {
+        output.fatal(CALL_INFO, -1, "Error (%s): response to an unknown request\n", getName().c_str());
+    }
+    ReqDesc desc = found->second;
+    requests.erase(found);
+    stat_req_latency->addData(getCurrentSimTime() - desc.issue_time);
+    num_events_returned++;
 
+    DMAOp &op = ops[desc.tag - ops.front().tag];
+    op.inflight--;
     if (typeid(*respone) == typeid(SST::Interfaces::StandardMem::ReadResp)) {
-        for (size_t i = 0; i < data.size(); i++) {
-            temp_data[i] = data[i];
-            // std::cout << "temp_data[" << i << "]=" << (uint16_t) temp_data[i] << std::endl;
-        }
-        if (is_vst) {
-            is_vst = false;
-            // std::cout << "vst read temp_data[0]=" << (uint16_t) temp_data[0] << std::endl;
-            if (is_vst_write) {
-                temp_data[0] = temp_data[0] | (1 << vst_offset);
-                // std::cout << "after vst read temp_data[0]=" << (uint16_t) temp_data[0] << std::endl;
-                is_vst_write = false;
-                vst_tmp_data = temp_data[0];
-                delete respone;
-                vst_tmp_data = vst_tmp_data | (1 << vst_offset);
-                std::vector<uint8_t> vst_tmp_data_write = {vst_tmp_data};
-                phnswDMA::DMAwrite(vst_tmp_addr, 1, &vst_tmp_data_write);
-                return;
-            } else {
-                temp_data[0] = temp_data[0] & (1 << vst_offset);
+        std::vector<uint8_t> &data = ((SST::Interfaces::StandardMem::ReadResp*) respone)->data;
+        if (op.kind == DMAOp::VST) {
+            uint8_t bit = 1 << op.vst_offset;
+            // std::cout << "vst read data[0]=" << (uint16_t) data[0] << std::endl;
+            if (op.res_size) *op.res = data[0] & bit; // old bit
+            if (op.vst_write) {
+                // set the bit and write the byte back, the op is done after the write
+                std::vector<uint8_t> vst_tmp_data_write = {(uint8_t) (data[0] | bit)};
+                SST::Interfaces::StandardMem::Request *req;
+                req = new SST::Interfaces::StandardMem::Write(op.addr, 1, vst_tmp_data_write);
+                req->setNoncacheable();
+                count_bytes(op.addr, 1);
+                phnswDMA::send(req, op, nullptr, 0);
             }
+        } else if (op.kind == DMAOp::EPOCH) {
+            uint32_t tag = 0;
+            for (size_t i = 0; i < op.size && i < data.size(); i++) tag |= (uint32_t) data[i] << (8 * i);
+            if (op.res_size) *op.res = tag == op.vst_offset;
+            if (op.vst_write && tag != op.vst_offset) {
+                // write the current epoch back, the op is done after the write
+                std::vector<uint8_t> epoch_data(op.size);
+                for (size_t i = 0; i < op.size; i++) epoch_data[i] = (uint8_t) (op.vst_offset >> (8 * i));
+                SST::Interfaces::StandardMem::Request *req;
+                req = new SST::Interfaces::StandardMem::Write(op.addr, op.size, epoch_data);
+                req->setNoncacheable();
+                count_bytes(op.addr, op.size);
+                stat_bytes_visit->addData(op.size);
+                phnswDMA::send(req, op, nullptr, 0);
+            }
+        } else if (desc.dst) {
+            std::memcpy(desc.dst, data.data(), std::min(data.size(), desc.dst_size));
         }
-        std::memcpy(res, temp_data, res_size);
     }
-
     delete respone;
-    if (spm_size_now >= spm_size) is_spm = false;
 
-    if (is_spm) {
-        SST::Interfaces::StandardMem::Request *req;
-        req = new SST::Interfaces::StandardMem::Read(spm_addr + spm_size_now, 8);
-        req->setNoncacheable();
-        // output.output("%s\n", req->getString().c_str());
-        memory->send(req);
-        spm_size_now += 8;
-        res = (void *) ((uint64_t) res + 8);
-    } else {
-        // is_spm = false;
-        phnsw::phnswDMA::stopFlag = false;
+    if (op.inflight == 0 && op.issued >= op.size) {
+        op.done = true;
+        phnswDMA::retire();
     }
 }
 
@@ -272,8 +591,3 @@ void phnswDMA::init(unsigned int phase) {
     memory->init(phase);
     std::cout << "memory->init(phase) called" << std::endl;
 }
-
-void phnswDMA::Resset(void *res, size_t res_size) {
-    phnswDMA::res = res;
-    phnswDMA::res_size = res_size;
-}
@@ -21,17 +21,15 @@
  */
 
 #include <cstdint>
-#define SPM_NEIGHBOR_ADDR 0x0
-#define SPM_NEIGHBOR_SIZE 0x80 // 0x80(16) = 128(10) in bytes = 32 * 4(bytes)
-#define SPM_RAW_BASE SPM_NEIGHBOR_SIZE
-#define SPM_RAW_SIZE 128 * 4 // 128(dim) * 4(bytes)(float32)
-#define SPM_VISIT_BASE 720
-#define MEM_ADDR_BASE 0x800 // 0x800(16) = 2048(10)
-#define MEM_NEIGHBOR ADDR 0X0
-#define MEM_NEIGHBOR_SIZE 1280000
-#define MEM_RAW_BASE 0x138800
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#define SPM_NEIGHBOR_ADDR 0x0 // staging areas of the contexts, sized by Phnsw::Layout
+#define SPM_VISIT_BASE 720    // lowest start of the visited bitmap
     
 #include <sst/core/subcomponent.h>
+#include <sst/core/link.h>
 #include <sst/core/interfaces/stdMem.h>
 #include <sst/core/params.h>
 
@@ -51,20 +49,24 @@ public:
     phnswDMAAPI(ComponentId_t id, Params& params, TimeConverter *time) : SubComponent(id) { }
     virtual ~phnswDMAAPI() { }
 
-    // These are the two functions described in the comment above
-    virtual void DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) =0;
-    virtual void DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) =0;
-    virtual void DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) =0;
-    virtual void DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) =0;
-    virtual void DMAvst(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) =0;
-    virtual void Resset(void *res, size_t res_size) =0;
+    // DMA operations are queued and retired in order, each returns its tag
+    virtual uint64_t DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) =0;
+    virtual uint64_t DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) =0;
+    virtual uint64_t DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) =0;
+    virtual uint64_t DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) =0;
+    virtual uint64_t DMAvst(SST::Interfaces::StandardMem::Addr addr, uint32_t offset, bool write, void *res, size_t res_size) =0;
+    virtual uint64_t DMAepoch(SST::Interfaces::StandardMem::Addr addr, uint32_t tag_bytes, uint32_t epoch, bool write, void *res, size_t res_size) =0;
+    virtual uint64_t DMAfill(SST::Interfaces::StandardMem::Addr addr, size_t size, uint8_t value) =0;
 
-    // Stop Flag
+    // Stop Flag, cleared when every queued operation is done
     bool stopFlag;
 
-    bool is_vst;
-    bool is_vst_write;
-    uint32_t vst_offset;
+    // Tags: an operation with tag t is done once completed_tag >= t
+    uint64_t issued_tag;
+    uint64_t completed_tag;
+    bool idle() const { return completed_tag == issued_tag; }
+    // Called whenever completed_tag moves, the core resumes its suspended clock
+    std::function<void()> on_retire;
 
     // Serialization
     phnswDMAAPI();
@@ -99,7 +101,10 @@ public:
     { "memLineSize",             "(uint) Line size for memory, max request size for memory", "64"},
     { "clock",                   "(string) Clock frequency in Hz or period in s", "1GHz"},
     { "maxOutstandingRequests",  "(uint) Maximum number of requests outstanding at a time", "8"},
-    { "maxRequestsPerCycle",     "(uint) Maximum number of requests to issue per cycle", "2"},
+    { "maxRequestsPerCycle",     "(uint) Maximum number of memory side requests to issue per cycle", "2"},
+    { "memRawBase",              "(uint) Raw vectors in memory, from the start of memory, splits bytes_neighbor from bytes_raw", "0x138800"},
+    { "imageFile",               "(string) Memory image with a header (datasetx/build_image.py), its raw region replaces memRawBase", ""},
+    { "spmPortWidth",            "(uint) Bytes the scratchpad read port delivers per cycle, scratchpad reads are split into requests of at most this size", "64"},
     { "reqsToIssue",             "(uint) Number of requests to issue before ending simulation", "1000"}
     )
 
@@ -110,6 +115,18 @@ public:
         {"mem_link", "Connection to spm", { "memHierarchy.MemEventBase" } }
     )
 
+    /* Document statistics (optional if no statistics declared)
+     *  Format: { "statisticname", "description", "units", "enablelevel" }
+     */
+    SST_ELI_DOCUMENT_STATISTICS(
+        { "bytes_neighbor", "Bytes moved from the neighbor list region of memory", "bytes", 1 },
+        { "bytes_raw",      "Bytes moved from the raw vector region of memory", "bytes", 1 },
+        { "bytes_spm",      "Bytes read from or written to the scratchpad", "bytes", 1 },
+        { "bytes_visit",    "Bytes of epoch visited tags read or written, also counted in their region", "bytes", 1 },
+        { "bytes_pq",       "Bytes moved from the PQ codebook and code regions of an image", "bytes", 1 },
+        { "req_latency",    "Latency of each request, use sst.HistogramStatistic for a histogram", "cycles", 1 }
+    )
+
     /* Document subcomponent slots (optional if no subcomponent slots declared)
      *  Format: { "slotname", "description", "subcomponentAPI" }
      */
@@ -128,17 +145,20 @@ public:
     // virtual void complete(unsigned int phase) override;
     // virtual void finish() override;
 
-    void DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) override;
-    void DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) override;
-    void DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) override;
-    void DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) override;
-    void DMAvst(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) override;
+    uint64_t DMAwrite(SST::Interfaces::StandardMem::Addr addr, size_t size, std::vector<uint8_t>* data) override;
+    uint64_t DMAread(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) override;
+    uint64_t DMAget(SST::Interfaces::StandardMem::Addr srcAddr, SST::Interfaces::StandardMem::Addr dstAddr, uint32_t data_size) override;
+    uint64_t DMAspmrd(SST::Interfaces::StandardMem::Addr addr, size_t size, void *res, size_t res_size) override;
+    uint64_t DMAvst(SST::Interfaces::StandardMem::Addr addr, uint32_t offset, bool write, void *res, size_t res_size) override;
+    uint64_t DMAepoch(SST::Interfaces::StandardMem::Addr addr, uint32_t tag_bytes, uint32_t epoch, bool write, void *res, size_t res_size) override;
+    uint64_t DMAfill(SST::Interfaces::StandardMem::Addr addr, size_t size, uint8_t value) override;
     void serialize_order(SST::Core::Serialization::serializer& ser) override;
 
     // bool stopFalg;
 
     void handleEvent( SST::Interfaces::StandardMem::Request *ev );
-    void Resset(void *res, size_t res_size) override;
+    bool clockTick( SST::Cycle_t currentCycle );
+    void handle_wake(SST::Event *ev);
 
 private:
     int amount;
@@ -154,27 +174,78 @@ private:
 
     uint32_t reqPerCycle;   // Up to this many requests can be issued in a cycle
     uint32_t reqQueueSize;  // Maximum number of outstanding requests
+    uint64_t spmPortWidth;  // Bytes per cycle through the scratchpad read port
+    uint64_t memRawBase;    // Raw vectors, from the start of memory
+    uint64_t memRawEnd;     // end of the raw vectors, UINT64_MAX without an image header
+    uint64_t memPqBase;     // PQ codebook and codes of an image, empty without
+    uint64_t memPqEnd;
     uint64_t reqsToIssue;   // Number of requests to issue before ending simulation
 
     // Local variables
     SST::Interfaces::StandardMem * memory;         // scratch interface
-    std::unordered_map<uint64_t, SST::SimTime_t> requests; // Request queue (outstanding requests)
     SST::TimeConverter *clockTC;                 // Clock object
     SST::Clock::HandlerBase *clockHandler;       // Clock handler
 
     uint64_t timestamp;     // current timestamp
+
+    /* The clock is off while every queued op is fully issued, enqueue wakes it through wake_link:
+     * the core queues ops from its own tick, inside the clock the handler would be re-added to */
+    bool clock_off;
+    bool wake_pending;
+    SST::Link *wake_link;
+    /* Issue of one cycle, from the clock or from an enqueue after it, whichever handler runs first */
+    SST::Cycle_t issue_cycle;   // last cycle whose issue ran, UINT64_MAX before the first
+    uint32_t cycle_reqs;        // memory side requests issued in issue_cycle
+    uint64_t cycle_spm_bytes;   // bytes through the scratchpad read port in issue_cycle
     uint64_t num_events_issued;      // number of events that have been issued at a given time
     uint64_t num_events_returned;    // number of events that have returned
 
-    void *res;
-    size_t res_size;
-
-    bool is_spm;
-    int spm_size, spm_size_now;
-    uint64_t spm_addr;
-
-    uint8_t vst_tmp_data;
-    SST::Interfaces::StandardMem::Addr vst_tmp_addr;
+    /* A queued DMA operation, split into line sized requests when issued */
+    struct DMAOp {
+        enum Kind { READ, GET, SPMRD, VST, EPOCH, WRITE, FILL } kind;
+        SST::Interfaces::StandardMem::Addr addr;
+        SST::Interfaces::StandardMem::Addr dst;  // GET: scratchpad destination
+        size_t size;
+        uint8_t *res;                            // READ, SPMRD, VST, EPOCH: destination in the core
+        size_t res_size;
+        uint32_t vst_offset;                     // VST: bit, EPOCH: tag of the current query
+        bool vst_write;                          // VST, EPOCH
+        uint8_t value;                           // FILL
+        std::vector<uint8_t> data;               // WRITE
+        uint64_t tag;
+        size_t issued;                           // bytes already issued
+        uint32_t inflight;                       // requests in flight
+        bool done;
+    };
+    std::deque<DMAOp> ops; // not retired yet, oldest first, tags are consecutive
+
+    /* Destination and completion descriptor of a request in flight */
+    struct ReqDesc {
+        uint64_t tag;                // DMA op the request belongs to
+        uint8_t *dst;                // ReadResp data goes here, nullptr if none
+        size_t dst_size;
+        SST::SimTime_t issue_time;
+    };
+    std::unordered_map<uint64_t, ReqDesc> requests; // outstanding requests
+
+    uint64_t enqueue(DMAOp &&op);
+    bool issue(SST::Cycle_t cycle);
+    static bool conflict(const DMAOp &earlier, const DMAOp &later);
+    bool op_ready(size_t index) const;
+    void issue_chunk(DMAOp &op, size_t size);
+    size_t chunk_size(const DMAOp &op) const;
+    bool spm_read(const DMAOp &op) const;
+    void send(SST::Interfaces::StandardMem::Request *req, DMAOp &op, uint8_t *dst, size_t dst_size);
+    void retire();
+
+    // statistics
+    Statistic<uint64_t>* stat_bytes_neighbor;
+    Statistic<uint64_t>* stat_bytes_raw;
+    Statistic<uint64_t>* stat_bytes_spm;
+    Statistic<uint64_t>* stat_bytes_visit;
+    Statistic<uint64_t>* stat_bytes_pq;
+    Statistic<uint64_t>* stat_req_latency;
+    void count_bytes(SST::Interfaces::StandardMem::Addr addr, size_t size);
 };
 
 } } /* Namspaces */
@@ -0,0 +1,255 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-24 10:12:40
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-24 10:12:40
+ * @FilePath: /phnsw/src/phnswMerge.cc
+ * @Description: host of a sharded index: broadcasts queries to the shard cores and merges their W
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#include <sst/core/sst_config.h> // This include is REQUIRED for all implementation files
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#include "phnswMerge.h"
+#include "image.h"
+
+using namespace SST;
+using namespace phnsw;
+
+/**
+ * @description: Constructor
+ *               Connect the shard links, read the labels of the shard images and the query set.
+ * @param {ComponentId_t} id comes from SST core.
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+phnswMerge::phnswMerge( SST::ComponentId_t id, SST::Params& params ) :
+    SST::Component(id), timestamp(0), next_broadcast(0), next_merge(0) {
+
+    output.init("phnswMerge-" + getName() + "-> ", params.find<uint32_t>("verbose", 1), 0, SST::Output::STDOUT);
+
+    shards = params.find<uint32_t>("shards", 1);
+    k = params.find<uint32_t>("k", 10);
+    max_inflight = params.find<uint32_t>("maxInflight", 1);
+    merge_ii = params.find<uint32_t>("mergeII", 1);
+    if (shards < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'shards' - must be at least 1\n", getName().c_str());
+    if (k < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'k' - must be at least 1\n", getName().c_str());
+    if (max_inflight < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'maxInflight' - must be at least 1\n", getName().c_str());
+    if (merge_ii < 1) output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'mergeII' - must be at least 1\n", getName().c_str());
+    merge_depth = 0;
+    while ((1u << merge_depth) < shards) merge_depth++;
+
+    for (uint32_t s = 0; s < shards; s++) {
+        SST::Link *link = configureLink("shard_" + std::to_string(s), new SST::Event::Handler<phnswMerge>(this, &phnswMerge::handle_result));
+        if (!link) output.fatal(CALL_INFO, -1, "Error (%s): port 'shard_%u' is not connected\n", getName().c_str(), s);
+        links.push_back(link);
+    }
+
+    // labels turn the node ids of a shard into ids of the whole index
+    std::vector<std::string> images;
+    params.find_array<std::string>("shardImages", images);
+    if (!images.empty() && images.size() != shards) {
+        output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'shardImages' - %zu images for %u shards\n", getName().c_str(), images.size(), shards);
+    }
+    labels.resize(shards);
+    for (size_t s = 0; s < images.size(); s++) {
+        ImageHeader header;
+        std::string error;
+        if (!read_image_header(images[s], header, error) || !read_image_labels(images[s], header, labels[s], error)) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'shardImages' - %s\n", getName().c_str(), error.c_str());
+        }
+        if (header.shard != s || header.shards != shards) {
+            output.fatal(CALL_INFO, -1, "Error (%s): invalid param 'shardImages' - %s is shard %u of %u, not %zu of %u\n",
+                getName().c_str(), images[s].c_str(), header.shard, header.shards, s, shards);
+        }
+    }
+
+    query_log = params.find<std::string>("queryLog", "");
+    phnswMerge::load_queries(params);
+
+    SST::UnitAlgebra clock = params.find<SST::UnitAlgebra>("clock", "1GHz");
+    clockHandler = new SST::Clock::Handler<phnswMerge>(this, &phnswMerge::clockTick);
+    clockTC = registerClock(clock, clockHandler);
+
+    registerAsPrimaryComponent();
+    primaryComponentDoNotEndSim();
+
+    stat_merged = registerStatistic<uint64_t>("merged_queries");
+    stat_merge_cycles = registerStatistic<uint64_t>("merge_cycles");
+    output.verbose(CALL_INFO, 1, 0, "%u shards, %zu queries, top %u, %u in flight, merge tree of %u levels\n",
+        shards, jobs.size(), k, max_inflight, merge_depth);
+}
+
+/**
+ * @description: Build the query set from params: queryFile lines are query numbers,
+ *               otherwise queryIndex, queryIndex + 1, ...
+ * @param {Params&} params come from SST core.
+ * @return {*}
+ */
+void phnswMerge::load_queries(SST::Params& params) {
+    std::string query_file = params.find<std::string>("queryFile", "");
+    uint32_t queries = params.find<uint32_t>("queries", 0);
+    std::vector<uint32_t> numbers;
+    if (!query_file.empty()) {
+        std::ifstream file(query_file);
+        if (!file) {
+            output.fatal(CALL_INFO, -1, "ERROR: can not open queryFile %s\n", query_file.c_str());
+        }
+        std::string line;
+        while (std::getline(file, line) && (queries == 0 || numbers.size() < queries)) {
+            std::stringstream ss(line);
+            uint32_t query;
+            if (ss >> query) numbers.push_back(query);
+        }
+    } else {
+        uint32_t query_index = params.find<uint32_t>("queryIndex", 0);
+        for (uint32_t n = 0; n < std::max<uint32_t>(queries, 1); n++) numbers.push_back(query_index + n);
+    }
+    if (numbers.empty()) {
+        output.fatal(CALL_INFO, -1, "ERROR: no query to run\n");
+    }
+    for (auto &&query : numbers) {
+        MergeJob job = {};
+        job.query = query;
+        jobs.push_back(job);
+    }
+}
+
+/**
+ * @description: lifecycle function: setup (unused)
+ * @return {*}
+ */
+void phnswMerge::setup() { }
+
+/**
+ * @description: Clock callback function: broadcast queries while fewer than maxInflight wait for
+ *               their merge, and run the merge tree on the oldest query once every shard replied.
+ * @param {Cycle_t} currentCycle
+ * @return {bool} true once every query is merged
+ */
+bool phnswMerge::clockTick( SST::Cycle_t currentCycle ) {
+    timestamp++;
+    while (next_broadcast < jobs.size() && next_broadcast < next_merge + max_inflight) {
+        MergeJob &job = jobs[next_broadcast];
+        job.start_ns = getCurrentSimTimeNano();
+        for (auto &&link : links) link->send(new ShardQueryEvent(next_broadcast, job.query));
+        next_broadcast++;
+    }
+    if (next_merge < jobs.size()) {
+        MergeJob &job = jobs[next_merge];
+        if (!job.merging && job.replies == shards) {
+            // the tree fills in merge_depth cycles, then gives one result every mergeII cycles
+            uint32_t out = std::min<size_t>(k, job.index.size());
+            job.merging = true;
+            job.merge_done = timestamp + merge_depth + (uint64_t) out * merge_ii;
+            stat_merge_cycles->addData(job.merge_done - timestamp);
+        }
+        if (job.merging && timestamp >= job.merge_done) {
+            phnswMerge::merge(job);
+            job.end_ns = getCurrentSimTimeNano();
+            job.done = true;
+            stat_merged->addData(1);
+            next_merge++;
+        }
+    }
+    if (next_merge == jobs.size()) {
+        primaryComponentOKToEndSim();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @description: W of one shard for one query, its node ids are turned into labels.
+ * @param {Event*} ev ShardResultEvent
+ * @return {*}
+ */
+void phnswMerge::handle_result(SST::Event *ev) {
+    ShardResultEvent *result = dynamic_cast<ShardResultEvent *>(ev);
+    if (!result || result->seq >= next_broadcast || result->shard >= shards) {
+        output.fatal(CALL_INFO, -1, "ERROR: unexpected event from a shard\n");
+    }
+    MergeJob &job = jobs[result->seq];
+    const std::vector<uint32_t> &label = labels[result->shard];
+    for (size_t n = 0; n < result->index.size(); n++) {
+        uint32_t node = result->index[n];
+        if (!label.empty() && node >= label.size()) {
+            output.fatal(CALL_INFO, -1, "ERROR: shard %u returned node %u, it has %zu\n", result->shard, node, label.size());
+        }
+        job.index.push_back(label.empty() ? node : label[node]);
+        job.dist.push_back(result->dist[n]);
+    }
+    // the shard that held the query longest is the one the merge waited for
+    if (result->queue_ns + result->search_ns >= job.queue_ns + job.search_ns) {
+        job.queue_ns = result->queue_ns;
+        job.search_ns = result->search_ns;
+    }
+    if (++job.replies == shards) job.replies_ns = getCurrentSimTimeNano();
+    delete ev;
+}
+
+/**
+ * @description: Global top k of a query: the k nearest of all shard results, ties by label.
+ * @param {MergeJob&} job every shard replied
+ * @return {*}
+ */
+void phnswMerge::merge(MergeJob &job) {
+    std::vector<size_t> order(job.index.size());
+    std::iota(order.begin(), order.end(), 0);
+    size_t out = std::min<size_t>(k, order.size());
+    std::partial_sort(order.begin(), order.begin() + out, order.end(), [&](size_t a, size_t b) {
+        return job.dist[a] != job.dist[b] ? job.dist[a] < job.dist[b] : job.index[a] < job.index[b];
+    });
+    std::vector<uint32_t> index(out), dist(out);
+    for (size_t n = 0; n < out; n++) {
+        index[n] = job.index[order[n]];
+        dist[n] = job.dist[order[n]];
+    }
+    job.index.swap(index);
+    job.dist.swap(dist);
+}
+
+/**
+ * @description: lifecycle function: finish,
+ *               print the end to end summary and write the per query log.
+ * @return {*}
+ */
+void phnswMerge::finish() {
+    size_t done = 0;
+    SST::SimTime_t sum_ns = 0, max_ns = 0, search_ns = 0, queue_ns = 0, network_ns = 0, merge_ns = 0;
+    for (auto &&job : jobs) {
+        if (!job.done) continue;
+        SST::SimTime_t ns = job.end_ns - job.start_ns;
+        SST::SimTime_t shard_ns = job.queue_ns + job.search_ns;
+        done++;
+        sum_ns += ns;
+        max_ns = std::max(max_ns, ns);
+        search_ns += job.search_ns;
+        queue_ns += job.queue_ns;
+        network_ns += job.replies_ns - job.start_ns - std::min<SST::SimTime_t>(shard_ns, job.replies_ns - job.start_ns);
+        merge_ns += job.end_ns - job.replies_ns;
+    }
+    if (!done) return;
+    SST::SimTime_t span_ns = jobs[done - 1].end_ns - jobs[0].start_ns;
+    output.output("Sharded: %zu queries on %u shards, avg latency %.3f us (shard queue %.3f us, slowest shard %.3f us, broadcast/return %.3f us, merge %.3f us), max latency %.3f us, %.1f QPS\n",
+        done, shards, (double) sum_ns / done / 1000, (double) queue_ns / done / 1000, (double) search_ns / done / 1000,
+        (double) network_ns / done / 1000, (double) merge_ns / done / 1000, (double) max_ns / 1000, span_ns ? done * 1e9 / span_ns : 0.0);
+    if (query_log.empty()) return;
+    std::ofstream log_file(query_log);
+    if (!log_file) {
+        output.fatal(CALL_INFO, -1, "ERROR: can not open queryLog %s\n", query_log.c_str());
+    }
+    log_file << "query,start_ns,replies_ns,end_ns,latency_ns,queue_ns,search_ns,top_index,top_dist\n";
+    for (auto &&job : jobs) {
+        if (!job.done) continue;
+        log_file << job.query << "," << job.start_ns << "," << job.replies_ns << "," << job.end_ns << ","
+        << job.end_ns - job.start_ns << "," << job.queue_ns << "," << job.search_ns << ","
+        << (job.index.empty() ? 0 : job.index[0]) << "," << (job.dist.empty() ? 0 : job.dist[0]) << "\n";
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-24 10:12:40
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-24 10:12:40
+ * @FilePath: /phnsw/src/phnswMerge.h
+ * @Description: host of a sharded index: broadcasts queries to the shard cores and merges their W
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#ifndef _PHNSW_MERGE_H
+#define _PHNSW_MERGE_H
+
+#include <sst/core/component.h>
+#include <sst/core/link.h>
+#include <sst/core/params.h>
+
+#include <string>
+#include <vector>
+
+#include "shardEvent.h"
+
+namespace SST {
+namespace phnsw {
+
+class phnswMerge : public SST::Component {
+
+public:
+    SST_ELI_REGISTER_COMPONENT(
+        phnswMerge,
+        "phnsw",
+        "phnswMerge",
+        SST_ELI_ELEMENT_VERSION( 1, 0, 0 ),
+        "Host of a sharded index: broadcasts every query to the shard cores and merges their results into a global top k",
+        COMPONENT_CATEGORY_UNCATEGORIZED
+    )
+
+    SST_ELI_DOCUMENT_PARAMS(
+        { "shards",         "(uint) Shard cores, connected on shard_0 .. shard_<shards - 1>", "1"},
+        { "shardImages",    "(list) Image of every shard, in shard order, for the labels (global ids) of its nodes; empty keeps the node ids", "[]"},
+        { "queryFile",      "(string) Text file with one query number per line (the query vectors of the images), empty for queryIndex, queryIndex + 1, ...", ""},
+        { "queries",        "(uint) Number of queries to run, 0 means every line of queryFile", "0"},
+        { "queryIndex",     "(uint) First query number when no queryFile is given", "0"},
+        { "k",              "(uint) Results of the merged top k", "10"},
+        { "maxInflight",    "(uint) Queries broadcast before the oldest one is merged", "1"},
+        { "mergeII",        "(uint) Cycles per result out of the merge tree", "1"},
+        { "clock",          "(string) Clock of the merge unit", "1GHz"},
+        { "queryLog",       "(string) CSV file for per query records, empty to disable", ""},
+        { "verbose",        "(uint) Output verbosity", "1"}
+    )
+
+    SST_ELI_DOCUMENT_PORTS(
+        {"shard_%(shards)d", "Link to the host_link of a shard core", { "phnsw.ShardQueryEvent", "phnsw.ShardResultEvent" } }
+    )
+
+    SST_ELI_DOCUMENT_STATISTICS(
+        { "merged_queries",   "Queries merged", "queries", 1 },
+        { "merge_cycles",     "Cycles the merge tree works on a query", "cycles", 1 }
+    )
+
+    phnswMerge( SST::ComponentId_t id, SST::Params& params );
+    ~phnswMerge() { }
+
+    virtual void setup() override;
+    virtual void finish() override;
+
+private:
+    SST::Output output;
+    SST::TimeConverter *clockTC;
+    SST::Clock::HandlerBase *clockHandler;
+    uint64_t timestamp;
+    bool clockTick( SST::Cycle_t currentCycle );
+    void handle_result(SST::Event *ev);
+
+    uint32_t shards;
+    std::vector<SST::Link *> links;
+    std::vector<std::vector<uint32_t>> labels;  // per shard, empty if node ids are kept
+    uint32_t k;
+    uint32_t max_inflight;
+    uint32_t merge_ii;
+    uint32_t merge_depth;   // levels of the tournament tree over the shard lists
+    std::string query_log;
+
+    /* One query from broadcast to the merged top k */
+    struct MergeJob {
+        uint32_t query;
+        uint32_t replies;       // shard results in
+        bool merging;
+        bool done;
+        uint64_t merge_done;    // timestamp the merge tree is through
+        SST::SimTime_t start_ns;        // broadcast
+        SST::SimTime_t replies_ns;      // last shard result in
+        SST::SimTime_t end_ns;          // merged
+        uint64_t search_ns;     // shard with the longest queue + search, first bundle to END
+        uint64_t queue_ns;      // that shard, arrival to its first bundle
+        std::vector<uint32_t> index;    // candidates of every shard, then the top k, labels
+        std::vector<uint32_t> dist;
+    };
+    std::vector<MergeJob> jobs;
+    size_t next_broadcast;  // first job not broadcast yet
+    size_t next_merge;      // oldest job not merged yet
+    void load_queries(SST::Params& params);
+    void merge(MergeJob &job);
+
+    Statistic<uint64_t>* stat_merged;
+    Statistic<uint64_t>* stat_merge_cycles;
+};
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
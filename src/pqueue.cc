@@ -0,0 +1,115 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-03 10:21:47
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-03 10:21:47
+ * @FilePath: /phnsw/src/pqueue.cc
+ * @Description: priority queue unit of the C and W lists
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#include <algorithm>
+
+#include "pqueue.h"
+
+using namespace SST::phnsw;
+
+QueueKind SST::phnsw::parse_queue_kind(const std::string &name, bool &ok) {
+    ok = true;
+    if (name == "shift") return QueueKind::SHIFT;
+    if (name == "systolic") return QueueKind::SYSTOLIC;
+    if (name == "heap") return QueueKind::HEAP;
+    ok = false;
+    return QueueKind::SHIFT;
+}
+
+QueueTiming SST::phnsw::queue_timing(QueueKind kind, uint32_t capacity) {
+    QueueTiming t;
+    switch (kind) {
+    case QueueKind::SYSTOLIC:
+        // a new operation every 2 cycles (compare, then swap with the neighbor),
+        // the head is ready next cycle, the tail once the ripple reached it
+        t.insert = {1, 2};
+        t.pop_min = {1, 2};
+        t.pop_max = {capacity, 2};
+        t.peek_max = {capacity, 2};
+        t.reg_cells = capacity;
+        t.sram_cells = 0;
+        t.comparators = capacity;
+        break;
+    case QueueKind::HEAP: {
+        // min-max heap: the min is the root, the max one of its children,
+        // insert sifts up and a pop sifts down one level per cycle
+        uint32_t levels = 1;
+        while (((uint64_t) 1 << levels) - 1 < capacity) levels++;
+        t.insert = {1, levels};
+        t.pop_min = {1, levels + 1};
+        t.pop_max = {2, levels + 1};
+        t.peek_max = {2, 2};
+        t.reg_cells = 0;
+        t.sram_cells = capacity;
+        t.comparators = 2;
+        break;
+    }
+    case QueueKind::SHIFT:
+    default:
+        // every cell compares with the broadcast key and shifts in the same cycle
+        t.insert = {1, 1};
+        t.pop_min = {1, 1};
+        t.pop_max = {1, 1};
+        t.peek_max = {1, 1};
+        t.reg_cells = capacity;
+        t.sram_cells = 0;
+        t.comparators = capacity;
+        break;
+    }
+    return t;
+}
+
+PriorityQueue::Insert PriorityQueue::insert(uint32_t d, uint32_t i) {
+    // first entry not smaller than d
+    uint32_t pos = std::lower_bound(dist, dist + *size, d) - dist;
+    if (pos < *size && dist[pos] == d && index[pos] == i) return DUPLICATE;
+    if (pos >= capacity) return DROPPED;
+    Insert res = INSERTED;
+    if (*size == capacity) {
+        res = EVICTED; // the max falls off the tail
+    } else {
+        (*size)++;
+    }
+    for (uint32_t n = *size - 1; n > pos; n--) {
+        dist[n] = dist[n - 1];
+        index[n] = index[n - 1];
+    }
+    dist[pos] = d;
+    index[pos] = i;
+    return res;
+}
+
+bool PriorityQueue::pop_min(uint32_t &d, uint32_t &i) {
+    if (*size == 0) return false;
+    d = dist[0];
+    i = index[0];
+    std::copy(dist + 1, dist + *size, dist);
+    std::copy(index + 1, index + *size, index);
+    (*size)--;
+    dist[*size] = 0;
+    index[*size] = 0;
+    return true;
+}
+
+bool PriorityQueue::pop_max(uint32_t &d, uint32_t &i) {
+    if (*size == 0) return false;
+    (*size)--;
+    d = dist[*size];
+    i = index[*size];
+    dist[*size] = 0;
+    index[*size] = 0;
+    return true;
+}
+
+void PriorityQueue::peek_max(uint32_t &d, uint32_t &i) const {
+    d = *size < capacity ? UINT32_MAX : dist[*size - 1];
+    i = *size ? index[*size - 1] : 0;
+}
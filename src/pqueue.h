@@ -0,0 +1,97 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-03 10:21:47
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-03 10:21:47
+ * @FilePath: /phnsw/src/pqueue.h
+ * @Description: priority queue unit of the C and W lists
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#ifndef _PHNSW_PQUEUE_H
+#define _PHNSW_PQUEUE_H
+
+#include <cstdint>
+#include <string>
+
+namespace SST {
+namespace phnsw {
+
+/*
+ * SHIFT:    register based sorted shift queue, every cell compares with the broadcast key,
+ *           min at the head and max at the tail, every operation in 1 cycle;
+ * SYSTOLIC: sorted systolic array, cells only talk to their neighbors, an operation enters
+ *           at the head every 2 cycles and ripples down, the tail (max) settles after capacity cycles;
+ * HEAP:     min-max heap in SRAM, one level per cycle, 2 comparators.
+ */
+enum class QueueKind { SHIFT, SYSTOLIC, HEAP };
+
+/**
+ * @description: parse "shift", "systolic" or "heap"
+ * @param {string&} name to parse
+ * @param {bool&} ok false if name is unknown
+ * @return {QueueKind}
+ */
+QueueKind parse_queue_kind(const std::string &name, bool &ok);
+
+/* Latency (issue to write back) and occupancy (cycles before the queue accepts the next
+ * operation) of every queue operation, and the storage and comparators it takes */
+struct QueueTiming {
+    struct Op { uint32_t latency, occupancy; };
+    Op insert, pop_min, pop_max, peek_max;
+    uint32_t reg_cells;     // entries in flip-flops
+    uint32_t sram_cells;    // entries in SRAM
+    uint32_t comparators;
+};
+
+/**
+ * @description: timing of a queue of capacity entries
+ * @param {QueueKind} kind
+ * @param {uint32_t} capacity at least 1
+ * @return {QueueTiming}
+ */
+QueueTiming queue_timing(QueueKind kind, uint32_t capacity);
+
+/*
+ * Functional model of a bounded priority queue kept in registers, (dist, index) pairs in
+ * ascending dist order. Results do not depend on the QueueKind, only the timing does.
+ */
+class PriorityQueue {
+public:
+    enum Insert { INSERTED, EVICTED, DROPPED, DUPLICATE };
+
+    PriorityQueue(uint32_t *dist, uint32_t *index, uint32_t *size, uint32_t capacity) :
+        dist(dist), index(index), size(size), capacity(capacity) { }
+
+    /**
+     * @description: insert (d, i), a full queue evicts its max, or drops (d, i) if it is not smaller
+     * @param {uint32_t} d dist
+     * @param {uint32_t} i index
+     * @return {Insert}
+     */
+    Insert insert(uint32_t d, uint32_t i);
+
+    bool pop_min(uint32_t &d, uint32_t &i);
+    bool pop_max(uint32_t &d, uint32_t &i);
+
+    /**
+     * @description: admission bound of the queue: the max once full, UINT32_MAX before,
+     *               so anything below it would be kept by insert
+     * @param {uint32_t&} d
+     * @param {uint32_t&} i index of the max, 0 if empty
+     * @return {*}
+     */
+    void peek_max(uint32_t &d, uint32_t &i) const;
+
+private:
+    uint32_t *dist;
+    uint32_t *index;
+    uint32_t *size;
+    uint32_t capacity;
+};
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
@@ -1,51 +1,28 @@
 #!/bin/bash
 
-# 初始值和数组
-declare -a time_us
-i=6
-
-# 循环执行 99 次
-for iter in {1..99}
-do
-    # echo "Iteration $iter: Modifying instructions.asm with i=$i"
-
-    # 定义文件路径
-    file_path="/home/miil/phnsw/src/instructions/instructions.asm"
-
-    # 使用 sed 替换第9行的内容为新的值
-    sed -i "9c\MOV [$i] DMAindex ; ep is index $i" "$file_path"
-
-    # 执行 make 和 sst 测试
-    output=$(make -j && sst ../tests/phnsw-test-001.py)
+# 一次 sst 跑完所有 query (batch mode), 不再每次改 instructions.asm 重新编译
+# query 1, ep 从 6 开始每次 +100, 共 99 个
+queries=${QUERIES:-99}
+query_log="time_us_queries.csv"
 
-    # 提取时间并累加
-    thistime=$(echo "$output" | grep -E 'Simulation is complete, simulated time: [0-9]+(\.[0-9]+)? (us|ns)' | awk '
-    {
-        time = $6
-        unit = $7
+make -j || exit 1
 
-        # 转换 ns 到 us
-        if (unit == "ns") {
-            time = time / 1000
-        }
+output=$(sst ../tests/phnsw-test-001.py --model-options="--queries $queries --queryIndex 1 --queryStride 0 --epPolicy stride --entryPoint 6 --epStride 100 --queryLog $query_log")
+if [ $? -ne 0 ]; then
+    echo "$output"
+    echo "Error occurred during simulation. Exiting."
+    exit 1
+fi
 
-        print time
-    }')
+echo "$output" | grep -E 'Batch:|Simulation is complete'
 
-    # 检查命令是否成功执行
-    if [ $? -ne 0 ]; then
-        echo "Error occurred during iteration $iter. Exiting."
-        exit 1
-    fi
-
-    time_us+=("$thistime")
-    echo "Recorded time: $thistime us"
-
-    # i += 100
-    i=$((i + 100))
-done
+# 每个 query 的时间 (ns -> us)
+declare -a time_us
+while IFS=, read -r query ep start_cycle end_cycle cycles start_ns end_ns top_index top_dist; do
+    time_us+=("$(echo "($end_ns - $start_ns) / 1000" | bc -l)")
+done < <(tail -n +2 "$query_log")
 
-echo "All iterations completed successfully."
+echo "All ${#time_us[@]} queries completed successfully."
 
 # 计算最大时间&算平均时间
 max_time=0
@@ -79,5 +56,5 @@ echo "Time values have been written to $output_file"
 echo "Recorded times (in us):"
 printf "%.3f " "${time_us[@]}"
 printf "\n"
-printf "Max time: $max_time us\n"
+printf "Max time: %.3f us\n" "$max_time"
 printf "Average time: %.3f us\n" "$avg_time"
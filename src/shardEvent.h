@@ -0,0 +1,70 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-06-24 10:12:40
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-06-24 10:12:40
+ * @FilePath: /phnsw/src/shardEvent.h
+ * @Description: events between phnswMerge and the shard cores of a sharded index
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#ifndef _PHNSW_SHARD_EVENT_H
+#define _PHNSW_SHARD_EVENT_H
+
+#include <cstdint>
+#include <vector>
+
+#include <sst/core/event.h>
+
+namespace SST {
+namespace phnsw {
+
+/* phnswMerge -> shard core: run query number query, the query vector is node nodes + query
+ * of the shard image */
+class ShardQueryEvent : public SST::Event {
+public:
+    uint32_t seq;       // position in the query set of phnswMerge
+    uint32_t query;
+
+    ShardQueryEvent() : SST::Event() { }
+    ShardQueryEvent(uint32_t seq, uint32_t query) : SST::Event(), seq(seq), query(query) { }
+
+    void serialize_order(SST::Core::Serialization::serializer &ser) override {
+        Event::serialize_order(ser);
+        ser & seq;
+        ser & query;
+    }
+    ImplementSerializable(SST::phnsw::ShardQueryEvent);
+};
+
+/* shard core -> phnswMerge: W of the query once it is done, nearest first, node ids of the shard */
+class ShardResultEvent : public SST::Event {
+public:
+    uint32_t seq;
+    uint32_t shard;
+    uint64_t search_ns;     // first bundle to the end of the query on the shard core
+    uint64_t queue_ns;      // arrival on the shard core to its first bundle
+    std::vector<uint32_t> index;
+    std::vector<uint32_t> dist;
+
+    ShardResultEvent() : SST::Event() { }
+    ShardResultEvent(uint32_t seq, uint32_t shard, uint64_t search_ns, uint64_t queue_ns) :
+        SST::Event(), seq(seq), shard(shard), search_ns(search_ns), queue_ns(queue_ns) { }
+
+    void serialize_order(SST::Core::Serialization::serializer &ser) override {
+        Event::serialize_order(ser);
+        ser & seq;
+        ser & shard;
+        ser & search_ns;
+        ser & queue_ns;
+        ser & index;
+        ser & dist;
+    }
+    ImplementSerializable(SST::phnsw::ShardResultEvent);
+};
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-05-27 15:08:12
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-05-27 15:08:12
+ * @FilePath: /phnsw/src/visited.cc
+ * @Description: on-chip visited set of the VST unit
+ * 
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved. 
+ */
+
+#include <algorithm>
+
+#include "visited.h"
+
+using namespace SST::phnsw;
+
+VisitMode SST::phnsw::parse_visit_mode(const std::string &name, bool &ok) {
+    ok = true;
+    if (name == "spm") return VisitMode::SPM;
+    if (name == "bitmap") return VisitMode::BITMAP;
+    if (name == "hash") return VisitMode::HASH;
+    if (name == "bloom") return VisitMode::BLOOM;
+    if (name == "epoch") return VisitMode::EPOCH;
+    ok = false;
+    return VisitMode::BITMAP;
+}
+
+void VisitedSet::init(VisitMode mode, uint64_t capacity, uint32_t hashes) {
+    VisitedSet::mode = mode;
+    VisitedSet::hashes = std::max<uint32_t>(hashes, 1);
+    if (mode == VisitMode::HASH) {
+        // power of 2 so a probe wraps with a mask
+        cap = 1;
+        while (cap < capacity) cap <<= 1;
+        table.assign(cap, 0);
+    } else {
+        cap = capacity;
+        bits.assign((cap + 63) / 64, 0);
+    }
+    clear();
+}
+
+void VisitedSet::clear() {
+    std::fill(bits.begin(), bits.end(), 0);
+    std::fill(table.begin(), table.end(), 0);
+    used = 0;
+    overflows = 0;
+}
+
+/**
+ * @description: splitmix64 finalizer
+ * @param {uint64_t} x
+ * @return {uint64_t}
+ */
+uint64_t VisitedSet::mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @description: bit of hash i of node, double hashing h1 + i * h2
+ */
+uint64_t VisitedSet::bloom_bit(uint32_t node, uint32_t i) const {
+    uint64_t h = mix(node);
+    uint64_t h1 = h & 0xffffffffull, h2 = (h >> 32) | 1;
+    return (h1 + i * h2) % cap;
+}
+
+bool VisitedSet::test(uint32_t node) const {
+    switch (mode) {
+    case VisitMode::HASH: {
+        uint64_t mask = cap - 1;
+        for (uint64_t n = 0, slot = mix(node) & mask; n < cap; n++, slot = (slot + 1) & mask) {
+            if (table[slot] == 0) return false;
+            if (table[slot] == node + 1) return true;
+        }
+        return false;
+    }
+    case VisitMode::BLOOM:
+        for (uint32_t i = 0; i < hashes; i++) {
+            uint64_t bit = bloom_bit(node, i);
+            if (!(bits[bit / 64] >> (bit % 64) & 1)) return false;
+        }
+        return true;
+    default:
+        return node < cap && (bits[node / 64] >> (node % 64) & 1);
+    }
+}
+
+bool VisitedSet::test_and_set(uint32_t node) {
+    switch (mode) {
+    case VisitMode::HASH: {
+        uint64_t mask = cap - 1;
+        for (uint64_t n = 0, slot = mix(node) & mask; n < cap; n++, slot = (slot + 1) & mask) {
+            if (table[slot] == node + 1) return true;
+            if (table[slot] == 0) {
+                table[slot] = node + 1;
+                used++;
+                return false;
+            }
+        }
+        overflows++;
+        return false;
+    }
+    case VisitMode::BLOOM: {
+        bool old = true;
+        for (uint32_t i = 0; i < hashes; i++) {
+            uint64_t bit = bloom_bit(node, i);
+            old = old && (bits[bit / 64] >> (bit % 64) & 1);
+            bits[bit / 64] |= 1ull << (bit % 64);
+        }
+        return old;
+    }
+    default: {
+        bool old = bits[node / 64] >> (node % 64) & 1;
+        bits[node / 64] |= 1ull << (node % 64);
+        return old;
+    }
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-05-27 15:08:12
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-05-27 15:08:12
+ * @FilePath: /phnsw/src/visited.h
+ * @Description: on-chip visited set of the VST unit
+ * 
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved. 
+ */
+
+#ifndef _PHNSW_VISITED_H
+#define _PHNSW_VISITED_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace SST {
+namespace phnsw {
+
+/*
+ * SPM:    the bitmap at SPM_VISIT_BASE in scratchpad, every access goes through the DMA;
+ * BITMAP: exact on-chip bitmap, one bit per node id below capacity;
+ * HASH:   exact on-chip open addressing table of capacity node ids,
+ *         ids that find it full are not recorded (they read as not visited);
+ * BLOOM:  on-chip Bloom filter of capacity bits and k hashes, may report false positives;
+ * EPOCH:  array of per node epoch tags in scratchpad or memory, through the DMA,
+ *         a node is visited if its tag is the epoch of the current query.
+ */
+enum class VisitMode { SPM, BITMAP, HASH, BLOOM, EPOCH };
+
+/**
+ * @description: parse "spm", "bitmap", "hash", "bloom" or "epoch"
+ * @param {string&} name to parse
+ * @param {bool&} ok false if name is unknown
+ * @return {VisitMode}
+ */
+VisitMode parse_visit_mode(const std::string &name, bool &ok);
+
+class VisitedSet {
+public:
+    /**
+     * @description: size the set for mode, capacity in bits (BITMAP, BLOOM) or ids (HASH)
+     * @param {VisitMode} mode BITMAP, HASH or BLOOM
+     * @param {uint64_t} capacity
+     * @param {uint32_t} hashes k of BLOOM
+     * @return {*}
+     */
+    void init(VisitMode mode, uint64_t capacity, uint32_t hashes);
+
+    bool test(uint32_t node) const;
+
+    /**
+     * @description: set node, return whether it was set before
+     * @param {uint32_t} node id
+     * @return {bool} old value
+     */
+    bool test_and_set(uint32_t node);
+
+    void clear();
+
+    uint64_t capacity() const { return cap; }
+    uint64_t overflows;     // HASH: ids not recorded because the table was full
+
+private:
+    VisitMode mode;
+    uint64_t cap;
+    uint32_t hashes;
+    uint64_t used;
+    std::vector<uint64_t> bits;     // BITMAP, BLOOM
+    std::vector<uint32_t> table;    // HASH, id + 1, 0 is empty
+
+    static uint64_t mix(uint64_t x);
+    uint64_t bloom_bit(uint32_t node, uint32_t i) const;
+};
+
+} // namespace phnsw
+} // namespace SST
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * @Author: Zeng GuangYi tgy_scut2021@outlook.com
+ * @Date: 2025-05-20 10:12:41
+ * @LastEditors: Zeng GuangYi tgy_scut2021@outlook.com
+ * @LastEditTime: 2025-05-20 10:12:41
+ * @FilePath: /phnsw/tests/distance_test.cc
+ * @Description: standalone check that every DIST kernel is bit-identical to the reference order
+ *               of distance.h, for every instruction set of the host (make -C src distance_test)
+ *
+ * Copyright (c) 2025 by ${git_name_email}, All Rights Reserved.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "distance.h"
+
+using namespace SST::phnsw;
+
+namespace {
+
+constexpr uint32_t LANES = 16;
+
+/* The reference of distance.h: lane i % 16 in increasing i, separate multiply and add,
+ * then the pairwise lane reduction. Kept apart from distance.cc on purpose */
+float reduce(float *lane) {
+    for (uint32_t width = LANES / 2; width > 0; width /= 2) {
+        for (uint32_t j = 0; j < width; j++) lane[j] = lane[j] + lane[j + width];
+    }
+    return lane[0];
+}
+
+float ref_f32(const float *a, const float *b, uint32_t dim) {
+    float lane[LANES] = {0};
+    for (uint32_t i = 0; i < dim; i++) {
+        float t = a[i] - b[i];
+        float sq = t * t;
+        lane[i % LANES] = lane[i % LANES] + sq;
+    }
+    return reduce(lane);
+}
+
+float ref_f16(const uint16_t *a, const uint16_t *b, uint32_t dim) {
+    float lane[LANES] = {0};
+    for (uint32_t i = 0; i < dim; i++) {
+        float t = half_to_float(a[i]) - half_to_float(b[i]);
+        float sq = t * t;
+        lane[i % LANES] = lane[i % LANES] + sq;
+    }
+    return reduce(lane);
+}
+
+float ref_u8(const uint8_t *a, const uint8_t *b, const float *weight, uint32_t dim) {
+    float lane[LANES] = {0};
+    for (uint32_t i = 0; i < dim; i++) {
+        int32_t t = (int32_t) a[i] - (int32_t) b[i];
+        float sq = (float) (t * t);
+        lane[i % LANES] = lane[i % LANES] + sq * weight[i];
+    }
+    return reduce(lane);
+}
+
+/* Any finite half, subnormals included: exponent field below 31 */
+uint16_t random_half(std::mt19937 &rng) {
+    uint32_t bits = rng();
+    return (uint16_t) ((bits & 0x8000) | (bits >> 16) % 31 << 10 | (bits & 0x3ff));
+}
+
+bool same_bits(float x, float y) {
+    return std::memcmp(&x, &y, sizeof(float)) == 0;
+}
+
+} // namespace
+
+int main() {
+    // the specialized dims, plus 97 that runs the generic kernel with a tail
+    const uint32_t dims[] = {96, 100, 128, 256, 384, 768, 960, 97};
+    const int rounds = 50;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> normal(0.0f, 40.0f);
+    std::uniform_int_distribution<uint32_t> byte(0, 255);
+    std::uniform_real_distribution<float> scale(0.001f, 2.0f);
+    int failures = 0, checks = 0;
+
+    for (int l = 0; l <= (int) detect_simd(); l++) {
+        SimdLevel level = (SimdLevel) l;
+        for (uint32_t dim : dims) {
+            L2sqFn f32 = select_l2sq(dim, level);
+            L2sqF16Fn f16 = select_l2sq_f16(dim, level);
+            L2sqU8Fn u8 = select_l2sq_u8(dim, level);
+            std::vector<float> a(dim), b(dim), weight(dim);
+            std::vector<uint16_t> ha(dim), hb(dim);
+            std::vector<uint8_t> ca(dim), cb(dim);
+            for (int r = 0; r < rounds; r++) {
+                for (uint32_t i = 0; i < dim; i++) {
+                    a[i] = normal(rng);
+                    b[i] = normal(rng);
+                    ha[i] = random_half(rng);
+                    hb[i] = random_half(rng);
+                    ca[i] = (uint8_t) byte(rng);
+                    cb[i] = (uint8_t) byte(rng);
+                    float s = scale(rng);
+                    weight[i] = s * s;
+                }
+                struct { const char *format; float got, want; } results[] = {
+                    {"f32", f32(a.data(), b.data(), dim), ref_f32(a.data(), b.data(), dim)},
+                    {"f16", f16(ha.data(), hb.data(), dim), ref_f16(ha.data(), hb.data(), dim)},
+                    {"u8", u8(ca.data(), cb.data(), weight.data(), dim), ref_u8(ca.data(), cb.data(), weight.data(), dim)},
+                };
+                for (auto &&result : results) {
+                    checks++;
+                    if (same_bits(result.got, result.want)) continue;
+                    if (failures++ < 20) {
+                        std::printf("FAIL %s %s dim %u round %d: %.9g, reference %.9g\n",
+                            simd_name(level), result.format, dim, r, result.got, result.want);
+                    }
+                }
+            }
+        }
+        std::printf("%s: checked\n", simd_name(level));
+    }
+    std::printf("%d of %d DIST results differ from the reference\n", failures, checks);
+    return failures ? 1 : 0;
+}
@@ -1,8 +1,40 @@
 import sst
 import sys
+import argparse
 sys.path.append('../tests/')
 from mhlib import componentlist
 
+# Batch mode options, e.g. sst phnsw-test-001.py --model-options="--queries 99 --epPolicy stride"
+parser = argparse.ArgumentParser()
+parser.add_argument("--queryFile", help="one query per line: '<query index> [entry point]'")
+parser.add_argument("--queries", type=int, help="number of queries to run")
+parser.add_argument("--queryIndex", type=int, help="first query index without queryFile")
+parser.add_argument("--queryStride", type=int, help="query index step without queryFile")
+parser.add_argument("--epPolicy", choices=["fixed", "list", "stride"])
+parser.add_argument("--entryPoint", type=int)
+parser.add_argument("--entryPoints", help="entry points for epPolicy list, e.g. [6,106,206]")
+parser.add_argument("--epStride", type=int)
+parser.add_argument("--queryLog", help="csv file for per query records")
+parser.add_argument("--prefetchDepth", type=int, help="raw vectors prefetched ahead of RAW S, 0 disables")
+parser.add_argument("--queueKind", choices=["shift", "systolic", "heap"], help="priority queue unit of C and W")
+parser.add_argument("--ef", type=int, help="entries of W")
+parser.add_argument("--queueCCapacity", type=int, help="entries of C")
+parser.add_argument("--imageFile", help="image with a layout header from datasetx/build_image.py, in place of siftsmall")
+parser.add_argument("--memSize", default="1024MiB", help="memory size, at least the image size")
+parser.add_argument("--rerankR", type=int, help="entries of W re-ranked with raw vectors after END, 0 disables")
+parser.add_argument("--rerankK", type=int, help="results kept after the re-rank")
+parser.add_argument("--contexts", type=int, help="query contexts per core, issue switches between them on a stall")
+parser.add_argument("--contextPolicy", choices=["round-robin", "oldest"])
+parser.add_argument("--batchSize", type=int, help="contexts per batch sharing fetched raw vectors through a batched DIST, 1 disables")
+parser.add_argument("--batchWindow", type=int, help="pending queries an idle context of a batch picks from")
+parser.add_argument("--program", help="search program, e.g. instructions/pq.asm for an image built with --pq")
+parser.add_argument("--scratchSize", type=int, default=4096, help="scratchpad bytes, a PQ image needs room for the ADC table")
+args = parser.parse_args()
+mem_size = args.memSize
+scratch_size = args.scratchSize
+del args.memSize, args.scratchSize
+memory_file = args.imageFile or '../src/datasetx/unpack/siftsmall/output.bin'
+
 DEBUG_SCRATCH = 0
 DEBUG_MEM = 0
 
@@ -10,38 +42,44 @@ comp_cpu = sst.Component("phnsw", "phnsw.phnsw")
 comp_cpu.addParams({
     "printFrequency" : "5",
     "repeats" : "15",
-    "scratchSize" : 2048,   # 2K scratch
-    "maxAddr" : 4096,       # 4K mem
+    "scratchSize" : scratch_size,   # 4K scratch: 2K as before + prefetch ring (+ ADC table)
+    "maxAddr" : 2 * scratch_size,
     "scratchLineSize" : 64,
     "memLineSize" : 64,
     "clock" : "1GHz",
     "maxOutstandingRequests" : 16,
     "maxRequestsPerCycle" : 2,
     "reqsToIssue" : 2,
+    "prefetchDepth" : 4,
+    "prefetchBase" : max(2048, 640 * (args.contexts or 1)),  # ring of 4 x 512B per context, after the staging areas of the contexts
     "verbose" : 1
     })
+comp_cpu.addParams({k : v for k, v in vars(args).items() if v is not None})
 
 dma = comp_cpu.setSubComponent("dma", "phnsw.phnswDMA")
 dma.addParams({
     "printFrequency" : "5",
     "repeats" : "15",
-    "scratchSize" : 2048,   # 2K scratch
-    "maxAddr" : 4096,       # 4K mem
+    "scratchSize" : scratch_size,   # 4K scratch: 2K as before + prefetch ring (+ ADC table)
+    "maxAddr" : 2 * scratch_size,
     "scratchLineSize" : 512,
     "memLineSize" : 512,
     "clock" : "1GHz",
     "maxOutstandingRequests" : 16,
+    "spmPortWidth" : 64,
     "maxRequestsPerCycle" : 2,
     "reqsToIssue" : 2,
     "verbose" : 1
     })
+if args.imageFile:
+    dma.addParam("imageFile", args.imageFile)
 iface_dma = dma.setSubComponent("memory", "memHierarchy.standardInterface")
 comp_scratch_dma = sst.Component("scratch_dma", "memHierarchy.Scratchpad")
 comp_scratch_dma.addParams({
     "debug" : DEBUG_SCRATCH,
     "debug_level" : 10,
     "clock" : "2GHz",
-    "size" : "2KiB",
+    "size" : "%dB" % scratch_size,
     "scratch_line_size" : 64,
     "memory_line_size" : 64,
     "backing" : "mmap",
@@ -51,7 +89,7 @@ scratch_conv_dma = comp_scratch_dma.setSubComponent("backendConvertor", "memHier
 scratch_back_dma = scratch_conv_dma.setSubComponent("backend", "memHierarchy.simpleMem")
 scratch_back_dma.addParams({
     "access_time" : "900ps",
-    "mem_size" : "2KiB"
+    "mem_size" : "%dB" % scratch_size
 })
 scratch_conv_dma.addParams({
     "debug_location" : 0,
@@ -64,12 +102,12 @@ memctrl_dma.addParams({
       "debug_level" : 10,
       "addr_range_start" : 0,
       "backing" : "mmap",
-      "memory_file" : '../src/datasetx/unpack/siftsmall/output.bin'
+      "memory_file" : memory_file
 })
 memory_dma = memctrl_dma.setSubComponent("backend", "memHierarchy.simpleMem")
 memory_dma.addParams({
     "access_time" : "85 ns", # TODO
-    "mem_size" : "1024MiB"
+    "mem_size" : mem_size
 })
 
 
@@ -97,6 +135,15 @@ sst.setStatisticLoadLevel(5)
 # Enable statistics for all the component
 sst.enableAllStatisticsForAllComponents()
 
+# DMA request latency as a histogram (cycles)
+dma.enableStatistics(["req_latency"], {
+    "type" : "sst.HistogramStatistic",
+    "minvalue" : "0",
+    "binwidth" : "10",
+    "numbins" : "20",
+    "IncludeOutOfBounds" : "1"
+})
+
 print ("\nCompleted configuring the phnsw model\n")
 
 ################################ The End ################################
@@ -0,0 +1,203 @@
+import sst
+import sys
+import os
+import argparse
+sys.path.append('../tests/')
+from mhlib import componentlist
+
+# Multi-core: --cores phnsw cores, each with its own DMA and scratchpad, share --memControllers
+# memory controllers through one memHierarchy bus. Every core runs its share of the query set.
+# e.g. sst phnsw-test-002.py --model-options="--cores 4 --memControllers 2 --queries 64"
+parser = argparse.ArgumentParser()
+parser.add_argument("--cores", type=int, default=4, help="phnsw cores")
+parser.add_argument("--memControllers", type=int, default=1, help="memory controllers, interleaved by --interleave")
+parser.add_argument("--interleave", type=int, default=4096, help="bytes per controller before the next one")
+parser.add_argument("--memReqsPerCycle", type=int, default=1, help="requests a memory controller serves per cycle")
+parser.add_argument("--busFrequency", default="2GHz", help="clock of the bus between the scratchpads and the controllers")
+parser.add_argument("--queryFile", help="one query per line: '<query index> [entry point]'")
+parser.add_argument("--queries", type=int, help="number of queries to run, over all cores")
+parser.add_argument("--queryIndex", type=int, help="first query index without queryFile")
+parser.add_argument("--queryStride", type=int, help="query index step without queryFile")
+parser.add_argument("--epPolicy", choices=["fixed", "list", "stride"])
+parser.add_argument("--entryPoint", type=int)
+parser.add_argument("--entryPoints", help="entry points for epPolicy list, e.g. [6,106,206]")
+parser.add_argument("--epStride", type=int)
+parser.add_argument("--queryLog", help="csv file for per query records, core c writes <name>.core<c>.csv")
+parser.add_argument("--prefetchDepth", type=int, help="raw vectors prefetched ahead of RAW S, 0 disables")
+parser.add_argument("--queueKind", choices=["shift", "systolic", "heap"], help="priority queue unit of C and W")
+parser.add_argument("--ef", type=int, help="entries of W")
+parser.add_argument("--queueCCapacity", type=int, help="entries of C")
+parser.add_argument("--visitMode", choices=["spm", "bitmap", "hash", "bloom", "epoch"])
+parser.add_argument("--imageFile", help="image with a layout header from datasetx/build_image.py, in place of siftsmall")
+parser.add_argument("--memSize", default="1024MiB", help="memory size, at least the image size")
+parser.add_argument("--program", help="search program, e.g. instructions/pq.asm for an image built with --pq")
+parser.add_argument("--scratchSize", type=int, default=4096, help="scratchpad bytes of every core")
+parser.add_argument("--rerankR", type=int, help="entries of W re-ranked with raw vectors after END, 0 disables")
+parser.add_argument("--rerankK", type=int, help="results kept after the re-rank")
+parser.add_argument("--contexts", type=int, help="query contexts per core, issue switches between them on a stall")
+parser.add_argument("--contextPolicy", choices=["round-robin", "oldest"])
+parser.add_argument("--batchSize", type=int, help="contexts per batch sharing fetched raw vectors through a batched DIST, 1 disables")
+parser.add_argument("--batchWindow", type=int, help="pending queries an idle context of a batch picks from")
+args = parser.parse_args()
+cores = args.cores
+controllers = args.memControllers
+interleave = args.interleave
+mem_size = args.memSize
+scratch_size = args.scratchSize
+mem_reqs = args.memReqsPerCycle
+bus_frequency = args.busFrequency
+query_log = args.queryLog
+del args.cores, args.memControllers, args.interleave, args.memReqsPerCycle, args.busFrequency
+del args.memSize, args.scratchSize, args.queryLog
+memory_file = args.imageFile or '../src/datasetx/unpack/siftsmall/output.bin'
+
+DEBUG_SCRATCH = 0
+DEBUG_MEM = 0
+
+if cores < 1 or controllers < 1:
+    sys.exit("--cores and --memControllers must be at least 1")
+if args.visitMode == "epoch":
+    # the tag arrays of the cores would overlap at visitBase
+    sys.exit("--visitMode epoch keeps its tags at one visitBase, use an on-chip visited set with several cores")
+
+def parse_size(size):
+    units = {"B" : 1, "KiB" : 1 << 10, "MiB" : 1 << 20, "GiB" : 1 << 30}
+    for unit, scale in sorted(units.items(), key=lambda u: -len(u[0])):
+        if size.endswith(unit):
+            return int(float(size[:-len(unit)]) * scale)
+    return int(size)
+
+def split_image(path, parts, block):
+    """ A controller only holds its interleaved blocks, at its local addresses: part p of the
+        image is blocks p, p + parts, p + 2 * parts, ... Parts are kept next to the image. """
+    names = ["%s.mc%dof%d.%d" % (path, p, parts, block) for p in range(parts)]
+    mtime = os.path.getmtime(path)
+    if all(os.path.exists(n) and os.path.getmtime(n) >= mtime for n in names):
+        return names
+    print("Splitting %s over %d controllers" % (path, parts))
+    outs = [open(n, "wb") for n in names]
+    with open(path, "rb") as image:
+        p = 0
+        while True:
+            data = image.read(block)
+            if not data:
+                break
+            outs[p].write(data)
+            p = (p + 1) % parts
+    for out in outs:
+        out.close()
+    return names
+
+memory_files = [memory_file] if controllers == 1 else split_image(memory_file, controllers, interleave)
+
+membus = sst.Component("membus", "memHierarchy.Bus")
+membus.addParams({
+    "bus_frequency" : bus_frequency,
+})
+
+for core in range(cores):
+    comp_cpu = sst.Component("core%d" % core, "phnsw.phnsw")
+    comp_cpu.addParams({
+        "printFrequency" : "5",
+        "repeats" : "15",
+        "scratchSize" : scratch_size,   # 4K scratch: 2K as before + prefetch ring
+        "maxAddr" : 2 * scratch_size,
+        "scratchLineSize" : 64,
+        "memLineSize" : 64,
+        "clock" : "1GHz",
+        "maxOutstandingRequests" : 16,
+        "maxRequestsPerCycle" : 2,
+        "reqsToIssue" : 2,
+        "prefetchDepth" : 4,
+        "prefetchBase" : max(2048, 640 * (args.contexts or 1)),  # ring of 4 x 512B per context, after the staging areas of the contexts
+        "cores" : cores,
+        "coreId" : core,
+        "verbose" : 1 if core == 0 else 0
+        })
+    comp_cpu.addParams({k : v for k, v in vars(args).items() if v is not None})
+    if query_log:
+        comp_cpu.addParam("queryLog", "%s.core%d.csv" % (os.path.splitext(query_log)[0], core))
+
+    dma = comp_cpu.setSubComponent("dma", "phnsw.phnswDMA")
+    dma.addParams({
+        "printFrequency" : "5",
+        "repeats" : "15",
+        "scratchSize" : scratch_size,
+        "maxAddr" : 2 * scratch_size,
+        "scratchLineSize" : 512,
+        "memLineSize" : 512,
+        "clock" : "1GHz",
+        "maxOutstandingRequests" : 16,
+        "spmPortWidth" : 64,
+        "maxRequestsPerCycle" : 2,
+        "reqsToIssue" : 2,
+        "verbose" : 1 if core == 0 else 0
+        })
+    if args.imageFile:
+        dma.addParam("imageFile", args.imageFile)
+    iface_dma = dma.setSubComponent("memory", "memHierarchy.standardInterface")
+    comp_scratch = sst.Component("scratch%d" % core, "memHierarchy.Scratchpad")
+    comp_scratch.addParams({
+        "debug" : DEBUG_SCRATCH,
+        "debug_level" : 10,
+        "clock" : "2GHz",
+        "size" : "%dB" % scratch_size,
+        "scratch_line_size" : 64,
+        "memory_line_size" : 64,
+        "backing" : "mmap",
+        "initBacking" : 1
+    })
+    scratch_conv = comp_scratch.setSubComponent("backendConvertor", "memHierarchy.simpleMemScratchBackendConvertor")
+    scratch_back = scratch_conv.setSubComponent("backend", "memHierarchy.simpleMem")
+    scratch_back.addParams({
+        "access_time" : "900ps",
+        "mem_size" : "%dB" % scratch_size
+    })
+    scratch_conv.addParams({
+        "debug_location" : 0,
+        "debug_level" : 10,
+    })
+
+    link_dma_scratch = sst.Link("link_dma_scratch%d" % core)
+    link_dma_scratch.connect( (iface_dma, "port", "10ps"), (comp_scratch, "cpu", "10ps") )
+    link_scratch_bus = sst.Link("link_scratch_bus%d" % core)
+    link_scratch_bus.connect( (comp_scratch, "memory", "10ps"), (membus, "high_network_%d" % core, "10ps") )
+
+for mc in range(controllers):
+    memctrl = sst.Component("memory%d" % mc, "memHierarchy.MemController")
+    memctrl.addParams({
+        "clock" : "1GHz",
+        "debug" : DEBUG_MEM,
+        "debug_level" : 10,
+        "addr_range_start" : mc * interleave,
+        "backing" : "mmap",
+        "memory_file" : memory_files[mc]
+    })
+    if controllers > 1:
+        memctrl.addParams({
+            "interleave_size" : "%dB" % interleave,
+            "interleave_step" : "%dB" % (controllers * interleave),
+        })
+    memory = memctrl.setSubComponent("backend", "memHierarchy.simpleMem")
+    memory.addParams({
+        "access_time" : "85 ns", # TODO
+        "mem_size" : "%dB" % (parse_size(mem_size) // controllers),
+        "max_requests_per_cycle" : mem_reqs
+    })
+    link_bus_mem = sst.Link("link_bus_mem%d" % mc)
+    link_bus_mem.connect( (membus, "low_network_%d" % mc, "10ps"), (memctrl, "direct_link", "10ps") )
+
+
+#########################################################################
+## Statistics
+#########################################################################
+
+# Generate statistics in CSV format
+sst.setStatisticOutput("sst.statoutputcsv")
+sst.setStatisticOutputOptions( { "filepath"  : "stats_phnsw.csv" })
+sst.setStatisticLoadLevel(5)
+sst.enableAllStatisticsForAllComponents()
+
+print ("\nCompleted configuring the phnsw model: %d cores, %d memory controllers\n" % (cores, controllers))
+
+################################ The End ################################
@@ -0,0 +1,140 @@
+import sst
+import sys
+import argparse
+sys.path.append('../tests/')
+from mhlib import componentlist
+
+# Sharded index: --shards cores, each with its own DMA, scratchpad and memory controller holding
+# one shard image (datasetx/build_image.py --shard s --shards S). phnswMerge broadcasts every
+# query to all shards over links of --linkLatency and merges their W into the global top k.
+# e.g. sst phnsw-test-003.py --model-options="--shards 4 --shardImages sift/shard%d.bin --memSize 2GiB --queries 100"
+parser = argparse.ArgumentParser()
+parser.add_argument("--shards", type=int, default=2, help="shard cores")
+parser.add_argument("--shardImages", required=True, help="image of shard s, with %%d for s, e.g. sift/shard%%d.bin")
+parser.add_argument("--linkLatency", default="200ns", help="latency from phnswMerge to a shard core and back, each way")
+parser.add_argument("--k", type=int, help="results of the merged top k")
+parser.add_argument("--maxInflight", type=int, help="queries broadcast before the oldest one is merged")
+parser.add_argument("--mergeII", type=int, help="cycles per result out of the merge tree")
+parser.add_argument("--queryFile", help="one query number per line (query vectors of the images)")
+parser.add_argument("--queries", type=int, help="number of queries to run")
+parser.add_argument("--queryIndex", type=int, help="first query number without queryFile")
+parser.add_argument("--queryLog", help="csv file for per query end to end records")
+parser.add_argument("--memSize", default="1024MiB", help="memory size of every shard, at least its image size")
+parser.add_argument("--scratchSize", type=int, default=4096, help="scratchpad bytes of every core")
+parser.add_argument("--program", help="search program, e.g. instructions/pq.asm for images built with --pq")
+parser.add_argument("--ef", type=int, help="entries of W")
+parser.add_argument("--rerankR", type=int, help="entries of W re-ranked with raw vectors after END, 0 disables")
+parser.add_argument("--rerankK", type=int, help="results kept after the re-rank")
+args = parser.parse_args()
+
+DEBUG_SCRATCH = 0
+DEBUG_MEM = 0
+
+shards = args.shards
+images = [args.shardImages % s for s in range(shards)]
+scratch_size = args.scratchSize
+
+merge = sst.Component("merge", "phnsw.phnswMerge")
+merge.addParams({
+    "shards" : shards,
+    "shardImages" : "[%s]" % ",".join(images),
+    "clock" : "1GHz",
+    "verbose" : 1
+})
+merge.addParams({k : v for k, v in vars(args).items()
+                 if v is not None and k in ("k", "maxInflight", "mergeII", "queryFile", "queries", "queryIndex", "queryLog")})
+
+for shard in range(shards):
+    comp_cpu = sst.Component("shard%d" % shard, "phnsw.phnsw")
+    comp_cpu.addParams({
+        "printFrequency" : "5",
+        "repeats" : "15",
+        "scratchSize" : scratch_size,
+        "maxAddr" : 2 * scratch_size,
+        "scratchLineSize" : 64,
+        "memLineSize" : 64,
+        "clock" : "1GHz",
+        "maxOutstandingRequests" : 16,
+        "maxRequestsPerCycle" : 2,
+        "reqsToIssue" : 2,
+        "prefetchDepth" : 4,
+        "prefetchBase" : 2048,  # ring of 4 x 512B after the visited bitmap
+        "verbose" : 1 if shard == 0 else 0
+        })
+    comp_cpu.addParams({k : v for k, v in vars(args).items()
+                        if v is not None and k in ("program", "ef", "rerankR", "rerankK")})
+
+    dma = comp_cpu.setSubComponent("dma", "phnsw.phnswDMA")
+    dma.addParams({
+        "printFrequency" : "5",
+        "repeats" : "15",
+        "scratchSize" : scratch_size,
+        "maxAddr" : 2 * scratch_size,
+        "scratchLineSize" : 512,
+        "memLineSize" : 512,
+        "clock" : "1GHz",
+        "maxOutstandingRequests" : 16,
+        "spmPortWidth" : 64,
+        "maxRequestsPerCycle" : 2,
+        "reqsToIssue" : 2,
+        "imageFile" : images[shard],
+        "verbose" : 1 if shard == 0 else 0
+        })
+    iface_dma = dma.setSubComponent("memory", "memHierarchy.standardInterface")
+    comp_scratch = sst.Component("scratch%d" % shard, "memHierarchy.Scratchpad")
+    comp_scratch.addParams({
+        "debug" : DEBUG_SCRATCH,
+        "debug_level" : 10,
+        "clock" : "2GHz",
+        "size" : "%dB" % scratch_size,
+        "scratch_line_size" : 64,
+        "memory_line_size" : 64,
+        "backing" : "mmap",
+        "initBacking" : 1
+    })
+    scratch_conv = comp_scratch.setSubComponent("backendConvertor", "memHierarchy.simpleMemScratchBackendConvertor")
+    scratch_back = scratch_conv.setSubComponent("backend", "memHierarchy.simpleMem")
+    scratch_back.addParams({
+        "access_time" : "900ps",
+        "mem_size" : "%dB" % scratch_size
+    })
+    scratch_conv.addParams({
+        "debug_location" : 0,
+        "debug_level" : 10,
+    })
+    memctrl = sst.Component("memory%d" % shard, "memHierarchy.MemController")
+    memctrl.addParams({
+        "clock" : "1GHz",
+        "debug" : DEBUG_MEM,
+        "debug_level" : 10,
+        "addr_range_start" : 0,
+        "backing" : "mmap",
+        "memory_file" : images[shard]
+    })
+    memory = memctrl.setSubComponent("backend", "memHierarchy.simpleMem")
+    memory.addParams({
+        "access_time" : "85 ns", # TODO
+        "mem_size" : args.memSize
+    })
+
+    link_dma_scratch = sst.Link("link_dma_scratch%d" % shard)
+    link_dma_scratch.connect( (iface_dma, "port", "10ps"), (comp_scratch, "cpu", "10ps") )
+    link_scratch_mem = sst.Link("link_scratch_mem%d" % shard)
+    link_scratch_mem.connect( (comp_scratch, "memory", "10ps"), (memctrl, "direct_link", "10ps") )
+    link_host = sst.Link("link_host%d" % shard)
+    link_host.connect( (merge, "shard_%d" % shard, args.linkLatency), (comp_cpu, "host_link", args.linkLatency) )
+
+
+#########################################################################
+## Statistics
+#########################################################################
+
+# Generate statistics in CSV format
+sst.setStatisticOutput("sst.statoutputcsv")
+sst.setStatisticOutputOptions( { "filepath"  : "stats_phnsw.csv" })
+sst.setStatisticLoadLevel(5)
+sst.enableAllStatisticsForAllComponents()
+
+print ("\nCompleted configuring the phnsw model: %d shards\n" % shards)
+
+################################ The End ################################